@@ -0,0 +1,80 @@
+#include "allocation_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+    std::atomic<bool> g_enabled{false};
+    std::atomic<uint64_t> g_allocations{0};
+    std::atomic<uint64_t> g_bytes{0};
+
+    void *allocate(std::size_t size) noexcept {
+        if (g_enabled.load(std::memory_order_relaxed)) {
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+            g_bytes.fetch_add(size, std::memory_order_relaxed);
+        }
+        return std::malloc(size ? size : 1);
+    }
+
+    void *allocateOrThrow(std::size_t size) {
+        void *memory = allocate(size);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+} // namespace
+
+void AllocationCounter::enable() {
+    g_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool AllocationCounter::enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+AllocationCounter::Totals AllocationCounter::totals() {
+    return {g_allocations.load(std::memory_order_relaxed), g_bytes.load(std::memory_order_relaxed)};
+}
+
+void *operator new(std::size_t size) {
+    return allocateOrThrow(size);
+}
+
+void *operator new[](std::size_t size) {
+    return allocateOrThrow(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+    std::free(memory);
+}
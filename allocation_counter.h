@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Counts heap allocations made through the global `operator new`, which this module replaces. Counting is off
+ * until `enable()` is called, so normal compiles pay one relaxed load per allocation. The counters are
+ * process-wide: allocations by pool workers are included, and so are those of other files compiled at the
+ * same time in batch mode.
+ */
+class AllocationCounter {
+public:
+    struct Totals {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    static void enable();
+
+    static bool enabled();
+
+    static Totals totals();
+};
@@ -0,0 +1,120 @@
+#include "arena.h"
+#include <cstdlib>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+Arena::Arena(size_t block_size) : m_block_size(block_size) {}
+
+Arena::~Arena() {
+    reset();
+}
+
+/**
+ * @brief Allocates uninitialised memory from the current block, starting a new block when it is full.
+ *
+ * @param size The number of bytes to allocate.
+ * @param alignment The required alignment; must be a power of two.
+ * @return A pointer to the allocated memory.
+ */
+void *Arena::allocate(size_t size, size_t alignment) {
+    auto aligned = (reinterpret_cast<uintptr_t>(m_cursor) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    if (!m_cursor || aligned + size > reinterpret_cast<uintptr_t>(m_end)) {
+        addBlock(size + alignment);
+        aligned = (reinterpret_cast<uintptr_t>(m_cursor) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    }
+    m_cursor = reinterpret_cast<char *>(aligned + size);
+    m_bytes_used += size;
+    return reinterpret_cast<void *>(aligned);
+}
+
+void Arena::addBlock(size_t minimum_size) {
+    size_t size = std::max(m_block_size, minimum_size + sizeof(Block));
+    Block *block = nullptr;
+    for (Block **spare = &m_spare; *spare; spare = &(*spare)->next) {
+        if ((*spare)->size >= size) {
+            block = *spare;
+            *spare = block->next;
+            size = block->size;
+            break;
+        }
+    }
+    if (!block) {
+        block = static_cast<Block *>(std::malloc(size));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        block->size = size;
+    }
+    block->next = m_blocks;
+    m_blocks = block;
+    m_cursor = reinterpret_cast<char *>(block + 1);
+    m_end = reinterpret_cast<char *>(block) + size;
+}
+
+/**
+ * @brief Copies a string into the arena.
+ *
+ * @param text The text to copy.
+ * @return A view of the copy, valid for the lifetime of the arena.
+ */
+std::string_view Arena::copyString(std::string_view text) {
+    if (text.empty()) {
+        return {};
+    }
+    auto *copy = static_cast<char *>(allocate(text.size(), 1));
+    std::memcpy(copy, text.data(), text.size());
+    return {copy, text.size()};
+}
+
+/**
+ * @brief Releases everything allocated from the arena at once.
+ *
+ * @details Cost is proportional to the number of blocks, not the number of objects; no destructors run.
+ */
+void Arena::reset() {
+    clear();
+    while (m_spare) {
+        Block *next = m_spare->next;
+        std::free(m_spare);
+        m_spare = next;
+    }
+}
+
+/**
+ * @brief Releases everything allocated since `mark` was taken, keeping the blocks for reuse.
+ *
+ * @details Objects allocated before the mark are untouched, so a caller can hold on to them while discarding
+ *          a batch of later ones. Marks taken after `mark` become invalid.
+ *
+ * @param mark A mark taken from this arena since it was last cleared.
+ */
+void Arena::rewind(const Mark &mark) {
+    while (m_blocks != mark.block) {
+        Block *next = m_blocks->next;
+        m_blocks->next = m_spare;
+        m_spare = m_blocks;
+        m_blocks = next;
+    }
+    m_cursor = mark.cursor;
+    m_end = mark.end;
+    m_bytes_used = mark.bytes_used;
+    m_objects = mark.objects;
+}
+
+/**
+ * @brief Releases everything allocated from the arena but keeps its blocks, so the next translation unit
+ *        compiled with the same arena allocates from memory that is already mapped.
+ */
+void Arena::clear() {
+    while (m_blocks) {
+        Block *next = m_blocks->next;
+        m_blocks->next = m_spare;
+        m_spare = m_blocks;
+        m_blocks = next;
+    }
+    m_cursor = nullptr;
+    m_end = nullptr;
+    m_bytes_used = 0;
+    m_objects = 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Bump allocator that owns every node of a translation unit. Objects are never destroyed individually: they
+ * must be trivially destructible, and the whole arena is released at once.
+ */
+class Arena {
+    struct Block;
+
+public:
+    /** A point to rewind to: everything allocated after it can be released while what came before stays. */
+    struct Mark {
+        Block *block;
+        char *cursor;
+        char *end;
+        size_t bytes_used;
+        size_t objects;
+    };
+
+    explicit Arena(size_t block_size = 64 * 1024);
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena();
+
+    void *allocate(size_t size, size_t alignment);
+
+    template<typename T, typename... Args>
+    T *make(Args &&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena objects are never destroyed");
+        ++m_objects;
+        return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    T *makeArray(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena objects are never destroyed");
+        return new(allocate(sizeof(T) * count, alignof(T))) T[count]();
+    }
+
+    std::string_view copyString(std::string_view text);
+
+    void reset();
+
+    void clear();
+
+    Mark mark() const { return {m_blocks, m_cursor, m_end, m_bytes_used, m_objects}; }
+
+    void rewind(const Mark &mark);
+
+    size_t bytesUsed() const { return m_bytes_used; }
+
+    size_t objectCount() const { return m_objects; }
+
+private:
+    struct Block {
+        Block *next;
+        size_t size;
+    };
+
+    void addBlock(size_t minimum_size);
+
+    size_t m_block_size;
+    Block *m_blocks = nullptr;
+    Block *m_spare = nullptr;  // Blocks kept by clear() for reuse
+    char *m_cursor = nullptr;
+    char *m_end = nullptr;
+    size_t m_bytes_used = 0;
+    size_t m_objects = 0;     // Objects created with make(), for statistics
+};
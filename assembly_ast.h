@@ -13,6 +13,9 @@
 #include <vector>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
+#include "sink.h"
+#include "x86_encoder.h"
 
 namespace assembly {
 
@@ -20,7 +23,7 @@ namespace assembly {
     public:
         virtual ~AsmNode() = default;
 
-        virtual std::string emit() const = 0;
+        virtual void emit(Sink &out) const = 0;
 
         virtual std::string prettyPrint(int indent = 0) const = 0;
 
@@ -32,51 +35,162 @@ namespace assembly {
 
     class Operand : public AsmNode {
     public:
+        enum class Kind : uint8_t {
+            Imm,
+            Register,
+            Pseudo,
+            Stack
+        };
+
+        explicit Operand(Kind kind) : kind(kind) {}
+
         virtual ~Operand() = default;
+
+        virtual x86::Operand encode() const = 0;
+
+        virtual std::unique_ptr<Operand> clone() const = 0;
+
+        Kind kind;
     };
 
     class Imm : public Operand {
     public:
-        explicit Imm(int value) : value(value) {}
+        explicit Imm(int value) : Operand(Kind::Imm), value(value) {}
 
-        std::string emit() const override {
-            return "$" + std::to_string(value);
+        void emit(Sink &out) const override {
+            out << '$' << value;
         }
 
         std::string prettyPrint(int indent = 0) const override {
             return indentString(indent) + "Imm(" + std::to_string(value) + ")";
         }
 
+        x86::Operand encode() const override {
+            return x86::Operand::immediate(value);
+        }
+
+        std::unique_ptr<Operand> clone() const override {
+            return std::make_unique<Imm>(value);
+        }
+
         int value;
     };
 
+    /**
+     * A hard register, by encoding number. Instructions use its 32-bit form unless they say otherwise.
+     */
     class Register : public Operand {
     public:
-        explicit Register(const std::string &name) : name(name) {}
+        explicit Register(uint8_t number) : Operand(Kind::Register), number(number) {}
 
-        std::string emit() const override {
-            return "%" + name;
+        void emit(Sink &out) const override {
+            out << '%' << x86::registerName(number, 4);
         }
 
         std::string prettyPrint(int indent = 0) const override {
-            return indentString(indent) + "Register(\"" + name + "\")";
+            return indentString(indent) + "Register(\"" + std::string(x86::registerName(number, 4)) + "\")";
         }
 
-        std::string name;
+        x86::Operand encode() const override {
+            return x86::Operand::registerOperand(number, 4);
+        }
+
+        std::unique_ptr<Operand> clone() const override {
+            return std::make_unique<Register>(number);
+        }
+
+        uint8_t number;
+    };
+
+    /**
+     * A TACKY variable that has not been given a location yet. Every pseudo is replaced before emission.
+     */
+    class Pseudo : public Operand {
+    public:
+        explicit Pseudo(uint32_t id) : Operand(Kind::Pseudo), id(id) {}
+
+        void emit(Sink &) const override {
+            throw std::runtime_error("Pseudo-register tmp." + std::to_string(id) + " was never assigned");
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "Pseudo(tmp." + std::to_string(id) + ")";
+        }
+
+        x86::Operand encode() const override {
+            throw std::runtime_error("Pseudo-register tmp." + std::to_string(id) + " was never assigned");
+        }
+
+        std::unique_ptr<Operand> clone() const override {
+            return std::make_unique<Pseudo>(id);
+        }
+
+        uint32_t id;
+    };
+
+    /**
+     * A 4-byte slot in the current frame, addressed relative to %rbp.
+     */
+    class Stack : public Operand {
+    public:
+        explicit Stack(int offset) : Operand(Kind::Stack), offset(offset) {}
+
+        void emit(Sink &out) const override {
+            out << offset << "(%rbp)";
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "Stack(" + std::to_string(offset) + ")";
+        }
+
+        x86::Operand encode() const override {
+            return x86::Operand::memory(5, offset);
+        }
+
+        std::unique_ptr<Operand> clone() const override {
+            return std::make_unique<Stack>(offset);
+        }
+
+        int offset;
     };
 
     class Instruction : public AsmNode {
     public:
+        enum class Kind : uint8_t {
+            Mov,
+            Unary,
+            Binary,
+            Cmp,
+            Idiv,
+            Cdq,
+            Jmp,
+            JmpCC,
+            SetCC,
+            Label,
+            EnterFrame,
+            LeaveFrame,
+            Ret
+        };
+
+        explicit Instruction(Kind kind) : kind(kind) {}
+
         virtual ~Instruction() = default;
+
+        virtual void encode(x86::Encoder &encoder) const = 0;
+
+        Kind kind;
     };
 
     class Mov : public Instruction {
     public:
         Mov(std::unique_ptr<Operand> src, std::unique_ptr<Operand> dst)
-                : src(std::move(src)), dst(std::move(dst)) {}
+                : Instruction(Kind::Mov), src(std::move(src)), dst(std::move(dst)) {}
 
-        std::string emit() const override {
-            return "movl " + src->emit() + ", " + dst->emit();
+        void emit(Sink &out) const override {
+            out << "movl ";
+            src->emit(out);
+            out << ", ";
+            dst->emit(out);
         }
 
         std::string prettyPrint(int indent = 0) const override {
@@ -88,19 +202,331 @@ namespace assembly {
             return oss.str();
         }
 
+        void encode(x86::Encoder &encoder) const override {
+            encoder.mov32(dst->encode(), src->encode());
+        }
+
         std::unique_ptr<Operand> src;
         std::unique_ptr<Operand> dst;
     };
 
+    enum class UnaryOp : uint8_t {
+        Neg,
+        Not
+    };
+
+    class Unary : public Instruction {
+    public:
+        Unary(UnaryOp op, std::unique_ptr<Operand> operand)
+                : Instruction(Kind::Unary), op(op), operand(std::move(operand)) {}
+
+        void emit(Sink &out) const override {
+            out << (op == UnaryOp::Neg ? "negl " : "notl ");
+            operand->emit(out);
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            std::ostringstream oss;
+            oss << indentString(indent) << "Unary(" << (op == UnaryOp::Neg ? "Neg" : "Not") << ",\n"
+                << operand->prettyPrint(indent + 1) << "\n"
+                << indentString(indent) << ")";
+            return oss.str();
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            if (op == UnaryOp::Neg) {
+                encoder.neg32(operand->encode());
+            } else {
+                encoder.not32(operand->encode());
+            }
+        }
+
+        UnaryOp op;
+        std::unique_ptr<Operand> operand;
+    };
+
+    enum class BinaryOp : uint8_t {
+        Add,
+        Sub,
+        Mult,
+        Xor
+    };
+
+    class Binary : public Instruction {
+    public:
+        Binary(BinaryOp op, std::unique_ptr<Operand> src, std::unique_ptr<Operand> dst)
+                : Instruction(Kind::Binary), op(op), src(std::move(src)), dst(std::move(dst)) {}
+
+        void emit(Sink &out) const override {
+            out << mnemonic() << ' ';
+            src->emit(out);
+            out << ", ";
+            dst->emit(out);
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            static const char *const names[] = {"Add", "Sub", "Mult", "Xor"};
+            std::ostringstream oss;
+            oss << indentString(indent) << "Binary(" << names[static_cast<int>(op)] << ",\n"
+                << src->prettyPrint(indent + 1) << ",\n"
+                << dst->prettyPrint(indent + 1) << "\n"
+                << indentString(indent) << ")";
+            return oss.str();
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            switch (op) {
+                case BinaryOp::Add:
+                    encoder.add32(dst->encode(), src->encode());
+                    break;
+                case BinaryOp::Sub:
+                    encoder.sub32(dst->encode(), src->encode());
+                    break;
+                case BinaryOp::Mult:
+                    encoder.imul32(dst->encode(), src->encode());
+                    break;
+                case BinaryOp::Xor:
+                    encoder.xor32(dst->encode(), src->encode());
+                    break;
+            }
+        }
+
+        const char *mnemonic() const {
+            static const char *const mnemonics[] = {"addl", "subl", "imull", "xorl"};
+            return mnemonics[static_cast<int>(op)];
+        }
+
+        BinaryOp op;
+        std::unique_ptr<Operand> src;
+        std::unique_ptr<Operand> dst;
+    };
+
+    /**
+     * `cmpl src, dst`: sets the flags from `dst - src`.
+     */
+    class Cmp : public Instruction {
+    public:
+        Cmp(std::unique_ptr<Operand> src, std::unique_ptr<Operand> dst)
+                : Instruction(Kind::Cmp), src(std::move(src)), dst(std::move(dst)) {}
+
+        void emit(Sink &out) const override {
+            out << "cmpl ";
+            src->emit(out);
+            out << ", ";
+            dst->emit(out);
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            std::ostringstream oss;
+            oss << indentString(indent) << "Cmp(\n"
+                << src->prettyPrint(indent + 1) << ",\n"
+                << dst->prettyPrint(indent + 1) << "\n"
+                << indentString(indent) << ")";
+            return oss.str();
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.cmp32(dst->encode(), src->encode());
+        }
+
+        std::unique_ptr<Operand> src;
+        std::unique_ptr<Operand> dst;
+    };
+
+    /**
+     * `idivl operand`: divides %edx:%eax, leaving the quotient in %eax and the remainder in %edx.
+     */
+    class Idiv : public Instruction {
+    public:
+        explicit Idiv(std::unique_ptr<Operand> operand) : Instruction(Kind::Idiv), operand(std::move(operand)) {}
+
+        void emit(Sink &out) const override {
+            out << "idivl ";
+            operand->emit(out);
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            std::ostringstream oss;
+            oss << indentString(indent) << "Idiv(\n"
+                << operand->prettyPrint(indent + 1) << "\n"
+                << indentString(indent) << ")";
+            return oss.str();
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.idiv32(operand->encode());
+        }
+
+        std::unique_ptr<Operand> operand;
+    };
+
+    class Cdq : public Instruction {
+    public:
+        Cdq() : Instruction(Kind::Cdq) {}
+
+        void emit(Sink &out) const override {
+            out << "cdq";
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "Cdq()";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.cdq();
+        }
+    };
+
+    class Jmp : public Instruction {
+    public:
+        explicit Jmp(std::string label) : Instruction(Kind::Jmp), label(std::move(label)) {}
+
+        void emit(Sink &out) const override {
+            out << "jmp " << label;
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "Jmp(" + label + ")";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.jmp(label);
+        }
+
+        std::string label;
+    };
+
+    class JmpCC : public Instruction {
+    public:
+        JmpCC(x86::Condition condition, std::string label)
+                : Instruction(Kind::JmpCC), condition(condition), label(std::move(label)) {}
+
+        void emit(Sink &out) const override {
+            out << 'j' << x86::conditionSuffix(condition) << ' ' << label;
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "JmpCC(" + std::string(x86::conditionSuffix(condition)) + ", " + label +
+                   ")";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.jcc(condition, label);
+        }
+
+        x86::Condition condition;
+        std::string label;
+    };
+
+    /**
+     * `setcc operand`: writes 0 or 1 to the low byte of the operand only; the rest must already be zeroed.
+     */
+    class SetCC : public Instruction {
+    public:
+        SetCC(x86::Condition condition, std::unique_ptr<Operand> operand)
+                : Instruction(Kind::SetCC), condition(condition), operand(std::move(operand)) {}
+
+        void emit(Sink &out) const override {
+            out << "set" << x86::conditionSuffix(condition) << ' ';
+            if (operand->kind == Operand::Kind::Register) {
+                out << '%' << x86::registerName(static_cast<const Register &>(*operand).number, 1);
+            } else {
+                operand->emit(out);
+            }
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            std::ostringstream oss;
+            oss << indentString(indent) << "SetCC(" << x86::conditionSuffix(condition) << ",\n"
+                << operand->prettyPrint(indent + 1) << "\n"
+                << indentString(indent) << ")";
+            return oss.str();
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.setcc(condition, operand->encode());
+        }
+
+        x86::Condition condition;
+        std::unique_ptr<Operand> operand;
+    };
+
+    class Label : public Instruction {
+    public:
+        explicit Label(std::string name) : Instruction(Kind::Label), name(std::move(name)) {}
+
+        void emit(Sink &out) const override {
+            out << name << ':';
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "Label(" + name + ")";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.bindLabel(name);
+        }
+
+        std::string name;
+    };
+
+    /**
+     * Function prologue: saves %rbp, points it at the new frame and reserves `stack_size` bytes below it.
+     */
+    class EnterFrame : public Instruction {
+    public:
+        explicit EnterFrame(int stack_size) : Instruction(Kind::EnterFrame), stack_size(stack_size) {}
+
+        void emit(Sink &out) const override {
+            out << "pushq %rbp\n    movq %rsp, %rbp";
+            if (stack_size > 0) {
+                out << "\n    subq $" << stack_size << ", %rsp";
+            }
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "EnterFrame(" + std::to_string(stack_size) + ")";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.enterFrame(stack_size);
+        }
+
+        int stack_size;
+    };
+
+    class LeaveFrame : public Instruction {
+    public:
+        LeaveFrame() : Instruction(Kind::LeaveFrame) {}
+
+        void emit(Sink &out) const override {
+            out << "leave";
+        }
+
+        std::string prettyPrint(int indent = 0) const override {
+            return indentString(indent) + "LeaveFrame()";
+        }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.leave();
+        }
+    };
+
     class Ret : public Instruction {
     public:
-        std::string emit() const override {
-            return "ret";
+        Ret() : Instruction(Kind::Ret) {}
+
+        void emit(Sink &out) const override {
+            out << "ret";
         }
 
         std::string prettyPrint(int indent = 0) const override {
             return indentString(indent) + "Ret()";
         }
+
+        void encode(x86::Encoder &encoder) const override {
+            encoder.ret();
+        }
     };
 
     class Function : public AsmNode {
@@ -108,14 +534,16 @@ namespace assembly {
         Function(const std::string &name, std::vector<std::unique_ptr<Instruction>> instructions)
                 : name(name), instructions(std::move(instructions)) {}
 
-        std::string emit() const override {
-            std::ostringstream oss;
-            oss << ".globl " << name << "\n";
-            oss << name << ":\n";
+        void emit(Sink &out) const override {
+            out << ".globl " << name << '\n';
+            out << name << ":\n";
             for (const auto &instruction: instructions) {
-                oss << "    " << instruction->emit() << "\n";
+                if (instruction->kind != Instruction::Kind::Label) {
+                    out << "    ";
+                }
+                instruction->emit(out);
+                out << '\n';
             }
-            return oss.str();
         }
 
         std::string prettyPrint(int indent = 0) const override {
@@ -131,31 +559,52 @@ namespace assembly {
             return oss.str();
         }
 
+        void encode(x86::Encoder &encoder) const {
+            encoder.beginFunction(name);
+            for (const auto &instruction: instructions) {
+                instruction->encode(encoder);
+            }
+            encoder.endFunction();
+        }
+
         std::string name;
         std::vector<std::unique_ptr<Instruction>> instructions;
     };
 
     class Program : public AsmNode {
     public:
-        explicit Program(std::unique_ptr<Function> function)
-                : function(std::move(function)) {}
+        explicit Program(std::vector<std::unique_ptr<Function>> functions)
+                : functions(std::move(functions)) {}
 
-        std::string emit() const override {
-            std::ostringstream oss;
-            oss << function->emit();
-            oss << "\n.section .note.GNU-stack,\"\",@progbits\n";
-            return oss.str();
+        void emit(Sink &out) const override {
+            for (const auto &function: functions) {
+                function->emit(out);
+            }
+            emitTrailer(out);
+        }
+
+        // Follows the last function; marks the stack non-executable
+        static void emitTrailer(Sink &out) {
+            out << "\n.section .note.GNU-stack,\"\",@progbits\n";
         }
 
         std::string prettyPrint(int indent = 0) const override {
             std::ostringstream oss;
-            oss << indentString(indent) << "Program(\n"
-                << function->prettyPrint(indent + 1) << "\n"
-                << indentString(indent) << ")";
+            oss << indentString(indent) << "Program(\n";
+            for (size_t i = 0; i < functions.size(); ++i) {
+                oss << functions[i]->prettyPrint(indent + 1) << (i + 1 < functions.size() ? ",\n" : "\n");
+            }
+            oss << indentString(indent) << ")";
             return oss.str();
         }
 
-        std::unique_ptr<Function> function;
+        void encode(x86::Encoder &encoder) const {
+            for (const auto &function: functions) {
+                function->encode(encoder);
+            }
+        }
+
+        std::vector<std::unique_ptr<Function>> functions;  // In source order
     };
 
 } // namespace assembly
\ No newline at end of file
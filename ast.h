@@ -1,89 +1,137 @@
 #pragma once
 
+#include <cstdint>
+#include <span>
 #include <string>
-#include <memory>
+#include <string_view>
 #include <sstream>
-#include "assembly_ast.h"
+#include "arena.h"
+#include "source_location.h"
 
+/**
+ * AST nodes live in an Arena owned by the driver and are identified by a compact kind tag. Passes dispatch with
+ * a switch on `kind` and a static_cast; there are no vtables and no per-node destructors.
+ */
 class ASTNode {
 public:
-    virtual ~ASTNode() = default;
+    enum class Kind : uint8_t {
+        Constant,
+        Unary,
+        Binary,
+        Return,
+        Function,
+        Program
+    };
 
-    virtual std::string prettyPrint(int indent = 0) const = 0;
+    Kind kind;
+    SourceLocation location;
 
-    virtual std::unique_ptr<assembly::AsmNode> codegen() const = 0;
+    std::string prettyPrint(int indent = 0) const;
 
 protected:
+    ASTNode(Kind kind, SourceLocation location) : kind(kind), location(location) {}
+
     static std::string indentString(int indent) {
         return std::string(indent * 2, ' ');
     }
 };
 
 class Exp : public ASTNode {
-public:
-    virtual ~Exp() = default;
+protected:
+    using ASTNode::ASTNode;
 };
 
 class Constant : public Exp {
 public:
-    explicit Constant(int value) : value(value) {}
+    explicit Constant(int value, SourceLocation location = {}) : Exp(Kind::Constant, location), value(value) {}
 
     int value;
 
-    std::string prettyPrint(int indent = 0) const override {
+    std::string prettyPrint(int indent = 0) const {
         std::ostringstream oss;
         oss << indentString(indent) << "Constant(" << value << ")";
         return oss.str();
     }
+};
 
-    std::unique_ptr<assembly::AsmNode> codegen() const override {
-        return std::make_unique<assembly::Imm>(value);
-    }
+enum class UnaryOperator : uint8_t {
+    Negate,
+    Complement,
+    Not
 };
 
-class Statement : public ASTNode {
+enum class BinaryOperator : uint8_t {
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Remainder,
+    Equal,
+    NotEqual,
+    LessThan,
+    LessOrEqual,
+    GreaterThan,
+    GreaterOrEqual,
+    And,
+    Or
+};
+
+std::string_view operatorName(UnaryOperator op);
+
+std::string_view operatorName(BinaryOperator op);
+
+class Unary : public Exp {
 public:
-    virtual ~Statement() = default;
+    Unary(UnaryOperator op, Exp *operand, SourceLocation location = {})
+            : Exp(Kind::Unary, location), op(op), operand(operand) {}
+
+    UnaryOperator op;
+    Exp *operand;
+
+    std::string prettyPrint(int indent = 0) const;
+};
+
+class Binary : public Exp {
+public:
+    Binary(BinaryOperator op, Exp *left, Exp *right, SourceLocation location = {})
+            : Exp(Kind::Binary, location), op(op), left(left), right(right) {}
+
+    BinaryOperator op;
+    Exp *left;
+    Exp *right;
+
+    std::string prettyPrint(int indent = 0) const;
+};
+
+class Statement : public ASTNode {
+protected:
+    using ASTNode::ASTNode;
 };
 
 class Return : public Statement {
 public:
-    explicit Return(std::unique_ptr<Exp> exp) : exp(std::move(exp)) {}
+    explicit Return(Exp *exp, SourceLocation location = {}) : Statement(Kind::Return, location), exp(exp) {}
 
-    std::unique_ptr<Exp> exp;
+    Exp *exp;
 
-    std::string prettyPrint(int indent = 0) const override {
+    std::string prettyPrint(int indent = 0) const {
         std::ostringstream oss;
         oss << indentString(indent) << "Return(\n"
             << exp->prettyPrint(indent + 1) << "\n"
             << indentString(indent) << ")";
         return oss.str();
     }
-
-    std::unique_ptr<assembly::AsmNode> codegen() const override {
-        auto expCode = exp->codegen();
-        auto *operand = dynamic_cast<assembly::Operand *>(expCode.get());
-        if (!operand) {
-            throw std::runtime_error("Expression did not generate an Operand");
-        }
-        auto movInstr = std::make_unique<assembly::Mov>(
-                std::unique_ptr<assembly::Operand>(operand),
-                std::make_unique<assembly::Register>("eax")
-        );
-        expCode.release(); // Release ownership as it's now managed by movInstr
-        return movInstr;
-    }
 };
 
 class Function : public ASTNode {
 public:
-    Function(std::string name, std::unique_ptr<Statement> body)
-            : name(std::move(name)), body(std::move(body)) {}
+    Function(std::string_view name, Statement *body, SourceLocation location = {})
+            : ASTNode(Kind::Function, location), name(name), body(body) {}
 
-    std::string name;
-    std::unique_ptr<Statement> body;
+    std::string_view name;
+    Statement *body;
 
-    std::string prettyPrint(int indent = 0) const override {
+    std::string prettyPrint(int indent = 0) const {
         std::ostringstream oss;
         oss << indentString(indent) << "Function(\n"
             << indentString(indent + 1) << "name=\"" << name << "\",\n"
@@ -92,37 +140,101 @@ public:
             << indentString(indent) << ")";
         return oss.str();
     }
-
-    std::unique_ptr<assembly::AsmNode> codegen() const override {
-        std::vector<std::unique_ptr<assembly::Instruction>> instructions;
-        instructions.push_back(std::unique_ptr<assembly::Instruction>(
-                dynamic_cast<assembly::Instruction *>(body->codegen().release())
-        ));
-        instructions.push_back(std::make_unique<assembly::Ret>());
-        return std::make_unique<assembly::Function>(name, std::move(instructions));
-    }
 };
 
 class Program : public ASTNode {
 public:
-    explicit Program(std::unique_ptr<Function> function)
-            : function(std::move(function)) {}
+    explicit Program(std::span<Function *> functions, SourceLocation location = {})
+            : ASTNode(Kind::Program, location), functions(functions) {}
 
-    std::unique_ptr<Function> function;
+    std::span<Function *> functions;  // In source order; the array lives in the arena too
 
-    std::string prettyPrint(int indent = 0) const override {
+    std::string prettyPrint(int indent = 0) const {
         std::ostringstream oss;
-        oss << indentString(indent) << "Program(\n"
-            << function->prettyPrint(indent + 1) << "\n"
-            << indentString(indent) << ")";
+        oss << indentString(indent) << "Program(\n";
+        for (size_t i = 0; i < functions.size(); ++i) {
+            oss << functions[i]->prettyPrint(indent + 1) << (i + 1 < functions.size() ? ",\n" : "\n");
+        }
+        oss << indentString(indent) << ")";
         return oss.str();
     }
+};
 
-    std::unique_ptr<assembly::AsmNode> codegen() const override {
-        return std::make_unique<assembly::Program>(
-                std::unique_ptr<assembly::Function>(
-                        dynamic_cast<assembly::Function *>(function->codegen().release())
-                )
-        );
+inline std::string_view operatorName(UnaryOperator op) {
+    switch (op) {
+        case UnaryOperator::Negate:
+            return "Negate";
+        case UnaryOperator::Complement:
+            return "Complement";
+        case UnaryOperator::Not:
+            return "Not";
+    }
+    return {};
+}
+
+inline std::string_view operatorName(BinaryOperator op) {
+    switch (op) {
+        case BinaryOperator::Add:
+            return "Add";
+        case BinaryOperator::Subtract:
+            return "Subtract";
+        case BinaryOperator::Multiply:
+            return "Multiply";
+        case BinaryOperator::Divide:
+            return "Divide";
+        case BinaryOperator::Remainder:
+            return "Remainder";
+        case BinaryOperator::Equal:
+            return "Equal";
+        case BinaryOperator::NotEqual:
+            return "NotEqual";
+        case BinaryOperator::LessThan:
+            return "LessThan";
+        case BinaryOperator::LessOrEqual:
+            return "LessOrEqual";
+        case BinaryOperator::GreaterThan:
+            return "GreaterThan";
+        case BinaryOperator::GreaterOrEqual:
+            return "GreaterOrEqual";
+        case BinaryOperator::And:
+            return "And";
+        case BinaryOperator::Or:
+            return "Or";
+    }
+    return {};
+}
+
+inline std::string Unary::prettyPrint(int indent) const {
+    std::ostringstream oss;
+    oss << indentString(indent) << "Unary(" << operatorName(op) << ",\n"
+        << operand->prettyPrint(indent + 1) << "\n"
+        << indentString(indent) << ")";
+    return oss.str();
+}
+
+inline std::string Binary::prettyPrint(int indent) const {
+    std::ostringstream oss;
+    oss << indentString(indent) << "Binary(" << operatorName(op) << ",\n"
+        << left->prettyPrint(indent + 1) << ",\n"
+        << right->prettyPrint(indent + 1) << "\n"
+        << indentString(indent) << ")";
+    return oss.str();
+}
+
+inline std::string ASTNode::prettyPrint(int indent) const {
+    switch (kind) {
+        case Kind::Constant:
+            return static_cast<const Constant *>(this)->prettyPrint(indent);
+        case Kind::Unary:
+            return static_cast<const Unary *>(this)->prettyPrint(indent);
+        case Kind::Binary:
+            return static_cast<const Binary *>(this)->prettyPrint(indent);
+        case Kind::Return:
+            return static_cast<const Return *>(this)->prettyPrint(indent);
+        case Kind::Function:
+            return static_cast<const Function *>(this)->prettyPrint(indent);
+        case Kind::Program:
+            return static_cast<const Program *>(this)->prettyPrint(indent);
     }
-};
\ No newline at end of file
+    return {};
+}
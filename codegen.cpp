@@ -1,62 +1,364 @@
 #include "codegen.h"
+#include <stdexcept>
+#include <unordered_map>
+#include "register_allocator.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+namespace {
+
+    std::unique_ptr<assembly::Register> reg(uint8_t number) {
+        return std::make_unique<assembly::Register>(number);
+    }
+
+    std::unique_ptr<assembly::Imm> imm(int value) {
+        return std::make_unique<assembly::Imm>(value);
+    }
+
+    bool isMemory(const assembly::Operand &operand) {
+        return operand.kind == assembly::Operand::Kind::Stack;
+    }
+
+    x86::Condition conditionFor(tacky::Opcode opcode) {
+        switch (opcode) {
+            case tacky::Opcode::Equal:
+                return x86::Condition::E;
+            case tacky::Opcode::NotEqual:
+                return x86::Condition::NE;
+            case tacky::Opcode::LessThan:
+                return x86::Condition::L;
+            case tacky::Opcode::LessOrEqual:
+                return x86::Condition::LE;
+            case tacky::Opcode::GreaterThan:
+                return x86::Condition::G;
+            case tacky::Opcode::GreaterOrEqual:
+                return x86::Condition::GE;
+            default:
+                throw std::runtime_error("Not a relational opcode");
+        }
+    }
+
+} // namespace
 
 /**
- * @brief Generates an assembly program from the given abstract syntax tree (AST).
+ * @brief Generates an assembly program from the given TACKY program.
  *
- * @param ast The abstract syntax tree representing the program.
+ * @details Functions are independent from instruction selection through the peephole pass, so each one is
+ *          lowered, allocated and optimised as a separate task. With a thread pool in the options the tasks run
+ *          in parallel; results land in a slot per function, so the program keeps source order either way.
+ *
+ * @param program The TACKY program lowered from the AST.
+ * @param options Code generation options.
+ * @param peephole_hits If given, receives how often each peephole rule fired, summed over all functions.
  * @return A unique pointer to the generated assembly program.
  */
-std::unique_ptr<assembly::Program> CodeGen::generate(const Program &ast) {
-    return std::make_unique<assembly::Program>(generateFunction(*ast.function));
+std::unique_ptr<assembly::Program> CodeGen::generate(const tacky::Program &program, const CodeGenOptions &options,
+                                                     Peephole::Hits *peephole_hits) {
+    size_t count = program.functions.size();
+    std::vector<std::unique_ptr<assembly::Function>> functions(count);
+    std::vector<Peephole::Hits> hits(count);
+    auto generateOne = [&](size_t i) {
+        functions[i] = generate(program.functions[i], options, &hits[i]);
+    };
+    if (options.pool && count > 1) {
+        options.pool->parallelFor(count, generateOne);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            generateOne(i);
+        }
+    }
+
+    if (peephole_hits) {
+        peephole_hits->fill(0);
+        for (const auto &function_hits: hits) {
+            for (size_t rule = 0; rule < Peephole::kRuleCount; ++rule) {
+                (*peephole_hits)[rule] += function_hits[rule];
+            }
+        }
+    }
+    return std::make_unique<assembly::Program>(std::move(functions));
+}
+
+/**
+ * @brief Generates one function: instruction selection, register allocation, frame layout and the peephole pass.
+ *
+ * @param function The TACKY function.
+ * @param options Code generation options; the pool is not used.
+ * @param peephole_hits If given, receives how often each peephole rule fired in this function.
+ * @return The assembly function.
+ */
+std::unique_ptr<assembly::Function> CodeGen::generate(const tacky::Function &function, const CodeGenOptions &options,
+                                                      Peephole::Hits *peephole_hits) {
+    Trace::Scope trace("function", function.name);
+    CodeGen generator(function, options);
+    auto result = generator.generateFunction();
+    if (peephole_hits) {
+        peephole_hits->fill(0);
+    }
+    if (options.peephole_rules != 0) {
+        Trace::Scope pass("peephole", function.name);
+        Peephole peephole(options.peephole_rules);
+        peephole.run(*result);
+        if (peephole_hits) {
+            *peephole_hits = peephole.hits();
+        }
+    }
+    return result;
 }
 
 /**
- * @brief Generates an assembly function from the given function AST node.
+ * @brief Generates an assembly function from the TACKY function.
+ *
+ * @details Instruction selection first produces code over pseudo-registers, one per TACKY variable. The register
+ *          allocator then assigns hard registers where it can; each remaining pseudo gets a stack slot, and
+ *          instructions whose operands x86 cannot encode are rewritten through the scratch registers %r10d and
+ *          %r11d. Functions that need no stack get no frame.
  *
- * @param function The function AST node.
  * @return A unique pointer to the generated assembly function.
  */
-std::unique_ptr<assembly::Function> CodeGen::generateFunction(const Function &function) {
-    std::vector<std::unique_ptr<assembly::Instruction>> instructions;
-    instructions.push_back(std::unique_ptr<assembly::Instruction>(
-            dynamic_cast<assembly::Instruction *>(generateStatement(*function.body).release())
-    ));
-    instructions.push_back(std::make_unique<assembly::Ret>());
-    return std::make_unique<assembly::Function>(function.name, std::move(instructions));
+std::unique_ptr<assembly::Function> CodeGen::generateFunction() {
+    {
+        Trace::Scope trace("select", m_function.name);
+        m_instructions.reserve(m_function.instructions.size() * 3);
+        for (const auto &instruction: m_function.instructions) {
+            generateInstruction(instruction);
+        }
+    }
+    if (m_options.allocate_registers) {
+        Trace::Scope trace("regalloc", m_function.name);
+        RegisterAllocator::allocate(m_instructions, m_function.var_count);
+    }
+    Trace::Scope trace("frame", m_function.name);
+    int stack_size = replacePseudos(m_instructions);
+    return std::make_unique<assembly::Function>(m_function.name,
+                                                fixupInstructions(std::move(m_instructions), stack_size));
+}
+
+/**
+ * @brief Appends the assembly instructions for one TACKY instruction.
+ *
+ * @param instruction The TACKY instruction.
+ */
+void CodeGen::generateInstruction(const tacky::Instruction &instruction) {
+    using assembly::Mov;
+    auto &out = m_instructions;
+    switch (instruction.opcode) {
+        case tacky::Opcode::Return:
+            out.push_back(std::make_unique<Mov>(generateOperand(instruction.src1), reg(x86::AX)));
+            out.push_back(std::make_unique<assembly::Ret>());
+            return;
+        case tacky::Opcode::Copy:
+            out.push_back(std::make_unique<Mov>(generateOperand(instruction.src1), generateOperand(instruction.dst)));
+            return;
+        case tacky::Opcode::Negate:
+        case tacky::Opcode::Complement: {
+            auto op = instruction.opcode == tacky::Opcode::Negate ? assembly::UnaryOp::Neg : assembly::UnaryOp::Not;
+            out.push_back(std::make_unique<Mov>(generateOperand(instruction.src1), generateOperand(instruction.dst)));
+            out.push_back(std::make_unique<assembly::Unary>(op, generateOperand(instruction.dst)));
+            return;
+        }
+        case tacky::Opcode::Not:
+            out.push_back(std::make_unique<assembly::Cmp>(imm(0), generateOperand(instruction.src1)));
+            out.push_back(std::make_unique<Mov>(imm(0), generateOperand(instruction.dst)));
+            out.push_back(std::make_unique<assembly::SetCC>(x86::Condition::E, generateOperand(instruction.dst)));
+            return;
+        case tacky::Opcode::Add:
+        case tacky::Opcode::Subtract:
+        case tacky::Opcode::Multiply: {
+            auto op = instruction.opcode == tacky::Opcode::Add ? assembly::BinaryOp::Add
+                    : instruction.opcode == tacky::Opcode::Subtract ? assembly::BinaryOp::Sub
+                    : assembly::BinaryOp::Mult;
+            out.push_back(std::make_unique<Mov>(generateOperand(instruction.src1), generateOperand(instruction.dst)));
+            out.push_back(std::make_unique<assembly::Binary>(op, generateOperand(instruction.src2),
+                                                             generateOperand(instruction.dst)));
+            return;
+        }
+        case tacky::Opcode::Divide:
+        case tacky::Opcode::Remainder:
+            out.push_back(std::make_unique<Mov>(generateOperand(instruction.src1), reg(x86::AX)));
+            out.push_back(std::make_unique<assembly::Cdq>());
+            out.push_back(std::make_unique<assembly::Idiv>(generateOperand(instruction.src2)));
+            out.push_back(std::make_unique<Mov>(reg(instruction.opcode == tacky::Opcode::Divide ? x86::AX : x86::DX),
+                                                generateOperand(instruction.dst)));
+            return;
+        case tacky::Opcode::Equal:
+        case tacky::Opcode::NotEqual:
+        case tacky::Opcode::LessThan:
+        case tacky::Opcode::LessOrEqual:
+        case tacky::Opcode::GreaterThan:
+        case tacky::Opcode::GreaterOrEqual:
+            out.push_back(std::make_unique<assembly::Cmp>(generateOperand(instruction.src2),
+                                                          generateOperand(instruction.src1)));
+            out.push_back(std::make_unique<Mov>(imm(0), generateOperand(instruction.dst)));
+            out.push_back(std::make_unique<assembly::SetCC>(conditionFor(instruction.opcode),
+                                                            generateOperand(instruction.dst)));
+            return;
+        case tacky::Opcode::Jump:
+            out.push_back(std::make_unique<assembly::Jmp>(labelName(instruction.label)));
+            return;
+        case tacky::Opcode::JumpIfZero:
+        case tacky::Opcode::JumpIfNotZero: {
+            auto condition = instruction.opcode == tacky::Opcode::JumpIfZero ? x86::Condition::E : x86::Condition::NE;
+            out.push_back(std::make_unique<assembly::Cmp>(imm(0), generateOperand(instruction.src1)));
+            out.push_back(std::make_unique<assembly::JmpCC>(condition, labelName(instruction.label)));
+            return;
+        }
+        case tacky::Opcode::Label:
+            out.push_back(std::make_unique<assembly::Label>(labelName(instruction.label)));
+            return;
+    }
+    throw std::runtime_error("Unsupported TACKY instruction");
+}
+
+/**
+ * @brief Generates an assembly operand from the given TACKY value.
+ *
+ * @param val The TACKY value.
+ * @return An immediate for constants, otherwise the variable's pseudo-register.
+ */
+std::unique_ptr<assembly::Operand> CodeGen::generateOperand(const tacky::Val &val) {
+    if (val.isConstant()) {
+        return imm(val.value);
+    }
+    return std::make_unique<assembly::Pseudo>(static_cast<uint32_t>(val.value));
 }
 
 /**
- * @brief Generates an assembly statement from the given statement AST node.
+ * @brief Returns the assembler-local name of a TACKY label. The function name keeps labels unique per file.
+ */
+std::string CodeGen::labelName(uint32_t label) const {
+    return ".L" + m_function.name + "." + std::to_string(label);
+}
+
+/**
+ * @brief Gives every remaining pseudo-register its own 4-byte stack slot.
+ *
+ * @details Slots are handed out in order of first use, so the frame only covers pseudos that were not allocated a
+ *          register.
  *
- * @param statement The statement AST node.
- * @return A unique pointer to the generated assembly statement.
+ * @param instructions The instructions to rewrite in place.
+ * @return The frame size in bytes, rounded up to keep %rsp 16-byte aligned.
  */
-std::unique_ptr<assembly::AsmNode> CodeGen::generateStatement(const Statement &statement) {
-    if (const auto *returnStmt = dynamic_cast<const Return *>(&statement)) {
-        auto expCode = generateExpression(*returnStmt->exp);
-        auto *operand = dynamic_cast<assembly::Operand *>(expCode.get());
-        if (!operand) {
-            throw std::runtime_error("Expression did not generate an Operand");
+int CodeGen::replacePseudos(InstructionList &instructions) {
+    std::unordered_map<uint32_t, int> offsets;
+    auto replace = [&offsets](std::unique_ptr<assembly::Operand> &operand) {
+        if (operand->kind != assembly::Operand::Kind::Pseudo) {
+            return;
+        }
+        uint32_t id = static_cast<const assembly::Pseudo &>(*operand).id;
+        auto slot = offsets.try_emplace(id, -4 * static_cast<int>(offsets.size() + 1)).first;
+        operand = std::make_unique<assembly::Stack>(slot->second);
+    };
+
+    for (auto &instruction: instructions) {
+        switch (instruction->kind) {
+            case assembly::Instruction::Kind::Mov: {
+                auto &mov = static_cast<assembly::Mov &>(*instruction);
+                replace(mov.src);
+                replace(mov.dst);
+                break;
+            }
+            case assembly::Instruction::Kind::Unary:
+                replace(static_cast<assembly::Unary &>(*instruction).operand);
+                break;
+            case assembly::Instruction::Kind::Binary: {
+                auto &binary = static_cast<assembly::Binary &>(*instruction);
+                replace(binary.src);
+                replace(binary.dst);
+                break;
+            }
+            case assembly::Instruction::Kind::Cmp: {
+                auto &cmp = static_cast<assembly::Cmp &>(*instruction);
+                replace(cmp.src);
+                replace(cmp.dst);
+                break;
+            }
+            case assembly::Instruction::Kind::Idiv:
+                replace(static_cast<assembly::Idiv &>(*instruction).operand);
+                break;
+            case assembly::Instruction::Kind::SetCC:
+                replace(static_cast<assembly::SetCC &>(*instruction).operand);
+                break;
+            default:
+                break;
         }
-        auto movInstr = std::make_unique<assembly::Mov>(
-                std::unique_ptr<assembly::Operand>(operand),
-                std::make_unique<assembly::Register>("eax")
-        );
-        expCode.release(); // Release ownership as it's now managed by movInstr
-        return movInstr;
     }
-    throw std::runtime_error("Unsupported statement type");
+    int stack_size = 4 * static_cast<int>(offsets.size());
+    return (stack_size + 15) & ~15;
 }
 
 /**
- * @brief Generates an assembly operand from the given expression AST node.
+ * @brief Rewrites instructions whose operand combination x86 cannot encode, and adds the frame.
  *
- * @param exp The expression AST node.
- * @return A unique pointer to the generated assembly operand.
+ * @details Memory-to-memory `mov`/`add`/`sub`/`cmp` go through %r10d, `imul` into memory goes through %r11d,
+ *          `idiv` of an immediate and `cmp` against an immediate load the constant into a register first.
+ *
+ * @param instructions The instructions after pseudo replacement.
+ * @param stack_size The frame size; 0 means the function needs no frame.
+ * @return The rewritten instruction list.
  */
-std::unique_ptr<assembly::Operand> CodeGen::generateExpression(const Exp &exp) {
-    if (const auto *constant = dynamic_cast<const Constant *>(&exp)) {
-        return std::make_unique<assembly::Imm>(constant->value);
+CodeGen::InstructionList CodeGen::fixupInstructions(InstructionList instructions, int stack_size) {
+    using assembly::Mov;
+    InstructionList out;
+    out.reserve(instructions.size() + instructions.size() / 2 + 1);
+    if (stack_size > 0) {
+        out.push_back(std::make_unique<assembly::EnterFrame>(stack_size));
     }
-    throw std::runtime_error("Unsupported expression type");
-}
\ No newline at end of file
+
+    for (auto &instruction: instructions) {
+        switch (instruction->kind) {
+            case assembly::Instruction::Kind::Mov: {
+                auto &mov = static_cast<Mov &>(*instruction);
+                if (isMemory(*mov.src) && isMemory(*mov.dst)) {
+                    out.push_back(std::make_unique<Mov>(std::move(mov.src), reg(x86::R10)));
+                    mov.src = reg(x86::R10);
+                }
+                break;
+            }
+            case assembly::Instruction::Kind::Binary: {
+                auto &binary = static_cast<assembly::Binary &>(*instruction);
+                if (binary.op == assembly::BinaryOp::Mult && isMemory(*binary.dst)) {
+                    out.push_back(std::make_unique<Mov>(binary.dst->clone(), reg(x86::R11)));
+                    auto dst = std::move(binary.dst);
+                    binary.dst = reg(x86::R11);
+                    out.push_back(std::move(instruction));
+                    out.push_back(std::make_unique<Mov>(reg(x86::R11), std::move(dst)));
+                    continue;
+                }
+                if (binary.op != assembly::BinaryOp::Mult && isMemory(*binary.src) && isMemory(*binary.dst)) {
+                    out.push_back(std::make_unique<Mov>(std::move(binary.src), reg(x86::R10)));
+                    binary.src = reg(x86::R10);
+                }
+                break;
+            }
+            case assembly::Instruction::Kind::Cmp: {
+                auto &cmp = static_cast<assembly::Cmp &>(*instruction);
+                if (isMemory(*cmp.src) && isMemory(*cmp.dst)) {
+                    out.push_back(std::make_unique<Mov>(std::move(cmp.src), reg(x86::R10)));
+                    cmp.src = reg(x86::R10);
+                } else if (cmp.dst->kind == assembly::Operand::Kind::Imm) {
+                    out.push_back(std::make_unique<Mov>(std::move(cmp.dst), reg(x86::R11)));
+                    cmp.dst = reg(x86::R11);
+                }
+                break;
+            }
+            case assembly::Instruction::Kind::Idiv: {
+                auto &idiv = static_cast<assembly::Idiv &>(*instruction);
+                if (idiv.operand->kind == assembly::Operand::Kind::Imm) {
+                    out.push_back(std::make_unique<Mov>(std::move(idiv.operand), reg(x86::R10)));
+                    idiv.operand = reg(x86::R10);
+                }
+                break;
+            }
+            case assembly::Instruction::Kind::Ret:
+                if (stack_size > 0) {
+                    out.push_back(std::make_unique<assembly::LeaveFrame>());
+                }
+                break;
+            default:
+                break;
+        }
+        out.push_back(std::move(instruction));
+    }
+    return out;
+}
@@ -1,16 +1,46 @@
 #pragma once
 
-#include "ast.h"
+#include "tacky.h"
 #include "assembly_ast.h"
+#include "peephole.h"
+
+class ThreadPool;
+
+struct CodeGenOptions {
+    bool allocate_registers = true;  // Otherwise every pseudo-register lives in a stack slot
+    uint32_t peephole_rules = 0;     // Peephole rules run on each function after allocation
+    ThreadPool *pool = nullptr;      // Functions are generated in parallel on this pool when set
+};
 
 class CodeGen {
 public:
-    static std::unique_ptr<assembly::Program> generate(const Program &ast);
+    static std::unique_ptr<assembly::Program> generate(const tacky::Program &program,
+                                                       const CodeGenOptions &options = {},
+                                                       Peephole::Hits *peephole_hits = nullptr);
+
+    static std::unique_ptr<assembly::Function> generate(const tacky::Function &function,
+                                                        const CodeGenOptions &options = {},
+                                                        Peephole::Hits *peephole_hits = nullptr);
 
 private:
-    static std::unique_ptr<assembly::Function> generateFunction(const Function &function);
+    using InstructionList = std::vector<std::unique_ptr<assembly::Instruction>>;
+
+    CodeGen(const tacky::Function &function, const CodeGenOptions &options)
+            : m_function(function), m_options(options) {}
+
+    std::unique_ptr<assembly::Function> generateFunction();
+
+    void generateInstruction(const tacky::Instruction &instruction);
+
+    static std::unique_ptr<assembly::Operand> generateOperand(const tacky::Val &val);
+
+    std::string labelName(uint32_t label) const;
+
+    static int replacePseudos(InstructionList &instructions);
 
-    static std::unique_ptr<assembly::AsmNode> generateStatement(const Statement &statement);
+    static InstructionList fixupInstructions(InstructionList instructions, int stack_size);
 
-    static std::unique_ptr<assembly::Operand> generateExpression(const Exp &exp);
-};
\ No newline at end of file
+    const tacky::Function &m_function;
+    const CodeGenOptions &m_options;
+    InstructionList m_instructions;
+};
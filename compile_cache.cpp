@@ -0,0 +1,267 @@
+#include "compile_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sha256.h"
+#include "trace.h"
+
+namespace {
+
+    constexpr size_t kKeyLength = 64;
+
+    /** Identifies this build of the compiler: a rebuilt executable never reuses an older build's outputs. */
+    const std::string &compilerIdentity() {
+        static const std::string identity = [] {
+            std::string text = "mcc";
+            struct stat st{};
+            if (stat("/proc/self/exe", &st) == 0) {
+                text += " " + std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) + "." +
+                        std::to_string(st.st_mtim.tv_nsec) + " " + std::to_string(st.st_ino);
+            }
+            return text;
+        }();
+        return identity;
+    }
+
+    bool isEntryName(const char *name) {
+        size_t length = 0;
+        for (; name[length]; ++length) {
+            if (!std::isxdigit(static_cast<unsigned char>(name[length]))) {
+                return false;
+            }
+        }
+        return length == kKeyLength;
+    }
+
+    bool copyContents(int from, int to) {
+        char buffer[64 * 1024];
+        for (;;) {
+            ssize_t count = read(from, buffer, sizeof(buffer));
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) return false;
+            if (count == 0) return true;
+            for (ssize_t done = 0; done < count;) {
+                ssize_t written = write(to, buffer + done, static_cast<size_t>(count - done));
+                if (written < 0 && errno == EINTR) continue;
+                if (written < 0) return false;
+                done += written;
+            }
+        }
+    }
+
+    /**
+     * Copies a file to `temporary` and renames it over `destination`, keeping the permission bits. Either the
+     * whole file appears under the destination name or nothing does.
+     */
+    bool copyAtomically(const std::string &source, const std::string &temporary, const std::string &destination) {
+        int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            return false;
+        }
+        struct stat st{};
+        fstat(in, &st);
+        int out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+        if (out < 0) {
+            close(in);
+            return false;
+        }
+        bool copied = copyContents(in, out);
+        close(in);
+        copied = close(out) == 0 && copied;
+        if (!copied || rename(temporary.c_str(), destination.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void makeDirectories(const std::string &path) {
+        for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            mkdir(path.substr(0, slash).c_str(), 0755);
+        }
+        mkdir(path.c_str(), 0755);
+    }
+
+    std::string uniqueSuffix() {
+        static std::atomic<uint64_t> counter{0};
+        return std::to_string(getpid()) + "." + std::to_string(counter++);
+    }
+
+} // namespace
+
+CompileCache::CompileCache(std::string directory, uint64_t max_bytes)
+        : m_directory(std::move(directory)), m_max_bytes(max_bytes) {}
+
+/**
+ * @brief Computes the cache key for a translation unit.
+ *
+ * @param source The preprocessed translation unit; `#include`d files and `-D` options are already part of it.
+ * @param flags The options that change the output, in a canonical spelling.
+ * @return The key, as 64 hex digits.
+ */
+std::string CompileCache::key(std::string_view source, std::string_view flags) {
+    Sha256 hash;
+    // Each part is length-prefixed so that moving text between them changes the key
+    for (std::string_view part: {std::string_view(compilerIdentity()), flags, source}) {
+        uint64_t size = part.size();
+        hash.update(&size, sizeof(size));
+        hash.update(part);
+    }
+    return Sha256::toHex(hash.finish());
+}
+
+/**
+ * @brief Copies a cached output to `destination` if there is one, and marks the entry as recently used.
+ *
+ * @param key The cache key.
+ * @param destination The output path; it is replaced atomically.
+ * @return `true` on a hit.
+ */
+bool CompileCache::fetch(const std::string &key, const std::string &destination) {
+    Trace::Scope trace("cache fetch");
+    std::string entry = entryPath(key);
+    if (!copyAtomically(entry, destination + ".tmp." + uniqueSuffix(), destination)) {
+        return false;
+    }
+    utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+    return true;
+}
+
+/**
+ * @brief Adds a freshly produced output to the cache, then evicts old entries if the cache is over its cap.
+ *
+ * @details Failures (a full disk, a read-only directory) only mean the output is not cached; the compile that
+ *          produced it has still succeeded.
+ *
+ * @param key The cache key.
+ * @param source The output file to copy into the cache.
+ */
+void CompileCache::store(const std::string &key, const std::string &source) {
+    Trace::Scope trace("cache store");
+    makeDirectories(m_directory);
+    if (copyAtomically(source, temporaryPath(), entryPath(key))) {
+        Stats delta;
+        delta.stores = 1;
+        addToStats(delta);
+        evict();
+    }
+}
+
+void CompileCache::recordLookup(bool hit) {
+    Stats delta;
+    (hit ? delta.hits : delta.misses) = 1;
+    addToStats(delta);
+}
+
+std::string CompileCache::temporaryPath() const {
+    return m_directory + "/tmp." + uniqueSuffix();
+}
+
+/**
+ * @brief Removes the least recently used entries until the cache is back under 90% of its cap.
+ *
+ * @details Entries are touched on every hit, so their modification time is their last use. Several processes
+ *          may evict at once; an entry someone else already removed is simply skipped.
+ */
+void CompileCache::evict() {
+    struct Entry {
+        std::string path;
+        int64_t last_use;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    DIR *directory = opendir(m_directory.c_str());
+    if (!directory) {
+        return;
+    }
+    while (dirent *item = readdir(directory)) {
+        if (!isEntryName(item->d_name)) {
+            continue;
+        }
+        std::string path = m_directory + "/" + item->d_name;
+        struct stat st{};
+        if (stat(path.c_str(), &st) == 0) {
+            entries.push_back({path, static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+                               static_cast<uint64_t>(st.st_size)});
+            total += static_cast<uint64_t>(st.st_size);
+        }
+    }
+    closedir(directory);
+    if (total <= m_max_bytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.last_use < b.last_use; });
+    Stats delta;
+    uint64_t target = m_max_bytes / 10 * 9;
+    for (const auto &entry: entries) {
+        if (total <= target) {
+            break;
+        }
+        if (unlink(entry.path.c_str()) == 0) {
+            ++delta.evictions;
+        }
+        total -= entry.size;
+    }
+    addToStats(delta);
+}
+
+/**
+ * @brief Adds to the counters in the `stats` file, holding an exclusive lock on it while doing so.
+ */
+void CompileCache::addToStats(const Stats &delta) const {
+    makeDirectories(m_directory);
+    int fd = open((m_directory + "/stats").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    char text[128] = {};
+    Stats current;
+    if (pread(fd, text, sizeof(text) - 1, 0) > 0) {
+        std::sscanf(text, "%lu %lu %lu %lu", &current.hits, &current.misses, &current.stores, &current.evictions);
+    }
+    int length = std::snprintf(text, sizeof(text), "%lu %lu %lu %lu\n", current.hits + delta.hits,
+                               current.misses + delta.misses, current.stores + delta.stores,
+                               current.evictions + delta.evictions);
+    if (ftruncate(fd, 0) == 0) {
+        pwrite(fd, text, static_cast<size_t>(length), 0);
+    }
+    close(fd);
+}
+
+/**
+ * @brief Returns the counters accumulated by every compile that used this directory, plus its current size.
+ */
+CompileCache::Stats CompileCache::stats() const {
+    Stats result;
+    int fd = open((m_directory + "/stats").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        flock(fd, LOCK_SH);
+        char text[128] = {};
+        if (pread(fd, text, sizeof(text) - 1, 0) > 0) {
+            std::sscanf(text, "%lu %lu %lu %lu", &result.hits, &result.misses, &result.stores, &result.evictions);
+        }
+        close(fd);
+    }
+    if (DIR *directory = opendir(m_directory.c_str())) {
+        while (dirent *item = readdir(directory)) {
+            struct stat st{};
+            if (isEntryName(item->d_name) && stat((m_directory + "/" + item->d_name).c_str(), &st) == 0) {
+                ++result.entries;
+                result.bytes += static_cast<uint64_t>(st.st_size);
+            }
+        }
+        closedir(directory);
+    }
+    return result;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * On-disk cache of compiler outputs (`.s`, `.o` or executables), keyed by the SHA-256 of the compiler's own
+ * identity, the flags that affect the output and the preprocessed translation unit. Entries are plain files
+ * named by their key. They are written to a temporary name and renamed into place, so concurrent compiles never
+ * see a partial entry. The directory is kept under a size cap by evicting the least recently used entries, and
+ * hit/miss counters are kept in a `stats` file that is updated under a lock.
+ */
+class CompileCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t stores = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    CompileCache(std::string directory, uint64_t max_bytes);
+
+    static std::string key(std::string_view source, std::string_view flags);
+
+    bool fetch(const std::string &key, const std::string &destination);
+
+    void store(const std::string &key, const std::string &source);
+
+    void recordLookup(bool hit);
+
+    Stats stats() const;
+
+private:
+    std::string entryPath(const std::string &key) const { return m_directory + "/" + key; }
+
+    std::string temporaryPath() const;
+
+    void evict();
+
+    void addToStats(const Stats &delta) const;
+
+    std::string m_directory;
+    uint64_t m_max_bytes;
+};
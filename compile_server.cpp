@@ -0,0 +1,255 @@
+#include "compile_server.h"
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "compiler_driver.h"
+
+namespace {
+
+    // Requests are a count followed by that many length-prefixed strings: the client's working directory,
+    // then its arguments. Replies are the exit status followed by the captured stdout and stderr. Integers are
+    // in host byte order; both ends are on the same machine.
+    constexpr uint32_t kMaxStrings = 1u << 20;
+    constexpr uint32_t kMaxStringSize = 1u << 30;
+
+    char g_socket_path[sizeof(sockaddr_un::sun_path)];
+
+    bool writeAll(int fd, const void *data, size_t size) {
+        auto *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    bool readAll(int fd, void *data, size_t size) {
+        auto *bytes = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t received = recv(fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) {
+                return false;
+            }
+            bytes += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    bool writeString(int fd, const std::string &text) {
+        auto size = static_cast<uint32_t>(text.size());
+        return writeAll(fd, &size, sizeof(size)) && writeAll(fd, text.data(), text.size());
+    }
+
+    bool readString(int fd, std::string &text) {
+        uint32_t size = 0;
+        if (!readAll(fd, &size, sizeof(size)) || size > kMaxStringSize) {
+            return false;
+        }
+        text.resize(size);
+        return readAll(fd, text.data(), size);
+    }
+
+    bool makeAddress(const std::string &path, sockaddr_un &address) {
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    int connectTo(const sockaddr_un &address) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    void removeSocketAndExit(int) {
+        unlink(g_socket_path);
+        _exit(0);
+    }
+
+} // namespace
+
+CompileServer::CompileServer(std::string socket_path) : m_socket_path(std::move(socket_path)) {}
+
+/**
+ * @brief Listens on the socket and serves requests until the process is interrupted or terminated.
+ *
+ * @details A stale socket file left by a server that died is replaced; a socket another server is still
+ *          answering on is not. SIGINT and SIGTERM remove the socket file before exiting.
+ *
+ * @returns The process exit code if the server could not start or accept() failed.
+ */
+int CompileServer::serve() {
+    sockaddr_un address{};
+    if (!makeAddress(m_socket_path, address)) {
+        std::cerr << "Invalid socket path " << m_socket_path << std::endl;
+        return 1;
+    }
+    int probe = connectTo(address);
+    if (probe >= 0) {
+        ::close(probe);
+        std::cerr << "A compile server is already listening on " << m_socket_path << std::endl;
+        return 1;
+    }
+    unlink(m_socket_path.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 || bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Unable to listen on " << m_socket_path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::memcpy(g_socket_path, address.sun_path, sizeof(g_socket_path));
+    std::signal(SIGINT, removeSocketAndExit);
+    std::signal(SIGTERM, removeSocketAndExit);
+    std::cerr << "Compile server listening on " << m_socket_path << std::endl;
+
+    for (;;) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+            unlink(m_socket_path.c_str());
+            return 1;
+        }
+        std::thread([this, fd] {
+            handleConnection(fd);
+            ::close(fd);
+        }).detach();
+    }
+}
+
+/**
+ * @brief Reads one request, compiles it and sends the reply.
+ *
+ * @details The connection thread gets a working directory of its own (unshare(CLONE_FS)) and moves into the
+ *          client's, so relative paths, derived output names, diagnostics and the gcc subprocesses behave exactly
+ *          as they would in the client's own process.
+ *
+ * @param fd The connected socket.
+ */
+void CompileServer::handleConnection(int fd) {
+    uint32_t count = 0;
+    if (!readAll(fd, &count, sizeof(count)) || count == 0 || count > kMaxStrings) {
+        return;
+    }
+    std::vector<std::string> message(count);
+    for (auto &text: message) {
+        if (!readString(fd, text)) {
+            return;
+        }
+    }
+
+    std::ostringstream out;
+    std::ostringstream err;
+    int status = 1;
+    if (unshare(CLONE_FS) != 0 || chdir(message[0].c_str()) != 0) {
+        err << "Compile server cannot enter " << message[0] << ": " << std::strerror(errno) << std::endl;
+    } else {
+        auto arena = takeArena();
+        CompileContext context;
+        context.pool = &m_pool;
+        context.arena = arena.get();
+        context.include_cache = &m_include_cache;
+        context.serving = true;
+        // Batch requests start their own workers; if one cannot follow into the directory, its relative paths
+        // fail with the usual diagnostics
+        context.enter_context = [directory = message[0]] {
+            if (unshare(CLONE_FS) != 0 || chdir(directory.c_str()) != 0) {
+                return;
+            }
+        };
+        try {
+            CompilerDriver driver;
+            status = driver.run(std::vector<std::string>(message.begin() + 1, message.end()), out, err, context);
+        } catch (const std::exception &e) {
+            err << "Internal compiler error: " << e.what() << std::endl;
+            status = 1;
+        }
+        arena->clear();
+        returnArena(std::move(arena));
+    }
+
+    // A client that has gone away simply misses its reply
+    int32_t reply_status = status;
+    if (writeAll(fd, &reply_status, sizeof(reply_status)) && writeString(fd, out.str())) {
+        writeString(fd, err.str());
+    }
+}
+
+std::unique_ptr<Arena> CompileServer::takeArena() {
+    std::lock_guard lock(m_arena_mutex);
+    if (m_arenas.empty()) {
+        return std::make_unique<Arena>();
+    }
+    auto arena = std::move(m_arenas.back());
+    m_arenas.pop_back();
+    return arena;
+}
+
+void CompileServer::returnArena(std::unique_ptr<Arena> arena) {
+    std::lock_guard lock(m_arena_mutex);
+    m_arenas.push_back(std::move(arena));
+}
+
+/**
+ * @brief Sends the arguments to a compile server and relays its output and exit status.
+ *
+ * @param socket_path The server's socket.
+ * @param args The arguments to compile with, without the program name.
+ * @param status Receives the exit status of the remote compile.
+ * @return `false` if no server answered or the connection broke before a full reply arrived; the caller then
+ *         compiles locally.
+ */
+bool CompileClient::forward(const std::string &socket_path, const std::vector<std::string> &args, int &status) {
+    sockaddr_un address{};
+    char cwd[PATH_MAX];
+    if (!makeAddress(socket_path, address) || !getcwd(cwd, sizeof(cwd))) {
+        return false;
+    }
+    int fd = connectTo(address);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto count = static_cast<uint32_t>(args.size() + 1);
+    bool sent = writeAll(fd, &count, sizeof(count)) && writeString(fd, cwd);
+    for (size_t i = 0; sent && i < args.size(); ++i) {
+        sent = writeString(fd, args[i]);
+    }
+    int32_t reply_status = 0;
+    std::string out;
+    std::string err;
+    bool received = sent && readAll(fd, &reply_status, sizeof(reply_status)) && readString(fd, out) &&
+                    readString(fd, err);
+    ::close(fd);
+    if (!received) {
+        return false;
+    }
+
+    std::cout << out << std::flush;
+    std::cerr << err << std::flush;
+    status = reply_status;
+    return true;
+}
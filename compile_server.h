@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "preprocessor.h"
+#include "thread_pool.h"
+
+/**
+ * Warm compiler process behind a Unix domain socket. Each request carries the client's working directory and
+ * the same arguments `mcc` takes on the command line; the reply carries the exit status and everything the
+ * compile printed. Requests run concurrently, one thread per connection, and share the code generation pool,
+ * a set of arenas that are cleared rather than freed, and an include cache.
+ */
+class CompileServer {
+public:
+    explicit CompileServer(std::string socket_path);
+
+    int serve();
+
+private:
+    void handleConnection(int fd);
+
+    std::unique_ptr<Arena> takeArena();
+
+    void returnArena(std::unique_ptr<Arena> arena);
+
+    std::string m_socket_path;
+    ThreadPool m_pool;
+    IncludeCache m_include_cache;
+    std::mutex m_arena_mutex;
+    std::vector<std::unique_ptr<Arena>> m_arenas;
+};
+
+/**
+ * The other end of CompileServer: sends one request and relays the reply to stdout and stderr.
+ */
+class CompileClient {
+public:
+    static bool forward(const std::string &socket_path, const std::vector<std::string> &args, int &status);
+};
@@ -3,9 +3,27 @@
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <thread>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
 
 CompilerDriver::CompilerDriver()
-        : m_lex_only(false), m_parse_only(false), m_codegen_only(false), m_emit_assembly(false) {}
+        : m_lex_only(false), m_parse_only(false), m_tacky_only(false), m_codegen_only(false), m_emit_assembly(false),
+          m_compile_only(false), m_external_assembler(false), m_run(false), m_fold(true),
+          m_peephole_stats(false), m_thread_count(0), m_jobs(0), m_batch(false), m_lexer_mode(Lexer::Mode::Dfa),
+          m_gcc_preprocess(false), m_cache_max_bytes(uint64_t{1024} << 20), m_cache_stats(false),
+          m_time_report_enabled(false), m_time_report_text(false), m_pipeline(false),
+          m_streaming(false), m_parallel_lex(false), m_out(&std::cout), m_err(&std::cerr), m_pool(nullptr) {
+    m_codegen_options.peephole_rules = Peephole::kAllRules;
+}
 
 /**
  * @brief Runs the compiler driver with the given command line arguments.
@@ -13,225 +31,1344 @@ CompilerDriver::CompilerDriver()
  * @details The compiler driver runs compilation stages up to the specified stage and writes the intermediate output
  * to the terminal, or (if no stage is specified) to a file. The command line args are the stage flags and the input file name.
  *
+ * With `--server <socket>` the process becomes a compile server instead. With `--connect <socket>` the
+ * remaining arguments are forwarded to such a server, and compiled locally if none is listening.
+ *
  * @param argc
  * @param argv
  * @return
  */
 int CompilerDriver::run(int argc, char *argv[]) {
+    // Write errors (a closed pipe to the assembler, a client that went away) are reported, not fatal
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] != "--server" && args[i] != "--connect") {
+            continue;
+        }
+        if (i + 1 >= args.size()) {
+            std::cerr << "Missing argument to " << args[i] << std::endl;
+            return 1;
+        }
+        std::string socket_path = args[i + 1];
+        if (args[i] == "--server") {
+            if (args.size() != 2) {
+                std::cerr << "--server takes no other arguments; flags are given with each request" << std::endl;
+                return 1;
+            }
+            return CompileServer(socket_path).serve();
+        }
+        args.erase(args.begin() + static_cast<std::ptrdiff_t>(i), args.begin() + static_cast<std::ptrdiff_t>(i) + 2);
+        int status = 0;
+        // --run executes the compiled program in-process, which must not happen inside a shared server
+        bool runs_program = std::find(args.begin(), args.end(), "--run") != args.end();
+        if (!runs_program && CompileClient::forward(socket_path, args, status)) {
+            return status;
+        }
+        break;
+    }
+    return run(args, std::cout, std::cerr);
+}
+
+/**
+ * @brief Runs the compiler driver on an argument list, writing all output to the given streams.
+ *
+ * @details This is what a compile server calls for each request; `context` then carries the state it keeps
+ *          warm between requests.
+ *
+ * @param args The arguments, without the program name.
+ * @param out Receives stage output.
+ * @param err Receives diagnostics.
+ * @param context Long-lived state to reuse, if any.
+ * @returns The process exit code.
+ */
+int CompilerDriver::run(const std::vector<std::string> &raw_args, std::ostream &out, std::ostream &err,
+                        const CompileContext &context) {
+    m_out = &out;
+    m_err = &err;
+    m_context = context;
+    m_pool = context.pool;
+
+    std::vector<std::string> args;
+    if (!expandArguments(raw_args, args)) {
+        return 1;
+    }
+
     // Parse command line arguments
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
+    std::vector<std::string> inputs;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string &arg = args[i];
         if (arg == "--lex") {
             m_lex_only = true;
         } else if (arg == "--parse") {
             m_parse_only = true;
+        } else if (arg == "--tacky") {
+            m_tacky_only = true;
         } else if (arg == "--codegen") {
             m_codegen_only = true;
         } else if (arg == "-S") {
             m_emit_assembly = true;
+        } else if (arg == "-c") {
+            m_compile_only = true;
+        } else if (arg == "--external-assembler") {
+            m_external_assembler = true;
+        } else if (arg == "--run") {
+            m_run = true;
+        } else if (arg == "--no-fold") {
+            m_fold = false;
+        } else if (arg == "--no-regalloc") {
+            m_codegen_options.allocate_registers = false;
+        } else if (arg == "--no-peephole") {
+            m_codegen_options.peephole_rules = 0;
+        } else if (arg.rfind("--peephole=", 0) == 0) {
+            if (!Peephole::parseRules(arg.substr(11), m_codegen_options.peephole_rules)) {
+                *m_err << "Unknown peephole rule in " << arg << std::endl;
+                return 1;
+            }
+        } else if (arg == "--peephole-stats") {
+            m_peephole_stats = true;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            char *end = nullptr;
+            long count = std::strtol(arg.c_str() + 10, &end, 10);
+            if (*end != '\0' || end == arg.c_str() + 10 || count < 1) {
+                *m_err << "Invalid thread count in " << arg << std::endl;
+                return 1;
+            }
+            m_thread_count = static_cast<unsigned>(count);
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            m_cache_dir = arg.substr(12);
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            char *end = nullptr;
+            long long megabytes = std::strtoll(arg.c_str() + 13, &end, 10);
+            if (*end != '\0' || end == arg.c_str() + 13 || megabytes < 1) {
+                *m_err << "Invalid cache size in " << arg << std::endl;
+                return 1;
+            }
+            m_cache_max_bytes = static_cast<uint64_t>(megabytes) << 20;
+        } else if (arg == "--cache-stats") {
+            m_cache_stats = true;
+        } else if (arg == "--time-report") {
+            m_time_report_enabled = true;
+            m_time_report_text = true;
+        } else if (arg.rfind("--time-report-json=", 0) == 0) {
+            m_time_report_enabled = true;
+            m_time_report_json = arg.substr(19);
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            m_trace_file = arg.substr(8);
+        } else if (arg == "--pipeline") {
+            m_pipeline = true;
+        } else if (arg == "--streaming") {
+            m_streaming = true;
+        } else if (arg == "--parallel-lex") {
+            m_parallel_lex = true;
+        } else if (arg == "--regex-lexer") {
+            m_lexer_mode = Lexer::Mode::Regex;
+        } else if (arg == "--gcc-preprocess") {
+            m_gcc_preprocess = true;
+        } else if (arg.rfind("-j", 0) == 0) {
+            std::string value = arg.substr(2);
+            if (value.empty()) {
+                if (i + 1 >= args.size()) {
+                    *m_err << "Missing argument to " << arg << std::endl;
+                    return 1;
+                }
+                value = args[++i];
+            }
+            char *end = nullptr;
+            long jobs = std::strtol(value.c_str(), &end, 10);
+            if (*end != '\0' || value.empty() || jobs < 1) {
+                *m_err << "Invalid job count " << value << std::endl;
+                return 1;
+            }
+            m_jobs = static_cast<unsigned>(jobs);
+            m_batch = true;
+        } else if (arg.rfind("-I", 0) == 0 || arg.rfind("-D", 0) == 0 || arg.rfind("-U", 0) == 0) {
+            std::string value = arg.substr(2);
+            if (value.empty()) {
+                if (i + 1 >= args.size()) {
+                    *m_err << "Missing argument to " << arg << std::endl;
+                    return 1;
+                }
+                value = args[++i];
+            }
+            if (arg[1] == 'I') {
+                m_preprocessor_options.include_dirs.push_back(value);
+            } else if (arg[1] == 'U') {
+                m_preprocessor_options.undefines.push_back(value);
+            } else {
+                auto equals = value.find('=');
+                m_preprocessor_options.defines.emplace_back(
+                        value.substr(0, equals), equals == std::string::npos ? "1" : value.substr(equals + 1));
+            }
         } else if (arg[0] == '-') {
-            std::cerr << "Unknown option: " << arg << std::endl;
+            *m_err << "Unknown option: " << arg << std::endl;
             printUsage();
             return 1;
         } else {
-            if (m_input_file.empty()) {
-                m_input_file = arg;
-            } else if (m_output_file.empty()) {
-                m_output_file = arg;
-            } else {
-                std::cerr << "Too many arguments" << std::endl;
-                printUsage();
-                return 1;
-            }
+            inputs.push_back(arg);
         }
     }
 
-    if (m_input_file.empty()) {
-        std::cerr << "No input file specified" << std::endl;
+    if (inputs.empty()) {
+        *m_err << "No input file specified" << std::endl;
         printUsage();
         return 1;
     }
+    if (m_run && context.serving) {
+        *m_err << "--run is not available through the compile server" << std::endl;
+        return 1;
+    }
+    if (!m_trace_file.empty() && context.serving) {
+        // The trace buffers are per process; a server's would mix every client's compiles
+        *m_err << "--trace is not available through the compile server" << std::endl;
+        return 1;
+    }
+    if (m_streaming && (m_pipeline || m_external_assembler)) {
+        // Streaming keeps one function in memory at a time; both of these want the whole program
+        *m_err << "--streaming cannot be combined with --pipeline or --external-assembler" << std::endl;
+        return 1;
+    }
+    if (m_parallel_lex && (m_pipeline || m_streaming)) {
+        // Both lex on demand, a window of tokens at a time, rather than the whole file up front
+        *m_err << "--parallel-lex cannot be combined with --pipeline or --streaming" << std::endl;
+        return 1;
+    }
+    if (m_cache_stats && m_cache_dir.empty()) {
+        *m_err << "--cache-stats needs --cache-dir" << std::endl;
+        return 1;
+    }
+    if (m_batch) {
+        if (m_run) {
+            *m_err << "--run cannot be combined with batch mode" << std::endl;
+            return 1;
+        }
+    } else if (inputs.size() > 2) {
+        *m_err << "Too many arguments" << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    if (m_time_report_enabled) {
+        AllocationCounter::enable();
+    }
+    if (!m_trace_file.empty()) {
+        Trace::start();
+    }
+    int status;
+    if (m_batch) {
+        status = runBatch(inputs);
+    } else {
+        m_input_file = inputs[0];
+        m_output_file = inputs.size() > 1 ? inputs[1] : defaultOutputFile(m_input_file);
+        status = compile();
+        m_time_reports.push_back(std::move(m_time_report));
+    }
+    if (m_cache_stats) {
+        printCacheStats();
+    }
+    if (!m_trace_file.empty() && !Trace::write(m_trace_file)) {
+        *m_err << "Unable to write trace " << m_trace_file << std::endl;
+        return 1;
+    }
+    if (!m_time_report_json.empty()) {
+        std::ofstream json(m_time_report_json);
+        TimeReport::writeJson(json, m_time_reports);
+        if (!json.flush()) {
+            *m_err << "Unable to write time report " << m_time_report_json << std::endl;
+            return 1;
+        }
+    }
+    return status;
+}
 
-    if (m_output_file.empty()) {
-        m_output_file = m_input_file.substr(0, m_input_file.find_last_of('.')) + "";
+/**
+ * @brief Compiles every input file in one process, spread over a work-stealing pool.
+ *
+ * @details Each file is compiled by its own copy of the driver, so lexer, parser and code generator state is
+ *          never shared between workers. Output and diagnostics are buffered per file and printed in input
+ *          order as soon as all earlier files are done, so logs do not interleave. Output names are derived
+ *          from the inputs as in single-file mode.
+ *
+ * @param inputs The input files.
+ * @returns 0 if every file compiled, 1 otherwise.
+ */
+int CompilerDriver::runBatch(const std::vector<std::string> &inputs) {
+    unsigned jobs = std::min<size_t>(m_jobs ? m_jobs : ThreadPool::defaultThreadCount(), inputs.size());
+    // The calling thread is one of the workers, so the pool needs one thread fewer. A shared pool is reused
+    // unless its threads first need setting up to run whole compiles, as in a server.
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool *pool = m_pool;
+    if (!pool || m_context.enter_context) {
+        own_pool = std::make_unique<ThreadPool>(std::max(jobs, m_thread_count) - 1, m_context.enter_context);
+        pool = own_pool.get();
     }
 
-    // Preprocess
-    std::string preprocessed_file = m_input_file.substr(0, m_input_file.find_last_of('.')) + ".i";
-    if (!preprocess(m_input_file, preprocessed_file)) {
-        std::cerr << "Preprocessing failed" << std::endl;
+    struct Result {
+        std::ostringstream out;
+        std::ostringstream err;
+        int status = 0;
+        bool done = false;
+        TimeReport time_report;
+    };
+    std::vector<Result> results(inputs.size());
+    std::mutex print_mutex;
+    size_t next_to_print = 0;
+    size_t failures = 0;
+    // Jobs copy the driver, so reports are only moved into it once every job is done
+    std::vector<TimeReport> time_reports;
+
+    // Only `jobs` files are in flight at once; any other workers serve the per-function tasks
+    std::atomic<size_t> next_input{0};
+    auto compileInputs = [&](size_t) {
+        for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+            Result &result = results[i];
+            CompilerDriver job(*this);
+            job.m_input_file = inputs[i];
+            job.m_output_file = defaultOutputFile(inputs[i]);
+            job.m_out = &result.out;
+            job.m_err = &result.err;
+            job.m_pool = m_thread_count == 1 ? nullptr : pool;
+            job.m_context.arena = nullptr;
+            try {
+                result.status = job.compile();
+            } catch (const std::exception &e) {
+                result.err << inputs[i] << ": Internal error: " << e.what() << std::endl;
+                result.status = 1;
+            }
+            result.time_report = std::move(job.m_time_report);
+
+            std::lock_guard lock(print_mutex);
+            result.done = true;
+            for (; next_to_print < results.size() && results[next_to_print].done; ++next_to_print) {
+                Result &ready = results[next_to_print];
+                *m_out << ready.out.str() << std::flush;
+                *m_err << ready.err.str() << std::flush;
+                failures += ready.status != 0;
+                if (ready.time_report.enabled()) {
+                    time_reports.push_back(std::move(ready.time_report));
+                }
+            }
+        }
+    };
+    pool->parallelFor(jobs, compileInputs);
+    m_time_reports = std::move(time_reports);
+
+    if (failures > 0) {
+        *m_err << failures << " of " << inputs.size() << " files failed to compile" << std::endl;
         return 1;
     }
+    return 0;
+}
 
-    // Run compilation stages
-    std::vector<Token> tokens;
-    std::unique_ptr<Program> ast;
-    std::unique_ptr<assembly::Program> asmProgram;
+/**
+ * @brief Returns the output path used when none is given: the input without its extension, plus `.o` with `-c`.
+ */
+std::string CompilerDriver::defaultOutputFile(const std::string &input_file) const {
+    return input_file.substr(0, input_file.find_last_of('.')) + (m_compile_only ? ".o" : "");
+}
 
-    // Lexer stage
-    if (!runLexer(preprocessed_file, tokens)) {
-        std::remove(preprocessed_file.c_str());
+/**
+ * @brief Copies the command line arguments, replacing each `@file` with the arguments listed in that file.
+ *
+ * @details Arguments in a response file are separated by whitespace and may be quoted with `'` or `"`.
+ *          Response files may name further response files. Using one turns on batch mode, since the list it
+ *          holds is usually a set of inputs.
+ *
+ * @param raw_args The arguments as given.
+ * @param args Receives the expanded arguments.
+ * @returns `false` if a response file cannot be read.
+ */
+bool CompilerDriver::expandArguments(const std::vector<std::string> &raw_args, std::vector<std::string> &args) {
+    std::vector<std::string> pending(raw_args);
+    std::reverse(pending.begin(), pending.end());
+    int depth = 0;
+    while (!pending.empty()) {
+        std::string arg = std::move(pending.back());
+        pending.pop_back();
+        if (arg.size() < 2 || arg[0] != '@') {
+            args.push_back(std::move(arg));
+            continue;
+        }
+        if (++depth > 64) {
+            *m_err << "Too many nested response files at " << arg << std::endl;
+            return false;
+        }
+        std::ifstream file(arg.substr(1));
+        if (!file) {
+            *m_err << "Unable to read response file " << arg.substr(1) << std::endl;
+            return false;
+        }
+        std::vector<std::string> contents;
+        std::string current;
+        bool in_word = false;
+        char quote = 0;
+        for (char c; file.get(c);) {
+            if (quote) {
+                if (c == quote) {
+                    quote = 0;
+                } else {
+                    current += c;
+                }
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+                in_word = true;
+            } else if (std::isspace(static_cast<unsigned char>(c))) {
+                if (in_word) {
+                    contents.push_back(std::move(current));
+                    current.clear();
+                    in_word = false;
+                }
+            } else {
+                current += c;
+                in_word = true;
+            }
+        }
+        if (in_word) {
+            contents.push_back(std::move(current));
+        }
+        pending.insert(pending.end(), contents.rbegin(), contents.rend());
+        m_batch = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Compiles `m_input_file` to `m_output_file`, stopping after the stage the flags ask for.
+ *
+ * @details All output goes to `m_out` and `m_err`, which batch mode points at per-file buffers. With
+ *          `--time-report` the phases are timed into `m_time_report`, which is printed here and left for the
+ *          caller to collect for the JSON report.
+ *
+ * @returns The process exit code: 0 on success, or the program's result with `--run`.
+ */
+int CompilerDriver::compile() {
+    Trace::Scope trace("compile", m_input_file);
+    m_time_report = m_time_report_enabled ? TimeReport(m_input_file) : TimeReport();
+    int status = runStages();
+    m_time_report.finish();
+    if (m_time_report_text) {
+        m_time_report.print(*m_err);
+    }
+    return status;
+}
+
+int CompilerDriver::runStages() {
+    // Preprocess. Tokens slice `source`, so it must outlive them.
+    SourceBuffer source;
+    m_time_report.begin("preprocess");
+    if (!preprocess(m_input_file, source)) {
+        *m_err << "Preprocessing failed" << std::endl;
         return 1;
     }
-    if (m_lex_only) {
-        std::remove(preprocessed_file.c_str());
-        return 0;
+    m_time_report.count("bytes", source.text().size());
+
+    // A cache hit stands in for every later stage, including assembling and linking
+    std::string output_file = m_emit_assembly ? m_input_file.substr(0, m_input_file.find_last_of('.')) + ".s"
+                                              : m_output_file;
+    std::unique_ptr<CompileCache> cache;
+    std::string cache_key;
+    if (!m_cache_dir.empty() && !m_lex_only && !m_parse_only && !m_tacky_only && !m_codegen_only && !m_run) {
+        m_time_report.begin("cache");
+        cache = std::make_unique<CompileCache>(m_cache_dir, m_cache_max_bytes);
+        cache_key = CompileCache::key(source.text(), cacheFlags());
+        bool hit = cache->fetch(cache_key, output_file);
+        cache->recordLookup(hit);
+        if (hit) {
+            if (m_emit_assembly) {
+                *m_out << "Assembly code generated and written to " << output_file << std::endl;
+            }
+            return 0;
+        }
+    }
+
+    // Run compilation stages. The AST lives in `arena` and is released with it in one go.
+    Arena local_arena;
+    Arena &arena = m_context.arena ? *m_context.arena : local_arena;
+    Program *ast = nullptr;
+    tacky::Program tackyProgram;
+    std::unique_ptr<assembly::Program> asmProgram;
+
+    if (m_streaming && !m_lex_only && !m_parse_only && !m_tacky_only && !m_codegen_only) {
+        return runStreaming(source, arena, cache.get(), cache_key, output_file);
+    }
+
+    if (m_pipeline && !m_lex_only && !m_parse_only && !m_tacky_only) {
+        m_time_report.begin("pipeline");
+        if (!runPipeline(source, arena, asmProgram)) {
+            return 1;
+        }
+        return finishCompile(asmProgram, cache.get(), cache_key, output_file);
+    }
+
+    // Lexer stage. Only --lex and --parallel-lex need every token at once; otherwise the parser lexes as it goes.
+    std::vector<Token> tokens;
+    if (m_lex_only || m_parallel_lex) {
+        m_time_report.begin("lex");
+        if (!runLexer(source, tokens)) {
+            return 1;
+        }
+        m_time_report.count("tokens", tokens.size());
+        if (m_lex_only) {
+            return 0;
+        }
     }
 
     // Parser stage
-    if (!runParser(tokens, ast)) {
-        std::remove(preprocessed_file.c_str());
+    m_time_report.begin(m_parallel_lex ? "parse" : "lex+parse");
+    size_t objects = arena.objectCount();
+    size_t token_count = 0;
+    if (!runParser(source, m_parallel_lex ? &tokens : nullptr, arena, ast, token_count)) {
         return 1;
     }
+    m_time_report.count("tokens", token_count);
+    m_time_report.count("nodes", arena.objectCount() - objects);
     if (m_parse_only) {
-        std::remove(preprocessed_file.c_str());
         return 0;
     }
 
-    // Code generation stage
-    if (!runCodeGen(ast, asmProgram)) {
-        std::remove(preprocessed_file.c_str());
+    // Constant folding; replacement nodes go into the same arena as the rest of the AST
+    if (m_fold) {
+        m_time_report.begin("fold");
+        objects = arena.objectCount();
+        Trace::Scope trace("fold");
+        ConstantFolder::fold(*ast, arena);
+        m_time_report.count("new_nodes", arena.objectCount() - objects);
+    }
+
+    // TACKY generation stage
+    m_time_report.begin("tacky");
+    if (!runTackyGen(*ast, tackyProgram)) {
         return 1;
     }
-    if (m_codegen_only) {
-        std::remove(preprocessed_file.c_str());
+    if (m_time_report.enabled()) {
+        size_t instructions = 0;
+        for (const auto &function: tackyProgram.functions) {
+            instructions += function.instructions.size();
+        }
+        m_time_report.count("instructions", instructions);
+    }
+    if (m_tacky_only) {
         return 0;
     }
 
-    // Code emission stage
-    std::string assembly_file = m_input_file.substr(0, m_input_file.find_last_of('.')) + ".s";
-    if (!emitCode(asmProgram, assembly_file)) {
-        std::remove(preprocessed_file.c_str());
+    // Code generation stage
+    m_time_report.begin("codegen");
+    if (!runCodeGen(tackyProgram, asmProgram)) {
         return 1;
     }
+    if (m_time_report.enabled()) {
+        size_t instructions = 0;
+        for (const auto &function: asmProgram->functions) {
+            instructions += function->instructions.size();
+        }
+        m_time_report.count("instructions", instructions);
+    }
+    return finishCompile(asmProgram, cache.get(), cache_key, output_file);
+}
 
-    if (m_emit_assembly) {
-        // If -S flag is set, we stop here and keep the .s file
-        std::cout << "Assembly code generated and written to " << assembly_file << std::endl;
-        std::remove(preprocessed_file.c_str());
+/**
+ * @brief Runs whatever follows code generation: nothing with `--codegen`, the JIT with `--run`, otherwise
+ *        writing the output and adding it to the cache.
+ *
+ * @returns The process exit code.
+ */
+int CompilerDriver::finishCompile(const std::unique_ptr<assembly::Program> &asmProgram, CompileCache *cache,
+                                  const std::string &cache_key, const std::string &output_file) {
+    if (m_codegen_only) {
         return 0;
     }
 
-    // Assemble
-    if (!assemble(assembly_file, m_output_file)) {
-        std::cerr << "Assembly failed" << std::endl;
-        std::remove(preprocessed_file.c_str());
-        std::remove(assembly_file.c_str());
-        return 1;
+    // JIT: run main in-process and pass its result through as the exit code
+    if (m_run) {
+        m_time_report.begin("run");
+        int exit_code = 0;
+        if (!runJit(asmProgram, exit_code)) {
+            return 1;
+        }
+        return exit_code;
     }
 
-    // Cleanup intermediate files
-    std::remove(preprocessed_file.c_str());
-    std::remove(assembly_file.c_str());
+    if (!writeOutput(asmProgram, output_file)) {
+        return 1;
+    }
+    if (cache) {
+        m_time_report.begin("cache-store");
+        cache->store(cache_key, output_file);
+    }
+    if (m_emit_assembly) {
+        *m_out << "Assembly code generated and written to " << output_file << std::endl;
+    }
 
     // std::cout << "Compilation completed successfully. Output written to " << m_output_file << std::endl;
     return 0;
 }
 
+/**
+ * @brief Writes the final output: the `.s` file with `-S`, the object file with `-c`, otherwise the executable.
+ *
+ * @param asmProgram The generated assembly.
+ * @param output_file Where the output goes.
+ * @returns `true` if the output was written.
+ */
+bool CompilerDriver::writeOutput(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file) {
+    if (m_emit_assembly) {
+        // Code emission stage: with -S we stop here and keep the .s file
+        m_time_report.begin("emit");
+        return emitCode(asmProgram, output_file);
+    }
+    if (m_external_assembler) {
+        // Stream the assembly text straight into gcc; no intermediate .s file
+        m_time_report.begin("assemble");
+        if (!assemble(asmProgram, output_file)) {
+            *m_err << "Assembly failed" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Encode straight to an object file; only linking needs the system toolchain
+    m_time_report.begin("object");
+    x86::Encoder encoder;
+    try {
+        Trace::Scope trace("encode");
+        asmProgram->encode(encoder);
+    } catch (const std::exception &e) {
+        *m_err << "Encoding error: " << e.what() << std::endl;
+        return false;
+    }
+    return writeBinary(encoder, output_file);
+}
+
+/**
+ * @brief Writes encoded machine code as the object file with `-c`, otherwise links it into the executable.
+ *
+ * @param encoder The encoded program.
+ * @param output_file Where the output goes.
+ * @returns `true` if the output was written.
+ */
+bool CompilerDriver::writeBinary(const x86::Encoder &encoder, const std::string &output_file) {
+    std::string stem = m_input_file.substr(0, m_input_file.find_last_of('.'));
+    std::string object_file = m_compile_only ? output_file : stem + ".o";
+    if (!writeObject(encoder, object_file)) {
+        return false;
+    }
+    if (m_compile_only) {
+        return true;
+    }
+    m_time_report.begin("link");
+    bool linked = link(object_file, output_file);
+    std::remove(object_file.c_str());
+    if (!linked) {
+        *m_err << "Linking failed" << std::endl;
+    }
+    return linked;
+}
+
+/**
+ * @brief Spells out the options that change the final output, for the cache key.
+ *
+ * @details Preprocessor options are left out: their effect is already in the preprocessed text. So is the
+ *          thread count, since code generation is deterministic.
+ */
+std::string CompilerDriver::cacheFlags() const {
+    std::ostringstream flags;
+    flags << (m_emit_assembly ? "-S" : m_compile_only ? "-c" : "link")
+          << (m_external_assembler ? " external-assembler" : "")
+          << (m_fold ? "" : " no-fold")
+          << (m_codegen_options.allocate_registers ? "" : " no-regalloc")
+          << " peephole=" << m_codegen_options.peephole_rules
+          << (m_lexer_mode == Lexer::Mode::Regex ? " regex-lexer" : "");
+    return flags.str();
+}
+
+void CompilerDriver::printCacheStats() {
+    CompileCache::Stats stats = CompileCache(m_cache_dir, m_cache_max_bytes).stats();
+    uint64_t lookups = stats.hits + stats.misses;
+    *m_err << "Cache " << m_cache_dir << ": " << stats.hits << " hits, " << stats.misses << " misses";
+    if (lookups > 0) {
+        *m_err << " (" << std::fixed << std::setprecision(1) << 100.0 * static_cast<double>(stats.hits) /
+                                                                    static_cast<double>(lookups) << "% hit rate)";
+    }
+    *m_err << ", " << stats.stores << " stores, " << stats.evictions << " evictions; " << stats.entries
+           << " entries, " << stats.bytes << " of " << m_cache_max_bytes << " bytes" << std::endl;
+}
+
+/**
+ * @brief Preprocesses the input file into memory.
+ *
+ * @details Uses the built-in preprocessor unless `--gcc-preprocess` was given, in which case `gcc -E` is run
+ *          as before.
+ *
+ * @param input_file The path to the input file to be preprocessed.
+ * @param source The buffer that receives the preprocessed translation unit.
+ * @returns `true` if preprocessing is successful, `false` otherwise.
+ */
+bool CompilerDriver::preprocess(const std::string &input_file, SourceBuffer &source) {
+    Trace::Scope trace("preprocess");
+    m_line_marks.clear();
+    if (m_gcc_preprocess) {
+        return preprocessWithGcc(input_file, source);
+    }
+
+    Preprocessor preprocessor(m_preprocessor_options, m_context.include_cache);
+    try {
+        source = SourceBuffer::fromString(preprocessor.preprocess(input_file));
+        m_line_marks = preprocessor.lineMarks();
+    } catch (const PreprocessError &e) {
+        *m_err << e.file << ":" << e.line << ": Preprocessing error: " << e.what() << std::endl;
+        return false;
+    } catch (const std::exception &e) {
+        *m_err << "Preprocessing error: " << e.what() << std::endl;
+        return false;
+    }
+    for (const auto &warning: preprocessor.warnings()) {
+        *m_err << warning << std::endl;
+    }
+    return true;
+}
+
 /**
  * @brief Preprocesses the input file using the GCC preprocessor.
  *
+ * @details The `.i` file is mapped and then removed straight away; the mapping stays valid until `source`
+ *          is released.
+ *
  * @param input_file The path to the input file to be preprocessed.
- * @param output_file The path to the output file where the preprocessed content will be written.
+ * @param source The buffer that receives the preprocessed translation unit.
  * @returns `true` if preprocessing is successful, `false` otherwise.
  */
-bool CompilerDriver::preprocess(const std::string &input_file, const std::string &output_file) {
-    std::string command = "gcc -E -P " + input_file + " -o " + output_file;
-    return system(command.c_str()) == 0;
+bool CompilerDriver::preprocessWithGcc(const std::string &input_file, SourceBuffer &source) {
+    std::string output_file = input_file.substr(0, input_file.find_last_of('.')) + ".i";
+    std::string command = "gcc -E -P";
+    for (const auto &dir: m_preprocessor_options.include_dirs) {
+        command += " -I" + dir;
+    }
+    for (const auto &[name, value]: m_preprocessor_options.defines) {
+        command += " -D" + name + "=" + value;
+    }
+    for (const auto &name: m_preprocessor_options.undefines) {
+        command += " -U" + name;
+    }
+    command += " " + input_file + " -o " + output_file;
+    if (system(command.c_str()) != 0) {
+        return false;
+    }
+
+    try {
+        source = SourceBuffer::mapFile(output_file);
+    } catch (const std::exception &e) {
+        *m_err << "Error: " << e.what() << std::endl;
+        std::remove(output_file.c_str());
+        return false;
+    }
+    std::remove(output_file.c_str());
+    return true;
 }
 
 /**
- * @brief Assembles the given assembly file using GCC.
+ * @brief Assembles the program using GCC, emitting the assembly text into a pipe to its standard input.
  *
- * @param input_file The path to the input assembly file.
- * @param output_file The path to the output file where the executable will be written.
+ * @details run() ignores SIGPIPE, so an assembler that exits early shows up as a write error rather than
+ *          killing the driver.
+ *
+ * @param asmProgram The assembly AST to emit.
+ * @param output_file The path to the output file where the executable (or, with `-c`, the object file) will be
+ *                    written.
  * @returns `true` if assembly is successful, `false` otherwise.
  */
-bool CompilerDriver::assemble(const std::string &input_file, const std::string &output_file) {
-    std::string command = "gcc " + input_file + " -o " + output_file;
+bool CompilerDriver::assemble(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file) {
+    Trace::Scope trace("assemble");
+    std::string command = std::string("gcc ") + (m_compile_only ? "-c " : "") + "-x assembler - -o " + output_file;
+    FILE *pipe = popen(command.c_str(), "w");
+    if (!pipe) {
+        *m_err << "Error: Unable to start the assembler" << std::endl;
+        return false;
+    }
+    bool emitted = true;
+    try {
+        Sink out(fileno(pipe));
+        asmProgram->emit(out);
+        out.flush();
+    } catch (const std::exception &e) {
+        *m_err << "Emission error: " << e.what() << std::endl;
+        emitted = false;
+    }
+    int status = pclose(pipe);
+    return emitted && status == 0;
+}
+
+/**
+ * @brief Writes encoded machine code as an ELF relocatable object.
+ *
+ * @param encoder The encoded program.
+ * @param object_file The path of the object file to write.
+ * @returns `true` if the object file is written successfully, `false` otherwise.
+ */
+bool CompilerDriver::writeObject(const x86::Encoder &encoder, const std::string &object_file) {
+    Trace::Scope trace("object");
+    if (!ElfObjectWriter::write(encoder, object_file)) {
+        *m_err << "Error: Unable to write object file " << object_file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Encodes the assembly AST and calls its `main` function in-process.
+ *
+ * @param asmProgram The assembly AST to run.
+ * @param exit_code Receives the value returned by `main`.
+ * @returns `true` if the program was run, `false` if it could not be encoded or loaded.
+ */
+bool CompilerDriver::runJit(const std::unique_ptr<assembly::Program> &asmProgram, int &exit_code) {
+    Trace::Scope trace("run");
+    try {
+        x86::Encoder encoder;
+        asmProgram->encode(encoder);
+        exit_code = Jit::run(encoder, "main");
+        return true;
+    } catch (const std::exception &e) {
+        *m_err << "JIT error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+/**
+ * @brief Calls the `main` function of an already encoded program in-process.
+ *
+ * @param encoder The encoded program.
+ * @param exit_code Receives the value returned by `main`.
+ * @returns `true` if the program was run, `false` if it could not be loaded.
+ */
+bool CompilerDriver::runJit(const x86::Encoder &encoder, int &exit_code) {
+    Trace::Scope trace("run");
+    try {
+        exit_code = Jit::run(encoder, "main");
+        return true;
+    } catch (const std::exception &e) {
+        *m_err << "JIT error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+/**
+ * @brief Links an object file into an executable using GCC.
+ *
+ * @param object_file The path to the object file.
+ * @param output_file The path to the output file where the executable will be written.
+ * @returns `true` if linking is successful, `false` otherwise.
+ */
+bool CompilerDriver::link(const std::string &object_file, const std::string &output_file) {
+    Trace::Scope trace("link");
+    std::string command = "gcc " + object_file + " -o " + output_file;
     return system(command.c_str()) == 0;
 }
 
 /**
- * @brief Runs the lexer on the input file.
+ * @brief Runs the lexer on the preprocessed translation unit.
  *
- * @details The lexer reads the input file, tokenizes it, and stores the tokens in the given vector.
+ * @details The lexer tokenizes the buffer in place and stores the tokens in the given vector. Token payloads are
+ *          slices of the buffer, so `source` has to stay alive as long as the tokens do.
  *
- * @param input_file The path to the input file to be tokenized.
+ * @param source The preprocessed translation unit.
  * @param tokens The vector where the tokens will be stored.
  * @returns `true` if the lexer runs successfully, `false` otherwise.
  */
-bool CompilerDriver::runLexer(const std::string &input_file, std::vector<Token> &tokens) {
-    std::ifstream file(input_file);
-    if (!file.is_open()) {
-        std::cerr << "Error: Unable to open file " << input_file << std::endl;
-        return false;
-    }
+bool CompilerDriver::runLexer(const SourceBuffer &source, std::vector<Token> &tokens) {
+    Trace::Scope trace("lex");
+    std::string_view input = source.text();
 
-    std::string input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    unsigned threads = m_parallel_lex ? (m_thread_count ? m_thread_count : ThreadPool::defaultThreadCount()) : 1;
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool *pool = m_pool;
+    if (!pool && threads > 1 && input.size() >= 2 * Lexer::kParallelChunkSize) {
+        own_pool = std::make_unique<ThreadPool>(threads - 1);
+        pool = own_pool.get();
+    }
 
-    Lexer lexer(input);
+    Lexer lexer(input, m_lexer_mode);
+    auto start = std::chrono::steady_clock::now();
     try {
-        tokens = lexer.tokenize();
+        tokens = m_parallel_lex && pool ? lexer.tokenizeParallel(pool) : lexer.tokenize();
+    } catch (const LexError &e) {
+        reportDiagnostic(source, e.location, "Lexer error", e.what());
+        return false;
     } catch (const std::exception &e) {
-        std::cerr << "Lexer error: " << e.what() << std::endl;
+        *m_err << "Lexer error: " << e.what() << std::endl;
         return false;
     }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
 
     if (m_lex_only) {
         // Output the tokens
         for (const auto &token: tokens) {
-            std::cout << "Token: Type = " << static_cast<int>(token.type)
-                      << ", Value = \"" << token.value << "\"" << std::endl;
+            *m_out << "Token: Type = " << static_cast<int>(token.type)
+                      << ", Value = \"" << tokenText(token) << "\"" << std::endl;
         }
+
+        // Throughput goes to stderr so the token listing stays machine-comparable
+        double megabytes = static_cast<double>(input.size()) / (1024.0 * 1024.0);
+        *m_err << "Lexed " << input.size() << " bytes into " << tokens.size() << " tokens in "
+                  << std::fixed << std::setprecision(3) << elapsed.count() * 1000.0 << " ms ("
+                  << (elapsed.count() > 0 ? megabytes / elapsed.count() : 0.0) << " MB/s, "
+                  << (m_lexer_mode == Lexer::Mode::Dfa ? "dfa" : "regex") << " scanner)" << std::endl;
     }
 
     return true;
 }
 
 /**
- * @brief Runs the parser on the given tokens.
+ * @brief Lexes and parses the source.
+ *
+ * @details Unless the tokens were lexed up front, the parser pulls them from a generator over the lexer, so
+ *          only a small window of them exists at a time. It constructs an abstract syntax tree (AST) in the given
+ *          arena and stores its root in the given pointer.
  *
- * @details The parser reads the tokens, constructs an abstract syntax tree (AST), and stores it in the given pointer.
+ *          A lexer error is reported in preference to a parse error, wherever in the file it is: after a parse
+ *          error the rest of the source is still lexed.
  *
- * @param tokens The tokens to be parsed.
+ * @param source The preprocessed translation unit.
+ * @param tokens The source's tokens, or null to lex while parsing.
+ * @param arena The arena that owns the AST nodes.
  * @param ast The pointer where the AST will be stored.
+ * @param token_count Receives the number of tokens lexed.
  * @returns `true` if the parser runs successfully, `false` otherwise.
  */
-bool CompilerDriver::runParser(const std::vector<Token> &tokens, std::unique_ptr<Program> &ast) {
+bool CompilerDriver::runParser(const SourceBuffer &source, const std::vector<Token> *tokens, Arena &arena,
+                               Program *&ast, size_t &token_count) {
+    Trace::Scope trace(tokens ? "parse" : "lex+parse");
+    Lexer lexer(source.text(), m_lexer_mode);
+    TokenStream stream = tokens ? TokenStream(std::span<const Token>(*tokens)) : TokenStream(lexer.stream());
     try {
-        Parser parser(tokens);
-        ast = parser.parse();
-        if (m_parse_only) {
-            std::cout << "Parsing successful. AST created." << std::endl;
-            printPrettyAST(ast);
+        try {
+            Parser parser(stream, arena);
+            ast = parser.parse();
+            token_count = stream.count();
+        } catch (const ParseError &e) {
+            while (stream.peek()) {
+                stream.advance();
+            }
+            reportDiagnostic(source, e.location, "Parsing error", e.what());
+            return false;
         }
-        return true;
+    } catch (const LexError &e) {
+        reportDiagnostic(source, e.location, "Lexer error", e.what());
+        return false;
+    } catch (const std::exception &e) {
+        *m_err << "Lexer error: " << e.what() << std::endl;
+        return false;
+    }
+    if (m_parse_only) {
+        *m_out << "Parsing successful. AST created." << std::endl;
+        printPrettyAST(*ast);
+    }
+    return true;
+}
+
+/**
+ * @brief Compiles the translation unit one function at a time, so peak memory depends on the largest function
+ *        rather than on the size of the file.
+ *
+ * @details With `-S` each function's assembly text is written as soon as it is generated. Otherwise it is
+ *          encoded to machine code, which is all that is kept until the object file is written or, with
+ *          `--run`, the program is called.
+ *
+ * @param source The preprocessed translation unit.
+ * @param arena Holds one function's AST at a time.
+ * @param cache If not null, receives the output once it is written.
+ * @param cache_key The output's key in `cache`.
+ * @param output_file Where the output goes.
+ * @returns The process exit code.
+ */
+int CompilerDriver::runStreaming(const SourceBuffer &source, Arena &arena, CompileCache *cache,
+                                 const std::string &cache_key, const std::string &output_file) {
+    m_time_report.begin("stream");
+    if (m_emit_assembly) {
+        int fd = ::open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            *m_err << "Error: Unable to open output file " << output_file << std::endl;
+            return 1;
+        }
+        bool written = false;
+        try {
+            Sink out(fd);
+            written = compileEachFunction(source, arena, [&out](const assembly::Function &function) {
+                function.emit(out);
+            });
+            if (written) {
+                assembly::Program::emitTrailer(out);
+                out.flush();
+            }
+        } catch (const std::exception &e) {
+            *m_err << "Emission error: " << e.what() << std::endl;
+            written = false;
+        }
+        written = ::close(fd) == 0 && written;
+        if (!written) {
+            std::remove(output_file.c_str());
+            return 1;
+        }
+        if (cache) {
+            m_time_report.begin("cache-store");
+            cache->store(cache_key, output_file);
+        }
+        *m_out << "Assembly code generated and written to " << output_file << std::endl;
+        return 0;
+    }
+
+    x86::Encoder encoder;
+    bool encoded = false;
+    try {
+        encoded = compileEachFunction(source, arena, [&encoder](const assembly::Function &function) {
+            function.encode(encoder);
+        });
+    } catch (const std::exception &e) {
+        *m_err << "Encoding error: " << e.what() << std::endl;
+    }
+    if (!encoded) {
+        return 1;
+    }
+    if (m_run) {
+        m_time_report.begin("run");
+        int exit_code = 0;
+        return runJit(encoder, exit_code) ? exit_code : 1;
+    }
+    m_time_report.begin("object");
+    if (!writeBinary(encoder, output_file)) {
+        return 1;
+    }
+    if (cache) {
+        m_time_report.begin("cache-store");
+        cache->store(cache_key, output_file);
+    }
+    return 0;
+}
+
+/**
+ * @brief Parses, folds, lowers and generates code for each function in turn, hands the code to `output`, and
+ *        releases the function's AST before parsing the next one.
+ *
+ * @details Diagnostics match the other pipelines, with one difference: code is generated for the functions
+ *          before a syntax error, so a code generation error in one of them is reported instead.
+ *
+ * @param source The preprocessed translation unit.
+ * @param arena Rewound to where it started after every function.
+ * @param output Receives each function's code; an exception it throws propagates.
+ * @returns `true` if every function was compiled.
+ */
+bool CompilerDriver::compileEachFunction(const SourceBuffer &source, Arena &arena,
+                                         const std::function<void(const assembly::Function &)> &output) {
+    Trace::Scope trace("stream");
+    Lexer lexer(source.text(), m_lexer_mode);
+    TokenStream tokens(lexer.stream());
+    Parser parser(tokens, arena);
+    Arena::Mark start = arena.mark();
+    Peephole::Hits hits{};
+    size_t functions = 0;
+    size_t nodes = 0;
+    size_t instructions = 0;
+    size_t peak_bytes = 0;
+    for (;;) {
+        Function *function = nullptr;
+        try {
+            try {
+                function = parser.next();
+            } catch (const ParseError &e) {
+                while (tokens.peek()) {
+                    tokens.advance();
+                }
+                reportDiagnostic(source, e.location, "Parsing error", e.what());
+                return false;
+            }
+        } catch (const LexError &e) {
+            reportDiagnostic(source, e.location, "Lexer error", e.what());
+            return false;
+        } catch (const std::exception &e) {
+            *m_err << "Lexer error: " << e.what() << std::endl;
+            return false;
+        }
+        if (!function) {
+            break;
+        }
+
+        std::unique_ptr<assembly::Function> code;
+        try {
+            if (m_fold) {
+                ConstantFolder::fold(*function, arena);
+            }
+            tacky::Function tacky = TackyGen::generate(*function);
+            Peephole::Hits function_hits{};
+            code = CodeGen::generate(tacky, m_codegen_options, &function_hits);
+            for (size_t rule = 0; rule < Peephole::kRuleCount; ++rule) {
+                hits[rule] += function_hits[rule];
+            }
+        } catch (const std::exception &e) {
+            *m_err << "Code generation error: " << e.what() << std::endl;
+            return false;
+        }
+        nodes += arena.objectCount() - start.objects;
+        peak_bytes = std::max(peak_bytes, arena.bytesUsed() - start.bytes_used);
+        arena.rewind(start);
+
+        ++functions;
+        instructions += code->instructions.size();
+        output(*code);
+    }
+
+    m_time_report.count("tokens", tokens.count());
+    m_time_report.count("functions", functions);
+    m_time_report.count("nodes", nodes);
+    m_time_report.count("instructions", instructions);
+    m_time_report.count("peak_arena_bytes", peak_bytes);
+    if (m_peephole_stats) {
+        printPeepholeStats(hits);
+    }
+    return true;
+}
+
+/**
+ * @brief Lexes, parses and generates code concurrently.
+ *
+ * @details A lexer thread feeds tokens through a bounded queue to the parser on this thread, so the token vector
+ *          is never materialised. Each function is folded as soon as it is parsed and handed to the thread pool,
+ *          which lowers it to TACKY and generates its code while parsing continues. Once parsing ends this
+ *          thread helps with any functions no worker has started, then waits for the rest.
+ *
+ *          Diagnostics match the sequential pipeline: if the parser fails, the rest of the input is still lexed,
+ *          and a lexer error takes precedence.
+ *
+ * @param source The preprocessed translation unit.
+ * @param arena Receives the AST; only this thread allocates in it.
+ * @param asmProgram Receives the generated program, with functions in source order.
+ * @returns `true` on success.
+ */
+bool CompilerDriver::runPipeline(const SourceBuffer &source, Arena &arena,
+                                 std::unique_ptr<assembly::Program> &asmProgram) {
+    Trace::Scope trace("pipeline");
+
+    // A function's state is shared with the pool task that may compile it. Whoever claims it first compiles
+    // it; a task that runs after this function has returned finds it claimed and only drops its references.
+    // A task therefore owns everything it touches: the slot and the options are shared, not borrowed.
+    struct Slot {
+        Function *ast;
+        std::atomic<bool> claimed{false};
+        std::atomic<bool> done{false};
+        std::unique_ptr<assembly::Function> code;
+        Peephole::Hits hits{};
+        size_t tacky_instructions = 0;
+        std::string error;
+    };
+    auto options = std::make_shared<const CodeGenOptions>(m_codegen_options);
+    auto compileSlot = [](Slot &slot, const CodeGenOptions &options) {
+        if (slot.claimed.exchange(true)) {
+            return;
+        }
+        try {
+            tacky::Function function = TackyGen::generate(*slot.ast);
+            slot.tacky_instructions = function.instructions.size();
+            slot.code = CodeGen::generate(function, options, &slot.hits);
+        } catch (const std::exception &e) {
+            slot.error = e.what();
+        }
+        slot.done.store(true);
+        slot.done.notify_all();
+    };
+
+    unsigned threads = m_thread_count ? m_thread_count : ThreadPool::defaultThreadCount();
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool *pool = m_pool;
+    if (!pool && threads > 1) {
+        own_pool = std::make_unique<ThreadPool>(threads - 1);
+        pool = own_pool.get();
+    }
+
+    SpscQueue<Token> queue(16 * 1024);
+    std::exception_ptr lex_error;
+    size_t token_count = 0;
+    std::thread lexer_thread([&] {
+        Trace::Scope trace("lex");
+        try {
+            Lexer lexer(source.text(), m_lexer_mode);
+            Token batch[256];
+            size_t count = 0;
+            for (Token token; lexer.next(token);) {
+                batch[count++] = token;
+                ++token_count;
+                if (count == std::size(batch)) {
+                    if (!queue.push(batch, count)) {
+                        break;
+                    }
+                    count = 0;
+                }
+            }
+            queue.push(batch, count);
+        } catch (...) {
+            lex_error = std::current_exception();
+        }
+        queue.close();
+    });
+
+    // Claims every function no task has started and waits for the rest, after which no task touches the AST
+    std::vector<std::shared_ptr<Slot>> slots;
+    auto settleSlots = [&slots] {
+        for (const auto &slot: slots) {
+            if (slot->claimed.exchange(true)) {
+                slot->done.wait(false);
+            }
+        }
+    };
+    size_t objects = arena.objectCount();
+    bool parsed = false;
+    try {
+        Trace::Scope trace("parse");
+        TokenStream tokens(queue);
+        Parser parser(tokens, arena);
+        parser.onFunction([&](Function *function) {
+            if (m_fold) {
+                ConstantFolder::fold(*function, arena);
+            }
+            auto slot = std::make_shared<Slot>();
+            slot->ast = function;
+            slots.push_back(slot);
+            if (pool) {
+                pool->submit([slot, options, compileSlot] { compileSlot(*slot, *options); });
+            } else {
+                compileSlot(*slot, *options);
+            }
+        });
+        parser.parse();
+        parsed = true;
     } catch (const ParseError &e) {
-        std::cerr << "Parsing error: " << e.what() << std::endl;
+        // Finish lexing first: as in the sequential pipeline, a lexer error anywhere is the one reported
+        Token discard[256];
+        while (queue.pop(discard, std::size(discard)) > 0) {
+        }
+        lexer_thread.join();
+        if (!lex_error) {
+            reportDiagnostic(source, e.location, "Parsing error", e.what());
+        }
+    } catch (...) {
+        queue.cancel();
+        lexer_thread.join();
+        settleSlots();
+        throw;
+    }
+    if (parsed) {
+        lexer_thread.join();
+    }
+    if (lex_error) {
+        try {
+            std::rethrow_exception(lex_error);
+        } catch (const LexError &e) {
+            reportDiagnostic(source, e.location, "Lexer error", e.what());
+        } catch (const std::exception &e) {
+            *m_err << "Lexer error: " << e.what() << std::endl;
+        }
+        parsed = false;
+    }
+
+    // Functions still in the pool's queues are compiled here (or, after an error, claimed so they never start);
+    // either way no task touches the AST once this returns
+    if (pool && parsed) {
+        pool->parallelFor(slots.size(), [&](size_t i) { compileSlot(*slots[i], *options); });
+    }
+    settleSlots();
+    if (!parsed) {
         return false;
     }
+
+    std::vector<std::unique_ptr<assembly::Function>> functions;
+    Peephole::Hits hits{};
+    size_t tacky_instructions = 0;
+    size_t instructions = 0;
+    for (const auto &slot: slots) {
+        if (!slot->error.empty()) {
+            *m_err << "Code generation error: " << slot->error << std::endl;
+            return false;
+        }
+        for (size_t rule = 0; rule < Peephole::kRuleCount; ++rule) {
+            hits[rule] += slot->hits[rule];
+        }
+        tacky_instructions += slot->tacky_instructions;
+        instructions += slot->code->instructions.size();
+        functions.push_back(std::move(slot->code));
+    }
+    asmProgram = std::make_unique<assembly::Program>(std::move(functions));
+    m_time_report.count("tokens", token_count);
+    m_time_report.count("nodes", arena.objectCount() - objects);
+    m_time_report.count("tacky_instructions", tacky_instructions);
+    m_time_report.count("instructions", instructions);
+
+    if (m_peephole_stats) {
+        printPeepholeStats(hits);
+    }
+    if (m_codegen_only) {
+        *m_out << "Code generation successful. Assembly AST created." << std::endl;
+        printPrettyAssemblyAST(asmProgram);
+    }
+    return true;
 }
 
 /**
- * @brief Runs the code generation stage on the given AST.
+ * @brief Lowers the AST to the TACKY three-address IR.
  *
- * @details The code generation stage reads the AST, generates an assembly AST, and stores it in the given pointer.
+ * @param ast The AST to lower.
+ * @param tackyProgram The program that receives the TACKY instructions.
+ * @returns `true` if lowering is successful, `false` otherwise.
+ */
+bool CompilerDriver::runTackyGen(const Program &ast, tacky::Program &tackyProgram) {
+    Trace::Scope trace("tacky");
+    try {
+        tackyProgram = TackyGen::generate(ast);
+        if (m_tacky_only) {
+            *m_out << "TACKY generation successful. IR created." << std::endl;
+            printPrettyTacky(tackyProgram);
+        }
+        return true;
+    } catch (const std::exception &e) {
+        *m_err << "TACKY generation error: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+/**
+ * @brief Runs the code generation stage on the given TACKY program.
+ *
+ * @details The code generation stage reads the TACKY IR, generates an assembly AST, and stores it in the given
+ *          pointer.
  *
- * @param ast The AST to generate code from.
+ * @param tackyProgram The TACKY program to generate code from.
  * @param asmProgram The pointer where the assembly AST will be stored.
  * @returns `true` if code generation is successful, `false` otherwise.
  */
-bool CompilerDriver::runCodeGen(const std::unique_ptr<Program> &ast, std::unique_ptr<assembly::Program> &asmProgram) {
+bool CompilerDriver::runCodeGen(const tacky::Program &tackyProgram, std::unique_ptr<assembly::Program> &asmProgram) {
+    Trace::Scope trace("codegen");
     try {
-        asmProgram = CodeGen::generate(*ast);
+        unsigned threads = m_thread_count ? m_thread_count : ThreadPool::defaultThreadCount();
+        threads = std::min<size_t>(threads, tackyProgram.functions.size());
+        std::unique_ptr<ThreadPool> pool;
+        CodeGenOptions options = m_codegen_options;
+        if (m_pool) {
+            // Batch mode: functions become tasks on the shared pool, where idle workers steal them
+            options.pool = m_pool;
+        } else if (threads > 1) {
+            // The calling thread takes part in the work, so the pool needs one thread fewer
+            pool = std::make_unique<ThreadPool>(threads - 1);
+            options.pool = pool.get();
+        }
+        Peephole::Hits hits;
+        asmProgram = CodeGen::generate(tackyProgram, options, &hits);
+        if (m_peephole_stats) {
+            printPeepholeStats(hits);
+        }
         if (m_codegen_only) {
-            std::cout << "Code generation successful. Assembly AST created." << std::endl;
+            *m_out << "Code generation successful. Assembly AST created." << std::endl;
             printPrettyAssemblyAST(asmProgram);
         }
         return true;
     } catch (const std::exception &e) {
-        std::cerr << "Code generation error: " << e.what() << std::endl;
+        *m_err << "Code generation error: " << e.what() << std::endl;
         return false;
     }
 }
@@ -244,29 +1381,119 @@ bool CompilerDriver::runCodeGen(const std::unique_ptr<Program> &ast, std::unique
  * @returns `true` if the code is emitted successfully, `false` otherwise.
  */
 bool CompilerDriver::emitCode(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file) {
-    std::ofstream outFile(output_file);
-    if (!outFile.is_open()) {
-        std::cerr << "Error: Unable to open output file " << output_file << std::endl;
+    Trace::Scope trace("emit");
+    int fd = ::open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        *m_err << "Error: Unable to open output file " << output_file << std::endl;
         return false;
     }
-    outFile << asmProgram->emit();
-    // std::cout << "Assembly code generated and written to " << output_file << std::endl;
-    return true;
+    try {
+        Sink out(fd);
+        asmProgram->emit(out);
+        out.flush();
+    } catch (const std::exception &e) {
+        *m_err << "Emission error: " << e.what() << std::endl;
+        ::close(fd);
+        return false;
+    }
+    return ::close(fd) == 0;
+}
+
+void CompilerDriver::printPrettyAST(const Program &ast) {
+    *m_out << "Pretty-printed AST:\n" << ast.prettyPrint() << std::endl;
 }
 
-void CompilerDriver::printPrettyAST(const std::unique_ptr<Program> &ast) {
-    std::cout << "Pretty-printed AST:\n" << ast->prettyPrint() << std::endl;
+void CompilerDriver::printPrettyTacky(const tacky::Program &tackyProgram) {
+    *m_out << "Pretty-printed TACKY:\n" << tackyProgram.prettyPrint() << std::endl;
 }
 
 void CompilerDriver::printPrettyAssemblyAST(const std::unique_ptr<assembly::Program> &asmProgram) {
-    std::cout << "Pretty-printed Assembly AST:\n" << asmProgram->prettyPrint() << std::endl;
+    *m_out << "Pretty-printed Assembly AST:\n" << asmProgram->prettyPrint() << std::endl;
+}
+
+void CompilerDriver::printPeepholeStats(const Peephole::Hits &hits) {
+    for (size_t i = 0; i < Peephole::kRuleCount; ++i) {
+        *m_err << "peephole: " << std::left << std::setw(14) << Peephole::ruleName(static_cast<Peephole::Rule>(i))
+                  << std::right << hits[i] << std::endl;
+    }
+}
+
+/**
+ * @brief Prints a diagnostic with its line, column and the offending source line.
+ *
+ * @details This is the only place line numbers are computed; the buffer's line table is built on first use.
+ *          The preprocessor's line marks turn a line of its output into the file and line it came from, so
+ *          errors after an #include, or inside a header, name the right place.
+ *
+ * @param source The buffer the location refers to.
+ * @param location The location of the problem.
+ * @param kind The diagnostic prefix, e.g. "Parsing error".
+ * @param message The diagnostic text.
+ */
+void CompilerDriver::reportDiagnostic(const SourceBuffer &source, SourceLocation location, const std::string &kind,
+                                      const std::string &message) {
+    LineColumn position = source.lineColumn(location);
+    // Name the file and line the preprocessed line came from; the text shown is still the expanded line
+    std::string_view file = m_input_file;
+    uint32_t line_number = position.line;
+    auto mark = std::upper_bound(m_line_marks.begin(), m_line_marks.end(), position.line,
+                                 [](uint32_t at, const LineMark &mark) { return at < mark.output_line; });
+    if (mark != m_line_marks.begin()) {
+        --mark;
+        file = mark->file;
+        line_number = mark->line + (position.line - mark->output_line);
+    }
+    *m_err << file << ":" << line_number << ":" << position.column << ": " << kind << ": " << message << std::endl;
+    std::string_view line = source.lineText(position.line);
+    if (!line.empty()) {
+        *m_err << "    " << line << "\n"
+                  << "    " << std::string(position.column - 1, ' ') << "^" << std::endl;
+    }
 }
 
 void CompilerDriver::printUsage() {
-    std::cout << "Usage: your_compiler [options] input_file [output_file]" << std::endl;
-    std::cout << "Options:" << std::endl;
-    std::cout << "  --lex      Run only the lexer" << std::endl;
-    std::cout << "  --parse    Run the lexer and parser" << std::endl;
-    std::cout << "  --codegen  Run the lexer, parser, and code generation" << std::endl;
-    std::cout << "  -S         Emit assembly code only" << std::endl;
+    *m_out << "Usage: your_compiler [options] input_file [output_file]" << std::endl;
+    *m_out << "       your_compiler [options] -j <n> input_file..." << std::endl;
+    *m_out << "Options:" << std::endl;
+    *m_out << "  --lex      Run only the lexer" << std::endl;
+    *m_out << "  --parse    Run the lexer and parser" << std::endl;
+    *m_out << "  --tacky    Run the lexer, parser, and TACKY generation" << std::endl;
+    *m_out << "  --codegen  Run the lexer, parser, TACKY generation, and code generation" << std::endl;
+    *m_out << "  -S         Emit assembly code only" << std::endl;
+    *m_out << "  -c         Compile to an object file without linking" << std::endl;
+    *m_out << "  --external-assembler  Assemble emitted text with gcc instead of the built-in encoder"
+              << std::endl;
+    *m_out << "  --run      Compile to memory, run main in-process and exit with its result" << std::endl;
+    *m_out << "  --no-fold  Do not fold constant expressions" << std::endl;
+    *m_out << "  --no-regalloc  Keep every temporary in a stack slot instead of allocating registers" << std::endl;
+    *m_out << "  --no-peephole  Skip the peephole pass over the generated assembly" << std::endl;
+    *m_out << "  --peephole=<rules>  Only run the listed peephole rules (redundant-mov, memory-bounce, dead-mov,"
+                 " zero-idiom, branch-fusion)" << std::endl;
+    *m_out << "  --peephole-stats  Print how often each peephole rule fired" << std::endl;
+    *m_out << "  --threads=<n>  Generate code for up to n functions at once (default: one per core)" << std::endl;
+    *m_out << "  -j <n>     Batch mode: compile every input file, up to n at once, each to its default output"
+              << std::endl;
+    *m_out << "  @<file>    Read further arguments from <file>; implies batch mode" << std::endl;
+    *m_out << "  --server <socket>  Run as a compile server listening on a Unix socket" << std::endl;
+    *m_out << "  --connect <socket>  Send this compile to a server; compile locally if none is listening"
+           << std::endl;
+    *m_out << "  --cache-dir=<dir>  Reuse outputs of identical earlier compiles stored in <dir>" << std::endl;
+    *m_out << "  --cache-size=<mb>  Evict least recently used cache entries beyond this size (default: 1024)"
+           << std::endl;
+    *m_out << "  --cache-stats  Print the cache's hit and miss counts" << std::endl;
+    *m_out << "  --time-report  Print wall and CPU time, heap allocations and sizes for each compiler phase"
+           << std::endl;
+    *m_out << "  --time-report-json=<file>  Write the same report for every input file as JSON" << std::endl;
+    *m_out << "  --trace=<file>  Record driver stages, per-function code generation and passes as a Chrome trace"
+           << std::endl;
+    *m_out << "  --pipeline  Lex, parse and generate code concurrently; functions are compiled as they are parsed"
+           << std::endl;
+    *m_out << "  --streaming  Compile and write out one function at a time, releasing it before reading the next"
+           << std::endl;
+    *m_out << "  --parallel-lex  Lex large files on several threads (see --threads) before parsing" << std::endl;
+    *m_out << "  --regex-lexer  Use the std::regex token recogniser instead of the DFA scanner" << std::endl;
+    *m_out << "  -I<dir>    Add a directory to the #include search path" << std::endl;
+    *m_out << "  -D<name>[=<value>]  Define a macro" << std::endl;
+    *m_out << "  -U<name>   Undefine a macro" << std::endl;
+    *m_out << "  --gcc-preprocess  Preprocess with gcc -E instead of the built-in preprocessor" << std::endl;
 }
\ No newline at end of file
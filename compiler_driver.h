@@ -1,12 +1,41 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <memory>
+#include <ostream>
+#include <vector>
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
 #include "assembly_ast.h"
+#include "constant_folder.h"
+#include "tacky.h"
+#include "tacky_gen.h"
 #include "codegen.h"
+#include "peephole.h"
+#include "source_buffer.h"
+#include "preprocessor.h"
+#include "elf_writer.h"
+#include "jit.h"
+#include "thread_pool.h"
+#include "compile_server.h"
+#include "compile_cache.h"
+#include "time_report.h"
+#include "allocation_counter.h"
+#include "trace.h"
+
+/**
+ * State that outlives a single compile. A compile server fills this in so requests share it; a normal
+ * invocation leaves it empty.
+ */
+struct CompileContext {
+    ThreadPool *pool = nullptr;               // Per-function code generation (and batch jobs) run here
+    Arena *arena = nullptr;                   // Cleared and reused instead of allocating a fresh arena
+    IncludeCache *include_cache = nullptr;    // Mapped source files, revalidated on every use
+    bool serving = false;                     // Set inside a server, which refuses options that make no sense there
+    std::function<void()> enter_context;      // Prepares another thread to run whole compiles (working directory)
+};
 
 class CompilerDriver {
 public:
@@ -14,29 +43,111 @@ public:
 
     int run(int argc, char *argv[]);
 
+    int run(const std::vector<std::string> &raw_args, std::ostream &out, std::ostream &err,
+            const CompileContext &context = {});
+
 private:
-    bool preprocess(const std::string &input_file, const std::string &output_file);
+    bool expandArguments(const std::vector<std::string> &raw_args, std::vector<std::string> &args);
+
+    int compile();
+
+    int runStages();
+
+    int finishCompile(const std::unique_ptr<assembly::Program> &asmProgram, CompileCache *cache,
+                      const std::string &cache_key, const std::string &output_file);
+
+    bool runPipeline(const SourceBuffer &source, Arena &arena, std::unique_ptr<assembly::Program> &asmProgram);
+
+    int runStreaming(const SourceBuffer &source, Arena &arena, CompileCache *cache, const std::string &cache_key,
+                     const std::string &output_file);
+
+    bool compileEachFunction(const SourceBuffer &source, Arena &arena,
+                             const std::function<void(const assembly::Function &)> &output);
+
+    int runBatch(const std::vector<std::string> &inputs);
+
+    std::string defaultOutputFile(const std::string &input_file) const;
+
+    bool preprocess(const std::string &input_file, SourceBuffer &source);
+
+    bool preprocessWithGcc(const std::string &input_file, SourceBuffer &source);
 
-    bool runLexer(const std::string &input_file, std::vector<Token> &tokens);
+    bool runLexer(const SourceBuffer &source, std::vector<Token> &tokens);
 
-    bool runParser(const std::vector<Token> &tokens, std::unique_ptr<Program> &ast);
+    bool runParser(const SourceBuffer &source, const std::vector<Token> *tokens, Arena &arena, Program *&ast,
+                   size_t &token_count);
 
-    bool runCodeGen(const std::unique_ptr<Program> &ast, std::unique_ptr<assembly::Program> &asmProgram);
+    bool runTackyGen(const Program &ast, tacky::Program &tackyProgram);
+
+    bool runCodeGen(const tacky::Program &tackyProgram, std::unique_ptr<assembly::Program> &asmProgram);
+
+    bool writeOutput(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file);
 
     bool emitCode(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file);
 
-    bool assemble(const std::string &input_file, const std::string &output_file);
+    bool assemble(const std::unique_ptr<assembly::Program> &asmProgram, const std::string &output_file);
+
+    bool writeBinary(const x86::Encoder &encoder, const std::string &output_file);
+
+    bool writeObject(const x86::Encoder &encoder, const std::string &object_file);
+
+    bool link(const std::string &object_file, const std::string &output_file);
+
+    bool runJit(const std::unique_ptr<assembly::Program> &asmProgram, int &exit_code);
 
-    void printPrettyAST(const std::unique_ptr<Program> &ast);
+    bool runJit(const x86::Encoder &encoder, int &exit_code);
+
+    void printPrettyAST(const Program &ast);
+
+    void printPrettyTacky(const tacky::Program &tackyProgram);
 
     void printPrettyAssemblyAST(const std::unique_ptr<assembly::Program> &asmProgram);
 
+    void printPeepholeStats(const Peephole::Hits &hits);
+
+    std::string cacheFlags() const;
+
+    void printCacheStats();
+
+    void reportDiagnostic(const SourceBuffer &source, SourceLocation location, const std::string &kind,
+                          const std::string &message);
+
     void printUsage();
 
     std::string m_input_file;
+    std::vector<LineMark> m_line_marks;  // The current file's, for diagnostics; empty after gcc -E
     std::string m_output_file;
     bool m_lex_only;
     bool m_parse_only;
+    bool m_tacky_only;
     bool m_codegen_only;
     bool m_emit_assembly;
+    bool m_compile_only;
+    bool m_external_assembler;
+    bool m_run;
+    bool m_fold;
+    CodeGenOptions m_codegen_options;
+    bool m_peephole_stats;
+    unsigned m_thread_count;  // 0 means one per hardware thread
+    unsigned m_jobs;          // Files compiled at once in batch mode; 0 means one per hardware thread
+    bool m_batch;
+    Lexer::Mode m_lexer_mode;
+    bool m_gcc_preprocess;
+    PreprocessorOptions m_preprocessor_options;
+    std::string m_cache_dir;  // Empty when caching is off
+    uint64_t m_cache_max_bytes;
+    bool m_cache_stats;
+    bool m_time_report_enabled;
+    bool m_time_report_text;
+    std::string m_time_report_json;    // Empty unless --time-report-json was given
+    TimeReport m_time_report;          // The current file's phases
+    std::vector<TimeReport> m_time_reports;  // Every file's, in input order, for the JSON report
+    std::string m_trace_file;          // Empty unless --trace was given
+    bool m_pipeline;
+    bool m_streaming;
+    bool m_parallel_lex;
+    std::ostream *m_out;  // Stage output and diagnostics; per-file buffers in batch mode
+    std::ostream *m_err;
+    ThreadPool *m_pool;   // Shared pool for per-function code generation in batch mode
+    CompileContext m_context;
 };
\ No newline at end of file
@@ -0,0 +1,283 @@
+#include "constant_folder.h"
+#include <climits>
+#include <stdexcept>
+#include "trace.h"
+
+namespace {
+
+    const Constant *asConstant(const Exp *exp) {
+        return exp->kind == ASTNode::Kind::Constant ? static_cast<const Constant *>(exp) : nullptr;
+    }
+
+    bool isConstant(const Exp *exp, int32_t value) {
+        const Constant *constant = asConstant(exp);
+        return constant && constant->value == value;
+    }
+
+} // namespace
+
+/**
+ * @brief Folds every expression in the program.
+ *
+ * @param program The AST to rewrite in place.
+ * @param arena The arena that owns the AST; replacement nodes are allocated in it.
+ */
+void ConstantFolder::fold(Program &program, Arena &arena) {
+    for (Function *function: program.functions) {
+        fold(*function, arena);
+    }
+}
+
+/**
+ * @brief Folds every expression in one function, for callers that receive functions as they are parsed.
+ */
+void ConstantFolder::fold(Function &function, Arena &arena) {
+    Trace::Scope trace("fold function", function.name);
+    ConstantFolder folder(arena);
+    folder.foldStatement(*function.body);
+}
+
+void ConstantFolder::foldStatement(Statement &statement) {
+    switch (statement.kind) {
+        case ASTNode::Kind::Return: {
+            auto &returnStmt = static_cast<Return &>(statement);
+            returnStmt.exp = foldExpression(returnStmt.exp);
+            return;
+        }
+        default:
+            throw std::runtime_error("Unsupported statement type");
+    }
+}
+
+/**
+ * @brief Folds an expression bottom-up.
+ *
+ * @param exp The expression to fold.
+ * @return The folded expression, which may be `exp` itself, one of its operands, or a new node.
+ */
+Exp *ConstantFolder::foldExpression(Exp *exp) {
+    switch (exp->kind) {
+        case ASTNode::Kind::Constant:
+            return exp;
+        case ASTNode::Kind::Unary:
+            return foldUnary(static_cast<Unary &>(*exp));
+        case ASTNode::Kind::Binary:
+            return foldBinary(static_cast<Binary &>(*exp));
+        default:
+            throw std::runtime_error("Unsupported expression type");
+    }
+}
+
+Exp *ConstantFolder::foldUnary(Unary &unary) {
+    unary.operand = foldExpression(unary.operand);
+    const Constant *operand = asConstant(unary.operand);
+    if (!operand) {
+        return &unary;
+    }
+    switch (unary.op) {
+        case UnaryOperator::Negate:
+            if (operand->value == INT_MIN) {
+                return &unary;  // Overflows
+            }
+            return makeConstant(-operand->value, unary.location);
+        case UnaryOperator::Complement:
+            return makeConstant(~operand->value, unary.location);
+        case UnaryOperator::Not:
+            return makeConstant(operand->value == 0, unary.location);
+    }
+    return &unary;
+}
+
+Exp *ConstantFolder::foldBinary(Binary &binary) {
+    if (binary.op == BinaryOperator::And || binary.op == BinaryOperator::Or) {
+        return foldLogical(binary);
+    }
+    binary.left = foldExpression(binary.left);
+    binary.right = foldExpression(binary.right);
+    const Constant *left = asConstant(binary.left);
+    const Constant *right = asConstant(binary.right);
+    int32_t result;
+    if (left && right && evaluate(binary.op, left->value, right->value, result)) {
+        return makeConstant(result, binary.location);
+    }
+    return simplify(binary);
+}
+
+/**
+ * @brief Folds `&&` and `||`, preserving short-circuit evaluation.
+ *
+ * @details A constant left operand decides whether the right one runs at all. A constant right operand can
+ *          only be dropped together with the left operand if evaluating the left operand has no effect.
+ */
+Exp *ConstantFolder::foldLogical(Binary &binary) {
+    bool is_and = binary.op == BinaryOperator::And;
+    binary.left = foldExpression(binary.left);
+    binary.right = foldExpression(binary.right);
+    if (const Constant *left = asConstant(binary.left)) {
+        if ((left->value != 0) != is_and) {
+            return makeConstant(is_and ? 0 : 1, binary.location);  // 0 && x, 1 || x
+        }
+        return makeBoolean(binary.right, binary.location);         // 1 && x, 0 || x
+    }
+    if (const Constant *right = asConstant(binary.right)) {
+        if ((right->value != 0) == is_and) {
+            return makeBoolean(binary.left, binary.location);      // x && 1, x || 0
+        }
+        if (isPure(*binary.left)) {
+            return makeConstant(is_and ? 0 : 1, binary.location);  // x && 0, x || 1
+        }
+    }
+    return &binary;
+}
+
+/**
+ * @brief Applies algebraic identities to a binary expression with at most one constant operand.
+ *
+ * @details Operands are only discarded when evaluating them has no effect, so a division that might trap is
+ *          never optimized away.
+ */
+Exp *ConstantFolder::simplify(Binary &binary) {
+    Exp *left = binary.left;
+    Exp *right = binary.right;
+    switch (binary.op) {
+        case BinaryOperator::Add:
+            if (isConstant(right, 0)) return left;                                       // x + 0
+            if (isConstant(left, 0)) return right;                                       // 0 + x
+            break;
+        case BinaryOperator::Subtract:
+            if (isConstant(right, 0)) return left;                                       // x - 0
+            if (isPure(*left) && sameExpression(*left, *right)) {
+                return makeConstant(0, binary.location);                                 // x - x
+            }
+            break;
+        case BinaryOperator::Multiply:
+            if (isConstant(right, 1)) return left;                                       // x * 1
+            if (isConstant(left, 1)) return right;                                       // 1 * x
+            if ((isConstant(right, 0) && isPure(*left)) || (isConstant(left, 0) && isPure(*right))) {
+                return makeConstant(0, binary.location);                                 // x * 0
+            }
+            break;
+        case BinaryOperator::Divide:
+            if (isConstant(right, 1)) return left;                                       // x / 1
+            break;
+        case BinaryOperator::Remainder:
+            if (isConstant(right, 1) && isPure(*left)) return makeConstant(0, binary.location);  // x % 1
+            break;
+        default:
+            break;
+    }
+    return &binary;
+}
+
+Exp *ConstantFolder::makeConstant(int32_t value, SourceLocation location) {
+    return m_arena.make<Constant>(value, location);
+}
+
+/**
+ * @brief Normalizes an expression to 0 or 1, as the result of `&&`/`||` must be.
+ */
+Exp *ConstantFolder::makeBoolean(Exp *exp, SourceLocation location) {
+    if (const Constant *constant = asConstant(exp)) {
+        return makeConstant(constant->value != 0, location);
+    }
+    return m_arena.make<Binary>(BinaryOperator::NotEqual, exp, makeConstant(0, location), location);
+}
+
+/**
+ * @brief Evaluates a binary operator on two constants with 32-bit `int` semantics.
+ *
+ * @param result Receives the value.
+ * @return `false` if the operation is undefined in C (signed overflow, division by zero, INT_MIN / -1) and must
+ *         not be folded.
+ */
+bool ConstantFolder::evaluate(BinaryOperator op, int32_t lhs, int32_t rhs, int32_t &result) {
+    int64_t wide;
+    switch (op) {
+        case BinaryOperator::Add:
+            wide = int64_t{lhs} + rhs;
+            break;
+        case BinaryOperator::Subtract:
+            wide = int64_t{lhs} - rhs;
+            break;
+        case BinaryOperator::Multiply:
+            wide = int64_t{lhs} * rhs;
+            break;
+        case BinaryOperator::Divide:
+        case BinaryOperator::Remainder:
+            if (rhs == 0 || (lhs == INT_MIN && rhs == -1)) {
+                return false;
+            }
+            wide = op == BinaryOperator::Divide ? lhs / rhs : lhs % rhs;
+            break;
+        case BinaryOperator::Equal:
+            wide = lhs == rhs;
+            break;
+        case BinaryOperator::NotEqual:
+            wide = lhs != rhs;
+            break;
+        case BinaryOperator::LessThan:
+            wide = lhs < rhs;
+            break;
+        case BinaryOperator::LessOrEqual:
+            wide = lhs <= rhs;
+            break;
+        case BinaryOperator::GreaterThan:
+            wide = lhs > rhs;
+            break;
+        case BinaryOperator::GreaterOrEqual:
+            wide = lhs >= rhs;
+            break;
+        default:
+            return false;
+    }
+    if (wide < INT32_MIN || wide > INT32_MAX) {
+        return false;
+    }
+    result = static_cast<int32_t>(wide);
+    return true;
+}
+
+/**
+ * @brief Returns whether evaluating an expression can be skipped without changing behaviour.
+ *
+ * @details Division and remainder count as impure since they may trap.
+ */
+bool ConstantFolder::isPure(const Exp &exp) {
+    switch (exp.kind) {
+        case ASTNode::Kind::Constant:
+            return true;
+        case ASTNode::Kind::Unary:
+            return isPure(*static_cast<const Unary &>(exp).operand);
+        case ASTNode::Kind::Binary: {
+            const auto &binary = static_cast<const Binary &>(exp);
+            if (binary.op == BinaryOperator::Divide || binary.op == BinaryOperator::Remainder) {
+                return false;
+            }
+            return isPure(*binary.left) && isPure(*binary.right);
+        }
+        default:
+            return false;
+    }
+}
+
+bool ConstantFolder::sameExpression(const Exp &a, const Exp &b) {
+    if (a.kind != b.kind) {
+        return false;
+    }
+    switch (a.kind) {
+        case ASTNode::Kind::Constant:
+            return static_cast<const Constant &>(a).value == static_cast<const Constant &>(b).value;
+        case ASTNode::Kind::Unary: {
+            const auto &ua = static_cast<const Unary &>(a);
+            const auto &ub = static_cast<const Unary &>(b);
+            return ua.op == ub.op && sameExpression(*ua.operand, *ub.operand);
+        }
+        case ASTNode::Kind::Binary: {
+            const auto &ba = static_cast<const Binary &>(a);
+            const auto &bb = static_cast<const Binary &>(b);
+            return ba.op == bb.op && sameExpression(*ba.left, *bb.left) && sameExpression(*ba.right, *bb.right);
+        }
+        default:
+            return false;
+    }
+}
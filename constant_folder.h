@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include "ast.h"
+
+/**
+ * Folds constant subexpressions of the AST in place and applies simple algebraic identities. Replacement nodes
+ * are allocated in the arena that owns the tree. Anything whose value C leaves undefined, or that would trap at
+ * run time (signed overflow, division by zero, INT_MIN / -1), is left for the generated code to evaluate.
+ */
+class ConstantFolder {
+public:
+    static void fold(Program &program, Arena &arena);
+
+    static void fold(Function &function, Arena &arena);
+
+private:
+    explicit ConstantFolder(Arena &arena) : m_arena(arena) {}
+
+    void foldStatement(Statement &statement);
+
+    Exp *foldExpression(Exp *exp);
+
+    Exp *foldUnary(Unary &unary);
+
+    Exp *foldBinary(Binary &binary);
+
+    Exp *foldLogical(Binary &binary);
+
+    Exp *simplify(Binary &binary);
+
+    Exp *makeConstant(int32_t value, SourceLocation location);
+
+    Exp *makeBoolean(Exp *exp, SourceLocation location);
+
+    static bool evaluate(BinaryOperator op, int32_t lhs, int32_t rhs, int32_t &result);
+
+    static bool isPure(const Exp &exp);
+
+    static bool sameExpression(const Exp &a, const Exp &b);
+
+    Arena &m_arena;
+};
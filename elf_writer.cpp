@@ -0,0 +1,126 @@
+#include "elf_writer.h"
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <vector>
+
+namespace {
+
+    void align(std::vector<uint8_t> &image, size_t alignment) {
+        while (image.size() % alignment != 0) {
+            image.push_back(0);
+        }
+    }
+
+    template<typename T>
+    void append(std::vector<uint8_t> &image, const T &value) {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+        image.insert(image.end(), bytes, bytes + sizeof(T));
+    }
+
+    uint32_t addString(std::string &table, const std::string &value) {
+        auto offset = static_cast<uint32_t>(table.size());
+        table += value;
+        table += '\0';
+        return offset;
+    }
+
+} // namespace
+
+/**
+ * @brief Writes the encoder's code and symbols to an object file.
+ *
+ * @details Section layout: null, `.text`, `.note.GNU-stack`, `.symtab`, `.strtab`, `.shstrtab`. Function symbols
+ *          are global; the symbol table starts with the mandatory null symbol and a local section symbol.
+ *
+ * @param encoder The encoded program.
+ * @param path The path of the object file to write.
+ * @returns `true` if the file was written successfully, `false` otherwise.
+ */
+bool ElfObjectWriter::write(const x86::Encoder &encoder, const std::string &path) {
+    enum : uint16_t {
+        NullSection, TextSection, NoteSection, SymtabSection, StrtabSection, ShstrtabSection, SectionCount
+    };
+
+    std::string shstrtab(1, '\0');
+    uint32_t text_name = addString(shstrtab, ".text");
+    uint32_t note_name = addString(shstrtab, ".note.GNU-stack");
+    uint32_t symtab_name = addString(shstrtab, ".symtab");
+    uint32_t strtab_name = addString(shstrtab, ".strtab");
+    uint32_t shstrtab_name = addString(shstrtab, ".shstrtab");
+
+    std::string strtab(1, '\0');
+    std::vector<Elf64_Sym> symbols(2);
+    std::memset(symbols.data(), 0, sizeof(Elf64_Sym) * symbols.size());
+    symbols[1].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+    symbols[1].st_shndx = TextSection;
+    for (bool global: {false, true}) {
+        for (const auto &symbol: encoder.symbols()) {
+            if (symbol.global != global) continue;
+            Elf64_Sym entry{};
+            entry.st_name = addString(strtab, symbol.name);
+            entry.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, STT_FUNC);
+            entry.st_shndx = TextSection;
+            entry.st_value = symbol.offset;
+            entry.st_size = symbol.size;
+            symbols.push_back(entry);
+        }
+    }
+    uint32_t first_global = 2;
+    for (const auto &symbol: encoder.symbols()) {
+        if (!symbol.global) ++first_global;
+    }
+
+    std::vector<uint8_t> image(sizeof(Elf64_Ehdr), 0);
+    std::vector<Elf64_Shdr> sections(SectionCount);
+    std::memset(sections.data(), 0, sizeof(Elf64_Shdr) * sections.size());
+
+    align(image, 16);
+    sections[TextSection] = {text_name, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0, image.size(),
+                             encoder.code().size(), 0, 0, 16, 0};
+    image.insert(image.end(), encoder.code().begin(), encoder.code().end());
+
+    sections[NoteSection] = {note_name, SHT_PROGBITS, 0, 0, image.size(), 0, 0, 0, 1, 0};
+
+    align(image, 8);
+    sections[SymtabSection] = {symtab_name, SHT_SYMTAB, 0, 0, image.size(), symbols.size() * sizeof(Elf64_Sym),
+                               StrtabSection, first_global, 8, sizeof(Elf64_Sym)};
+    for (const auto &symbol: symbols) {
+        append(image, symbol);
+    }
+
+    sections[StrtabSection] = {strtab_name, SHT_STRTAB, 0, 0, image.size(), strtab.size(), 0, 0, 1, 0};
+    image.insert(image.end(), strtab.begin(), strtab.end());
+
+    sections[ShstrtabSection] = {shstrtab_name, SHT_STRTAB, 0, 0, image.size(), shstrtab.size(), 0, 0, 1, 0};
+    image.insert(image.end(), shstrtab.begin(), shstrtab.end());
+
+    align(image, 8);
+    uint64_t section_headers = image.size();
+    for (const auto &section: sections) {
+        append(image, section);
+    }
+
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = section_headers;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = SectionCount;
+    header.e_shstrndx = ShstrtabSection;
+    std::memcpy(image.data(), &header, sizeof(header));
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size()));
+    return out.good();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include "x86_encoder.h"
+
+/**
+ * Writes encoded machine code as an ELF64 relocatable object (`.o`) for x86-64 Linux, with the same sections
+ * the emitted assembly produces: `.text` and an empty `.note.GNU-stack` marking the stack non-executable.
+ */
+class ElfObjectWriter {
+public:
+    static bool write(const x86::Encoder &encoder, const std::string &path);
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+/**
+ * A lazily evaluated sequence produced by a coroutine that `co_yield`s values of type T. The body runs only
+ * when the consumer asks for the next value, and an exception it throws is rethrown from `next`.
+ */
+template<typename T>
+class Generator {
+public:
+    struct promise_type {
+        const T *value = nullptr;
+        std::exception_ptr error;
+
+        Generator get_return_object() { return Generator(Handle::from_promise(*this)); }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        // The yielded object outlives the suspension, so pointing at it is enough
+        std::suspend_always yield_value(const T &yielded) noexcept {
+            value = &yielded;
+            return {};
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    Generator(Generator &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+
+    Generator &operator=(Generator &&other) noexcept {
+        std::swap(m_handle, other.m_handle);
+        return *this;
+    }
+
+    ~Generator() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    /** Runs the body up to its next `co_yield` and returns the value, or nullptr once the body has finished. */
+    const T *next() {
+        if (!m_handle || m_handle.done()) {
+            return nullptr;
+        }
+        m_handle.resume();
+        if (m_handle.done()) {
+            if (auto error = std::exchange(m_handle.promise().error, {})) {
+                std::rethrow_exception(error);
+            }
+            return nullptr;
+        }
+        return m_handle.promise().value;
+    }
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Generator(Handle handle) : m_handle(handle) {}
+
+    Handle m_handle;
+};
@@ -0,0 +1,43 @@
+#include "jit.h"
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @brief Maps the encoded program into executable memory and calls one of its functions.
+ *
+ * @param encoder The encoded program.
+ * @param entry The name of the function to call; it must take no arguments and return int.
+ * @return The function's return value.
+ * @throws std::runtime_error if the entry point does not exist or the mapping cannot be set up.
+ */
+int Jit::run(const x86::Encoder &encoder, const std::string &entry) {
+    const x86::Symbol *symbol = nullptr;
+    for (const auto &candidate: encoder.symbols()) {
+        if (candidate.name == entry) {
+            symbol = &candidate;
+            break;
+        }
+    }
+    if (!symbol) {
+        throw std::runtime_error("Entry point " + entry + " is not defined");
+    }
+
+    const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (encoder.code().size() + page_size - 1) / page_size * page_size;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("Unable to map memory for JIT code");
+    }
+    std::memcpy(memory, encoder.code().data(), encoder.code().size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        throw std::runtime_error("Unable to make JIT code executable");
+    }
+
+    auto function = reinterpret_cast<int (*)()>(static_cast<uint8_t *>(memory) + symbol->offset);
+    int result = function();
+    munmap(memory, size);
+    return result;
+}
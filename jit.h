@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include "x86_encoder.h"
+
+/**
+ * Runs encoded machine code in-process. The code is copied into an anonymous mapping that is writable while it
+ * is filled and then switched to read+execute before anything is called (W^X).
+ */
+class Jit {
+public:
+    static int run(const x86::Encoder &encoder, const std::string &entry);
+};
@@ -1,12 +1,246 @@
 #include "lexer.h"
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include <exception>
 #include <stdexcept>
+#include "text_scanner.h"
+#include "thread_pool.h"
 
-Lexer::Lexer(const std::string &input) : m_input(input), m_position(0) {}
+namespace {
+
+    enum CharClass : uint8_t {
+        CC_OTHER,
+        CC_LETTER,
+        CC_DIGIT,
+        CC_OPEN_PAREN,
+        CC_CLOSE_PAREN,
+        CC_OPEN_BRACE,
+        CC_CLOSE_BRACE,
+        CC_SEMICOLON,
+        CC_TILDE,
+        CC_MINUS,
+        CC_PLUS,
+        CC_STAR,
+        CC_SLASH,
+        CC_PERCENT,
+        CC_BANG,
+        CC_AMPERSAND,
+        CC_PIPE,
+        CC_EQUAL,
+        CC_LESS,
+        CC_GREATER,
+        CC_COUNT
+    };
+
+    enum State : uint8_t {
+        S_START,
+        S_IDENTIFIER,
+        S_CONSTANT,
+        S_OPEN_PAREN,
+        S_CLOSE_PAREN,
+        S_OPEN_BRACE,
+        S_CLOSE_BRACE,
+        S_SEMICOLON,
+        S_TILDE,
+        S_MINUS,
+        S_DECREMENT,
+        S_PLUS,
+        S_STAR,
+        S_SLASH,
+        S_PERCENT,
+        S_BANG,
+        S_NOT_EQUAL,
+        S_AMPERSAND,      // a lone `&` is not a token yet
+        S_LOGICAL_AND,
+        S_PIPE,           // nor is a lone `|`
+        S_LOGICAL_OR,
+        S_EQUAL,          // nor a lone `=`
+        S_EQUAL_EQUAL,
+        S_LESS,
+        S_LESS_EQUAL,
+        S_GREATER,
+        S_GREATER_EQUAL,
+        S_BAD_CONSTANT,   // digits run into a word character, e.g. `123abc`
+        S_COUNT,
+        S_STOP = 0xFF
+    };
+
+    struct DfaTables {
+        std::array<uint8_t, 256> charClass{};
+        std::array<std::array<uint8_t, CC_COUNT>, S_COUNT> next{};
+        std::array<bool, S_COUNT> accepting{};
+        std::array<TokenType, S_COUNT> tokenType{};
+    };
+
+    /**
+     * @brief Builds the scanner tables at compile time.
+     *
+     * @details Every state stops on any class it has no transition for; the scanner then accepts the last
+     * accepting state it passed through (maximal munch).
+     */
+    constexpr DfaTables buildDfaTables() {
+        DfaTables t;
+        for (int c = 'a'; c <= 'z'; ++c) t.charClass[c] = CC_LETTER;
+        for (int c = 'A'; c <= 'Z'; ++c) t.charClass[c] = CC_LETTER;
+        t.charClass['_'] = CC_LETTER;
+        for (int c = '0'; c <= '9'; ++c) t.charClass[c] = CC_DIGIT;
+        t.charClass['('] = CC_OPEN_PAREN;
+        t.charClass[')'] = CC_CLOSE_PAREN;
+        t.charClass['{'] = CC_OPEN_BRACE;
+        t.charClass['}'] = CC_CLOSE_BRACE;
+        t.charClass[';'] = CC_SEMICOLON;
+        t.charClass['~'] = CC_TILDE;
+        t.charClass['-'] = CC_MINUS;
+        t.charClass['+'] = CC_PLUS;
+        t.charClass['*'] = CC_STAR;
+        t.charClass['/'] = CC_SLASH;
+        t.charClass['%'] = CC_PERCENT;
+        t.charClass['!'] = CC_BANG;
+        t.charClass['&'] = CC_AMPERSAND;
+        t.charClass['|'] = CC_PIPE;
+        t.charClass['='] = CC_EQUAL;
+        t.charClass['<'] = CC_LESS;
+        t.charClass['>'] = CC_GREATER;
+
+        for (auto &row: t.next) row.fill(S_STOP);
+
+        t.next[S_START][CC_LETTER] = S_IDENTIFIER;
+        t.next[S_START][CC_DIGIT] = S_CONSTANT;
+        t.next[S_START][CC_OPEN_PAREN] = S_OPEN_PAREN;
+        t.next[S_START][CC_CLOSE_PAREN] = S_CLOSE_PAREN;
+        t.next[S_START][CC_OPEN_BRACE] = S_OPEN_BRACE;
+        t.next[S_START][CC_CLOSE_BRACE] = S_CLOSE_BRACE;
+        t.next[S_START][CC_SEMICOLON] = S_SEMICOLON;
+        t.next[S_START][CC_TILDE] = S_TILDE;
+        t.next[S_START][CC_MINUS] = S_MINUS;
+        t.next[S_START][CC_PLUS] = S_PLUS;
+        t.next[S_START][CC_STAR] = S_STAR;
+        t.next[S_START][CC_SLASH] = S_SLASH;
+        t.next[S_START][CC_PERCENT] = S_PERCENT;
+        t.next[S_START][CC_BANG] = S_BANG;
+        t.next[S_START][CC_AMPERSAND] = S_AMPERSAND;
+        t.next[S_START][CC_PIPE] = S_PIPE;
+        t.next[S_START][CC_EQUAL] = S_EQUAL;
+        t.next[S_START][CC_LESS] = S_LESS;
+        t.next[S_START][CC_GREATER] = S_GREATER;
+
+        t.next[S_IDENTIFIER][CC_LETTER] = S_IDENTIFIER;
+        t.next[S_IDENTIFIER][CC_DIGIT] = S_IDENTIFIER;
+        t.next[S_CONSTANT][CC_DIGIT] = S_CONSTANT;
+        t.next[S_CONSTANT][CC_LETTER] = S_BAD_CONSTANT;
+        t.next[S_MINUS][CC_MINUS] = S_DECREMENT;
+        t.next[S_BANG][CC_EQUAL] = S_NOT_EQUAL;
+        t.next[S_AMPERSAND][CC_AMPERSAND] = S_LOGICAL_AND;
+        t.next[S_PIPE][CC_PIPE] = S_LOGICAL_OR;
+        t.next[S_EQUAL][CC_EQUAL] = S_EQUAL_EQUAL;
+        t.next[S_LESS][CC_EQUAL] = S_LESS_EQUAL;
+        t.next[S_GREATER][CC_EQUAL] = S_GREATER_EQUAL;
+
+        auto accept = [&t](State state, TokenType type) {
+            t.accepting[state] = true;
+            t.tokenType[state] = type;
+        };
+        accept(S_IDENTIFIER, TokenType::IDENTIFIER);
+        accept(S_CONSTANT, TokenType::CONSTANT);
+        accept(S_OPEN_PAREN, TokenType::OPEN_PAREN);
+        accept(S_CLOSE_PAREN, TokenType::CLOSE_PAREN);
+        accept(S_OPEN_BRACE, TokenType::OPEN_BRACE);
+        accept(S_CLOSE_BRACE, TokenType::CLOSE_BRACE);
+        accept(S_SEMICOLON, TokenType::SEMICOLON);
+        accept(S_TILDE, TokenType::TILDE);
+        accept(S_MINUS, TokenType::MINUS);
+        accept(S_DECREMENT, TokenType::DECREMENT);
+        accept(S_PLUS, TokenType::PLUS);
+        accept(S_STAR, TokenType::STAR);
+        accept(S_SLASH, TokenType::SLASH);
+        accept(S_PERCENT, TokenType::PERCENT);
+        accept(S_BANG, TokenType::BANG);
+        accept(S_NOT_EQUAL, TokenType::NOT_EQUAL);
+        accept(S_LOGICAL_AND, TokenType::LOGICAL_AND);
+        accept(S_LOGICAL_OR, TokenType::LOGICAL_OR);
+        accept(S_EQUAL_EQUAL, TokenType::EQUAL_EQUAL);
+        accept(S_LESS, TokenType::LESS);
+        accept(S_LESS_EQUAL, TokenType::LESS_EQUAL);
+        accept(S_GREATER, TokenType::GREATER);
+        accept(S_GREATER_EQUAL, TokenType::GREATER_EQUAL);
+        return t;
+    }
+
+    constexpr DfaTables kDfa = buildDfaTables();
+
+} // namespace
+
+/**
+ * @brief Returns the source spelling of a token.
+ *
+ * @param token The token.
+ * @return The token's payload for identifiers and constants, otherwise the fixed spelling of its type.
+ */
+std::string_view tokenText(const Token &token) {
+    switch (token.type) {
+        case TokenType::IDENTIFIER:
+        case TokenType::CONSTANT:
+            return token.value;
+        case TokenType::INT_KEYWORD:
+            return "int";
+        case TokenType::VOID_KEYWORD:
+            return "void";
+        case TokenType::RETURN_KEYWORD:
+            return "return";
+        case TokenType::OPEN_PAREN:
+            return "(";
+        case TokenType::CLOSE_PAREN:
+            return ")";
+        case TokenType::OPEN_BRACE:
+            return "{";
+        case TokenType::CLOSE_BRACE:
+            return "}";
+        case TokenType::SEMICOLON:
+            return ";";
+        case TokenType::TILDE:
+            return "~";
+        case TokenType::MINUS:
+            return "-";
+        case TokenType::DECREMENT:
+            return "--";
+        case TokenType::PLUS:
+            return "+";
+        case TokenType::STAR:
+            return "*";
+        case TokenType::SLASH:
+            return "/";
+        case TokenType::PERCENT:
+            return "%";
+        case TokenType::BANG:
+            return "!";
+        case TokenType::LOGICAL_AND:
+            return "&&";
+        case TokenType::LOGICAL_OR:
+            return "||";
+        case TokenType::EQUAL_EQUAL:
+            return "==";
+        case TokenType::NOT_EQUAL:
+            return "!=";
+        case TokenType::LESS:
+            return "<";
+        case TokenType::LESS_EQUAL:
+            return "<=";
+        case TokenType::GREATER:
+            return ">";
+        case TokenType::GREATER_EQUAL:
+            return ">=";
+    }
+    return {};
+}
+
+Lexer::Lexer(std::string_view input, Mode mode) : m_input(input), m_position(0), m_mode(mode) {}
 
 /**
  * @brief Tokenizes the input string.
  *
- * @details Tokenizes the input string by finding the longest match of a token regex at the current position.
+ * @details Tokenizes the input string by repeatedly skipping whitespace and comments and recognising the
+ *          token at the current position with the selected scanner.
  *
  * @return A vector of tokens.
  */
@@ -21,15 +255,149 @@ std::vector<Token> Lexer::tokenize() {
     return tokens;
 }
 
+/**
+ * @brief Tokenizes the input on several threads, with the same result as tokenize().
+ *
+ * @details The input is cut into chunks that start at line beginnings, and every chunk is lexed at once on the
+ *          guess that its first byte is not inside a comment or a token. The chunks are then joined in order.
+ *          The lexer is known to be between tokens where the previous chunk's scan stopped: at the first token
+ *          starting in this chunk. If the chunk's own scan also has a token there, the two scans agree from
+ *          that point on, since lexing from a token start depends on nothing before it. Otherwise the guess was
+ *          wrong (the chunk began inside a comment, say), and that stretch is lexed again from the right place.
+ *
+ *          A chunk's scan stops at its first error. The error is raised only if the joined token stream reaches
+ *          it, so errors seen from a wrong starting state never surface.
+ *
+ * @param pool Threads to lex on; without one the chunks are lexed in turn, which is only useful for testing.
+ * @param chunk_size The smallest chunk to lex on its own.
+ * @return The tokens.
+ */
+std::vector<Token> Lexer::tokenizeParallel(ThreadPool *pool, size_t chunk_size) {
+    const size_t length = m_input.length();
+    size_t threads = pool ? pool->size() + 1 : 1;
+    size_t count = std::clamp<size_t>(length / std::max<size_t>(chunk_size, 1), 1, threads * 4);
+    if (count == 1) {
+        return tokenize();
+    }
+
+    struct Chunk {
+        size_t start;
+        size_t stop;      // Tokens starting from here on belong to the next chunk
+        size_t exit = 0;  // Where the first token at or after `stop` starts
+        std::vector<Token> tokens;
+        std::exception_ptr error;
+    };
+    std::vector<Chunk> chunks(count);
+    for (size_t i = 1; i < count; ++i) {
+        size_t boundary = length / count * i;
+        size_t newline = TextScanner::findNewline(m_input.data(), boundary, length);
+        chunks[i].start = std::max(newline < length ? newline + 1 : boundary, chunks[i - 1].start);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].stop = i + 1 < count ? chunks[i + 1].start : length;
+    }
+
+    auto lexChunk = [this, &chunks](size_t i) {
+        Chunk &chunk = chunks[i];
+        chunk.tokens.reserve((chunk.stop - chunk.start) / 4);
+        try {
+            Lexer lexer(m_input, m_mode);
+            chunk.exit = lexer.tokenizeRange(chunk.start, chunk.stop, chunk.tokens);
+        } catch (...) {
+            chunk.error = std::current_exception();
+        }
+    };
+    if (pool) {
+        pool->parallelFor(count, lexChunk);
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            lexChunk(i);
+        }
+    }
+
+    std::vector<Token> tokens;
+    size_t total = 0;
+    for (const auto &chunk: chunks) {
+        total += chunk.tokens.size();
+    }
+    tokens.reserve(total);
+    size_t position = 0;  // The next token starts here
+    for (size_t i = 0; i < count; ++i) {
+        const Chunk &chunk = chunks[i];
+        if (position >= chunk.stop) {
+            continue;  // A comment or token from an earlier chunk covers this one
+        }
+        // The first chunk starts at the beginning of the input, so its scan is never a guess
+        auto first = std::lower_bound(chunk.tokens.begin(), chunk.tokens.end(), position,
+                                      [](const Token &token, size_t at) { return token.location.offset < at; });
+        if (i == 0 || (first != chunk.tokens.end() && first->location.offset == position)) {
+            tokens.insert(tokens.end(), first, chunk.tokens.end());
+            if (chunk.error) {
+                std::rethrow_exception(chunk.error);
+            }
+            position = chunk.exit;
+        } else {
+            Lexer lexer(m_input, m_mode);
+            position = lexer.tokenizeRange(position, chunk.stop, tokens);
+        }
+    }
+    return tokens;
+}
+
+/**
+ * @brief Lexes the tokens that start in `[start, stop)`, beginning between tokens at `start`.
+ *
+ * @return Where the next token starts: at or after `stop`, or the end of the input.
+ */
+size_t Lexer::tokenizeRange(size_t start, size_t stop, std::vector<Token> &tokens) {
+    m_position = start;
+    for (;;) {
+        skipWhitespaceAndComments();
+        if (m_position >= m_input.length() || m_position >= stop) {
+            return m_position;
+        }
+        tokens.push_back(getNextToken());
+    }
+}
+
+/**
+ * @brief Scans the next token, for callers that consume tokens while the input is still being lexed.
+ *
+ * @param token Receives the token.
+ * @return `false` at the end of the input.
+ */
+bool Lexer::next(Token &token) {
+    skipWhitespaceAndComments();
+    if (m_position >= m_input.length()) {
+        return false;
+    }
+    token = getNextToken();
+    return true;
+}
+
+/**
+ * @brief Returns the tokens as a lazily evaluated sequence: each one is scanned when the consumer asks for it.
+ *
+ * @details The lexer must outlive the generator. A LexError is raised from the consumer's request for the token
+ *          that could not be scanned.
+ */
+Generator<Token> Lexer::stream() {
+    Token token;
+    while (next(token)) {
+        co_yield token;
+    }
+}
+
 /**
  * @brief Skips whitespace and comments.
  *
+ * @details Runs of whitespace and comment bodies are scanned a vector at a time by TextScanner.
  */
 void Lexer::skipWhitespaceAndComments() {
-    while (m_position < m_input.length()) {
-        if (std::isspace(m_input[m_position])) {
-            ++m_position;
-        } else if (m_input[m_position] == '/' && m_position + 1 < m_input.length()) {
+    const size_t end = m_input.length();
+    while (m_position < end) {
+        m_position = TextScanner::skipSpace(m_input.data(), m_position, end);
+        if (m_position + 1 < end && m_input[m_position] == '/') {
             if (m_input[m_position + 1] == '/') {
                 skipSingleLineComment();
             } else if (m_input[m_position + 1] == '*') {
@@ -44,40 +412,83 @@ void Lexer::skipWhitespaceAndComments() {
 }
 
 void Lexer::skipSingleLineComment() {
-    m_position += 2;  // Skip '//'
-    while (m_position < m_input.length() && m_input[m_position] != '\n') {
-        ++m_position;
-    }
+    m_position = TextScanner::findNewline(m_input.data(), m_position + 2, m_input.length());  // After '//'
 }
 
 void Lexer::skipMultiLineComment() {
-    m_position += 2;  // Skip '/*'
-    while (m_position < m_input.length()) {
-        if (m_input[m_position] == '*' && m_position + 1 < m_input.length() && m_input[m_position + 1] == '/') {
-            m_position += 2;  // Skip '*/'
-            return;
-        }
-        ++m_position;
+    size_t start = m_position;
+    size_t close = TextScanner::findCommentEnd(m_input.data(), m_position + 2, m_input.length());  // After '/*'
+    if (close == m_input.length()) {
+        m_position = close;
+        throw LexError("Unterminated multi-line comment", {static_cast<uint32_t>(start)});
     }
-    throw std::runtime_error("Unterminated multi-line comment");
+    m_position = close + 2;  // Skip '*/'
 }
 
 /**
  * @brief Gets the next token from the input string.
  *
- * @details Finds the longest match of a token regex at the current position and returns the token.
+ * @details Recognises the token at the current position with the selected scanner and returns it.
  *
  * @return The next token.
  */
 Token Lexer::getNextToken() {
-    auto [type, value] = findLongestMatch();
-    if (type == TokenType::IDENTIFIER && (value == "int" || value == "void" || value == "return")) {
-        if (value == "int") type = TokenType::INT_KEYWORD;
-        else if (value == "void") type = TokenType::VOID_KEYWORD;
-        else type = TokenType::RETURN_KEYWORD;
-    }
-    m_position += value.length();
-    return {type, value};
+    auto [type, length] = m_mode == Mode::Dfa ? scanToken() : findLongestMatch();
+    SourceLocation location{static_cast<uint32_t>(m_position)};
+    std::string_view value = m_input.substr(m_position, length);
+    m_position += length;
+
+    if (type == TokenType::IDENTIFIER) {
+        if (value == "int") return {TokenType::INT_KEYWORD, location, {}};
+        if (value == "void") return {TokenType::VOID_KEYWORD, location, {}};
+        if (value == "return") return {TokenType::RETURN_KEYWORD, location, {}};
+        return {type, location, value};
+    }
+    if (type == TokenType::CONSTANT) {
+        return {type, location, value};
+    }
+    return {type, location, {}};
+}
+
+/**
+ * @brief Scans the token at the current position with the DFA.
+ *
+ * @details Runs the transition table from the start state over the input in place, remembering the last
+ *          accepting state. Digits running straight into a word character are rejected, matching the `\b`
+ *          anchor of the regex recogniser.
+ *
+ * @return A pair of the token type and its length in bytes.
+ */
+std::pair<TokenType, size_t> Lexer::scanToken() const {
+    const auto *input = reinterpret_cast<const unsigned char *>(m_input.data());
+    const size_t end = m_input.length();
+    size_t position = m_position;
+    uint8_t state = S_START;
+    size_t accepted_length = 0;
+    TokenType accepted_type = TokenType::IDENTIFIER;
+
+    while (position < end) {
+        uint8_t next = kDfa.next[state][kDfa.charClass[input[position]]];
+        if (next == S_STOP) {
+            break;
+        }
+        state = next;
+        ++position;
+        if (state == S_BAD_CONSTANT) {
+            accepted_length = 0;
+            break;
+        }
+        if (kDfa.accepting[state]) {
+            accepted_length = position - m_position;
+            accepted_type = kDfa.tokenType[state];
+        }
+    }
+
+    if (accepted_length == 0) {
+        throw LexError("Invalid token", {static_cast<uint32_t>(m_position)});
+    }
+
+    return {accepted_type, accepted_length};
 }
 
 /**
@@ -87,9 +498,9 @@ Token Lexer::getNextToken() {
  *         the token regexes in the order they are defined, and the remaining input string from the current position.
  *
  *
- * @return A pair of the token type and value.
+ * @return A pair of the token type and its length in bytes.
  */
-std::pair<TokenType, std::string> Lexer::findLongestMatch() {
+std::pair<TokenType, size_t> Lexer::findLongestMatch() {
     static const std::vector<std::pair<TokenType, std::regex>> token_regexes = {
             {TokenType::IDENTIFIER,  std::regex(R"([a-zA-Z_]\w*\b)")},
             {TokenType::CONSTANT,    std::regex(R"([0-9]+\b)")},
@@ -97,23 +508,39 @@ std::pair<TokenType, std::string> Lexer::findLongestMatch() {
             {TokenType::CLOSE_PAREN, std::regex(R"(\))")},
             {TokenType::OPEN_BRACE,  std::regex(R"(\{)")},
             {TokenType::CLOSE_BRACE, std::regex(R"(\})")},
-            {TokenType::SEMICOLON,   std::regex(R"(;)")}
+            {TokenType::SEMICOLON,   std::regex(R"(;)")},
+            {TokenType::TILDE,       std::regex(R"(~)")},
+            {TokenType::MINUS,       std::regex(R"(-)")},
+            {TokenType::DECREMENT,   std::regex(R"(--)")},
+            {TokenType::PLUS,        std::regex(R"(\+)")},
+            {TokenType::STAR,        std::regex(R"(\*)")},
+            {TokenType::SLASH,       std::regex(R"(/)")},
+            {TokenType::PERCENT,     std::regex(R"(%)")},
+            {TokenType::BANG,        std::regex(R"(!)")},
+            {TokenType::LOGICAL_AND, std::regex(R"(&&)")},
+            {TokenType::LOGICAL_OR,  std::regex(R"(\|\|)")},
+            {TokenType::EQUAL_EQUAL, std::regex(R"(==)")},
+            {TokenType::NOT_EQUAL,   std::regex(R"(!=)")},
+            {TokenType::LESS,        std::regex(R"(<)")},
+            {TokenType::LESS_EQUAL,  std::regex(R"(<=)")},
+            {TokenType::GREATER,     std::regex(R"(>)")},
+            {TokenType::GREATER_EQUAL, std::regex(R"(>=)")}
     };
 
-    std::pair<TokenType, std::string> longest_match = {TokenType::IDENTIFIER, ""};
-    std::string remaining = m_input.substr(m_position);
+    std::pair<TokenType, size_t> longest_match = {TokenType::IDENTIFIER, 0};
+    std::string remaining(m_input.substr(m_position));
     for (const auto &[type, regex]: token_regexes) {
         std::smatch match;
         if (std::regex_search(remaining.cbegin(), remaining.cend(), match, regex,
                               std::regex_constants::match_continuous)) {
-            if (match.length() > longest_match.second.length()) {
-                longest_match = {type, match.str()};
+            if (static_cast<size_t>(match.length()) > longest_match.second) {
+                longest_match = {type, static_cast<size_t>(match.length())};
             }
         }
     }
 
-    if (longest_match.second.empty()) {
-        throw std::runtime_error("Invalid token at position " + std::to_string(m_position));
+    if (longest_match.second == 0) {
+        throw LexError("Invalid token", {static_cast<uint32_t>(m_position)});
     }
 
     return longest_match;
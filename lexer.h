@@ -1,10 +1,14 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <regex>
+#include <stdexcept>
+#include "generator.h"
+#include "source_location.h"
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     IDENTIFIER,
     CONSTANT,
     INT_KEYWORD,
@@ -14,23 +18,78 @@ enum class TokenType {
     CLOSE_PAREN,
     OPEN_BRACE,
     CLOSE_BRACE,
-    SEMICOLON
+    SEMICOLON,
+    TILDE,
+    MINUS,
+    DECREMENT,
+    PLUS,
+    STAR,
+    SLASH,
+    PERCENT,
+    BANG,
+    LOGICAL_AND,
+    LOGICAL_OR,
+    EQUAL_EQUAL,
+    NOT_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GREATER,
+    GREATER_EQUAL
 };
 
+/**
+ * A token is a type and a source location plus, for identifiers and constants, a slice of the source buffer.
+ * Keywords and punctuation carry no payload; their spelling is implied by the type (see tokenText).
+ */
 struct Token {
     TokenType type;
-    std::string value;
+    SourceLocation location;
+    std::string_view value;
 };
 
+static_assert(sizeof(Token) <= 24, "Token should stay small enough to pack several per cache line");
+
+class LexError : public std::runtime_error {
+public:
+    LexError(const std::string &message, SourceLocation location)
+            : std::runtime_error(message), location(location) {}
+
+    SourceLocation location;
+};
+
+std::string_view tokenText(const Token &token);
+
+class ThreadPool;
+
 class Lexer {
 public:
-    Lexer(const std::string &input);
+    /**
+     * Token recognisers. `Dfa` is a single-pass table-driven scanner; `Regex` is the original std::regex
+     * longest-match implementation, kept so the two can be compared.
+     */
+    enum class Mode {
+        Dfa,
+        Regex
+    };
+
+    Lexer(std::string_view input, Mode mode = Mode::Dfa);
+
+    static constexpr size_t kParallelChunkSize = 1 << 20;  // Smallest share of the input a thread lexes
 
     std::vector<Token> tokenize();
 
+    std::vector<Token> tokenizeParallel(ThreadPool *pool, size_t chunk_size = kParallelChunkSize);
+
+    bool next(Token &token);
+
+    Generator<Token> stream();
+
 private:
-    std::string m_input;
+    std::string_view m_input;
     size_t m_position;
+    Mode m_mode;
+
+    size_t tokenizeRange(size_t start, size_t stop, std::vector<Token> &tokens);
 
     void skipWhitespaceAndComments();
 
@@ -40,5 +99,7 @@ private:
 
     Token getNextToken();
 
-    std::pair<TokenType, std::string> findLongestMatch();
-};
\ No newline at end of file
+    std::pair<TokenType, size_t> scanToken() const;
+
+    std::pair<TokenType, size_t> findLongestMatch();
+};
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "sink.h"
+#include "synthetic_source.h"
+#include "tacky_gen.h"
+#include "text_scanner.h"
+#include "thread_pool.h"
+#include "token_stream.h"
+
+/*
+ * Throughput benchmarks for the compiler's stages: Lexer::tokenize (and with --threads, tokenizeParallel),
+ * Parser::parse, both together through a TokenStream, CodeGen::generate and assembly::Program::emit, each run on
+ * synthetic translation units from 1 KB up to 100 MB. Every stage is repeated until it has run for --min-time
+ * seconds and the median iteration is reported, as items per second (tokens, AST nodes, assembly instructions)
+ * and input or output bytes per second.
+ *
+ * With --fuzz it instead checks that every vectorised TextScanner variant the CPU supports agrees with the
+ * scalar one, on random text and through the whole lexer, and that the chunked parallel lexer agrees with the
+ * sequential one.
+ */
+
+namespace {
+
+    struct Options {
+        std::vector<size_t> sizes = {1 << 10, 16 << 10, 256 << 10, 4 << 20, 100 << 20};
+        double min_time = 0.5;
+        unsigned threads = 1;
+        uint64_t seed = 1;
+        std::string json_file;
+        size_t fuzz_cases = 0;
+        std::string isa;
+    };
+
+    struct Result {
+        std::string name;
+        size_t input_bytes;
+        size_t iterations;
+        double seconds;      // Median over the iterations
+        uint64_t items;
+        const char *unit;
+        uint64_t bytes;      // Bytes read (lex) or written (emit); 0 where it means nothing
+    };
+
+    /**
+     * Runs `body` until `min_time` has passed (at least once, at most 1000 times) and returns the median time
+     * of one run in seconds.
+     */
+    template<typename Body>
+    double measure(double min_time, size_t &iterations, Body &&body) {
+        std::vector<double> times;
+        double total = 0;
+        while (times.empty() || (total < min_time && times.size() < 1000)) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            times.push_back(elapsed.count());
+            total += elapsed.count();
+        }
+        iterations = times.size();
+        std::nth_element(times.begin(), times.begin() + static_cast<std::ptrdiff_t>(times.size() / 2), times.end());
+        return times[times.size() / 2];
+    }
+
+    bool parseSize(const std::string &text, size_t &size) {
+        char *end = nullptr;
+        unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+        if (end == text.c_str()) {
+            return false;
+        }
+        std::string suffix(end);
+        if (suffix == "K" || suffix == "KB") {
+            value <<= 10;
+        } else if (suffix == "M" || suffix == "MB") {
+            value <<= 20;
+        } else if (!suffix.empty() && suffix != "B") {
+            return false;
+        }
+        size = value;
+        return value > 0;
+    }
+
+    std::string formatSize(size_t bytes) {
+        std::ostringstream text;
+        if (bytes >= (1 << 20)) {
+            text << bytes / (1 << 20) << " MB";
+        } else if (bytes >= (1 << 10)) {
+            text << bytes / (1 << 10) << " KB";
+        } else {
+            text << bytes << " B";
+        }
+        return text.str();
+    }
+
+    void print(const Result &result) {
+        double per_second = result.seconds > 0 ? 1.0 / result.seconds : 0;
+        std::cout << std::left << std::setw(8) << result.name << std::right << std::setw(8)
+                  << formatSize(result.input_bytes) << std::setw(7) << result.iterations << " iters"
+                  << std::fixed << std::setprecision(3) << std::setw(12) << result.seconds * 1000 << " ms"
+                  << std::setprecision(2) << std::setw(10) << static_cast<double>(result.items) * per_second / 1e6
+                  << " M " << result.unit << "/s";
+        if (result.bytes) {
+            std::cout << std::setw(10) << static_cast<double>(result.bytes) * per_second / (1 << 20) << " MB/s";
+        }
+        std::cout << std::endl;
+    }
+
+    void writeJson(std::ostream &out, const Options &options, const std::vector<Result> &results) {
+        out << "{\"seed\": " << options.seed << ", \"threads\": " << options.threads << ", \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &result = results[i];
+            double per_second = result.seconds > 0 ? 1.0 / result.seconds : 0;
+            out << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << result.name << "\", \"input_bytes\": "
+                << result.input_bytes << ", \"iterations\": " << result.iterations << ", \"seconds\": "
+                << std::setprecision(9) << result.seconds << ", \"" << result.unit << "\": " << result.items
+                << ", \"" << result.unit << "_per_second\": " << std::setprecision(6)
+                << static_cast<double>(result.items) * per_second;
+            if (result.bytes) {
+                out << ", \"bytes\": " << result.bytes << ", \"bytes_per_second\": "
+                    << static_cast<double>(result.bytes) * per_second;
+            }
+            out << "}";
+        }
+        out << "\n]}\n";
+    }
+
+    /**
+     * Benchmarks every stage on one input. Each stage's result feeds the next, and is released as soon as
+     * the next no longer needs it so the largest inputs fit in memory.
+     */
+    void runStages(const Options &options, size_t size, ThreadPool *pool, std::vector<Result> &results) {
+        std::string source = SyntheticSource(options.seed).generate(size);
+        auto report = [&results](Result result) {
+            print(result);
+            results.push_back(std::move(result));
+        };
+
+        std::vector<Token> tokens;
+        size_t iterations = 0;
+        double seconds = measure(options.min_time, iterations, [&] {
+            tokens = Lexer(source).tokenize();
+        });
+        report({"lex", size, iterations, seconds, tokens.size(), "tokens", source.size()});
+        if (pool) {
+            seconds = measure(options.min_time, iterations, [&] {
+                tokens = Lexer(source).tokenizeParallel(pool);
+            });
+            report({"lex-parallel", size, iterations, seconds, tokens.size(), "tokens", source.size()});
+        }
+
+        auto arena = std::make_unique<Arena>();
+        Program *ast = nullptr;
+        seconds = measure(options.min_time, iterations, [&] {
+            arena->clear();
+            TokenStream stream(tokens);
+            Parser parser(stream, *arena);
+            ast = parser.parse();
+        });
+        report({"parse", size, iterations, seconds, arena->objectCount(), "nodes", 0});
+        tokens = {};
+
+        // Lexing and parsing together, the way the driver does it: the parser pulls tokens from the lexer
+        seconds = measure(options.min_time, iterations, [&] {
+            arena->clear();
+            Lexer lexer(source);
+            TokenStream stream(lexer.stream());
+            Parser parser(stream, *arena);
+            ast = parser.parse();
+        });
+        report({"stream", size, iterations, seconds, arena->objectCount(), "nodes", source.size()});
+
+        tacky::Program tacky = TackyGen::generate(*ast);
+        arena.reset();
+
+        CodeGenOptions codegen_options;
+        codegen_options.peephole_rules = Peephole::kAllRules;
+        codegen_options.pool = pool;
+        std::unique_ptr<assembly::Program> program;
+        seconds = measure(options.min_time, iterations, [&] {
+            program.reset();
+            program = CodeGen::generate(tacky, codegen_options);
+        });
+        uint64_t instructions = 0;
+        for (const auto &function: program->functions) {
+            instructions += function->instructions.size();
+        }
+        report({"codegen", size, iterations, seconds, instructions, "instructions", 0});
+        tacky = {};
+
+        size_t emitted_bytes = 0;
+        {
+            std::string text;
+            Sink sink(text);
+            program->emit(sink);
+            sink.flush();
+            emitted_bytes = text.size();
+        }
+        int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        seconds = measure(options.min_time, iterations, [&] {
+            Sink sink(null_fd);
+            program->emit(sink);
+        });
+        ::close(null_fd);
+        report({"emit", size, iterations, seconds, instructions, "instructions", emitted_bytes});
+    }
+
+    /** xorshift64*, as in SyntheticSource. */
+    struct Random {
+        uint64_t state;
+
+        uint32_t next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return static_cast<uint32_t>((state * 0x2545F4914F6CDD1DULL) >> 32);
+        }
+
+        size_t below(size_t bound) { return next() % bound; }
+    };
+
+    // Random bytes, mostly ones the scans treat specially and their neighbours in the byte order
+    std::string randomText(Random &random, size_t length) {
+        static const char kBytes[] = {' ', '\t', '\n', '\v', '\f', '\r', '*', '/', 'a', '0', '\0', '\b', '\x0e',
+                                      '\x1f', '!', '\x7f', '\x80', '\x89', '\xa0', '\xff'};
+        std::string text(length, ' ');
+        for (char &c: text) {
+            c = random.below(4) ? kBytes[random.below(std::size(kBytes))] : static_cast<char>(random.next());
+        }
+        return text;
+    }
+
+    // C-like text in which whitespace runs and comments of every length fall across block boundaries
+    std::string randomSource(Random &random, size_t pieces) {
+        static const char *const kPieces[] = {"int", "x1", "42", "(", ")", "{", "}", ";", "-", "--", "/", "*",
+                                              "&&", "!=", "<=", "/**/", "/*/", "*/", "//", "\n", "\t", "\r\n"};
+        std::string text;
+        for (size_t i = 0; i < pieces; ++i) {
+            switch (random.below(5)) {
+                case 0:
+                    text.append(random.below(70), " \t\n"[random.below(3)]);
+                    break;
+                case 1:
+                    text += "/*" + randomText(random, random.below(80)) + "*/";
+                    break;
+                case 2:
+                    text += "//" + randomText(random, random.below(80)) + "\n";
+                    break;
+                default:
+                    text += kPieces[random.below(std::size(kPieces))];
+                    text += ' ';
+            }
+        }
+        return text;
+    }
+
+    // The tokens, or the error, as text that can be compared; lexed in chunks of `chunk_size` unless it is 0
+    std::string lexResult(const std::string &text, size_t chunk_size = 0, ThreadPool *pool = nullptr) {
+        std::string result;
+        try {
+            Lexer lexer(text);
+            for (const Token &token: chunk_size ? lexer.tokenizeParallel(pool, chunk_size) : lexer.tokenize()) {
+                result += std::to_string(static_cast<int>(token.type)) + "@" + std::to_string(token.location.offset) +
+                          " ";
+            }
+        } catch (const LexError &e) {
+            result += std::string("error ") + e.what() + "@" + std::to_string(e.location.offset);
+        }
+        return result;
+    }
+
+    /**
+     * Differential test: every TextScanner variant the CPU supports against the scalar one, first scan by scan
+     * on random bytes from random starting points, then through the lexer on random C-like text. The same text
+     * is also lexed in tiny chunks, so chunks often start inside comments and tokens.
+     */
+    int fuzz(const Options &options) {
+        std::vector<TextScanner::Isa> variants;
+        for (auto isa: {TextScanner::Isa::Sse2, TextScanner::Isa::Avx2}) {
+            if (TextScanner::supported(isa)) {
+                variants.push_back(isa);
+            }
+        }
+        TextScanner::Isa original = TextScanner::isa();
+        Random random{options.seed ? options.seed : 1};
+        std::unique_ptr<ThreadPool> pool;
+        if (options.threads > 1) {
+            pool = std::make_unique<ThreadPool>(options.threads - 1);
+        }
+        size_t failures = 0;
+        auto fail = [&failures](const std::string &what, TextScanner::Isa isa, uint64_t iteration) {
+            if (++failures <= 10) {
+                std::cerr << what << " differs with " << TextScanner::name(isa) << " in case " << iteration
+                          << std::endl;
+            }
+        };
+
+        for (size_t iteration = 0; iteration < options.fuzz_cases; ++iteration) {
+            std::string text = randomText(random, random.below(iteration % 16 ? 100 : 2000));
+            size_t end = text.size() - random.below(std::min<size_t>(text.size(), 3) + 1);
+            size_t start = random.below(end + 1);
+            TextScanner::use(TextScanner::Isa::Scalar);
+            size_t space = TextScanner::skipSpace(text.data(), start, end);
+            size_t newline = TextScanner::findNewline(text.data(), start, end);
+            size_t comment_end = TextScanner::findCommentEnd(text.data(), start, end);
+            std::string source = iteration % 8 ? std::string() : randomSource(random, random.below(300));
+            std::string tokens = source.empty() ? std::string() : lexResult(source);
+            if (!source.empty() && lexResult(source, 1 + random.below(64), pool.get()) != tokens) {
+                fail("Chunked lexer output", TextScanner::Isa::Scalar, iteration);
+            }
+            for (auto isa: variants) {
+                TextScanner::use(isa);
+                if (TextScanner::skipSpace(text.data(), start, end) != space) {
+                    fail("skipSpace", isa, iteration);
+                }
+                if (TextScanner::findNewline(text.data(), start, end) != newline) {
+                    fail("findNewline", isa, iteration);
+                }
+                if (TextScanner::findCommentEnd(text.data(), start, end) != comment_end) {
+                    fail("findCommentEnd", isa, iteration);
+                }
+                if (!source.empty() && lexResult(source) != tokens) {
+                    fail("Lexer output", isa, iteration);
+                }
+            }
+        }
+        TextScanner::use(original);
+
+        std::cout << "fuzz: " << options.fuzz_cases << " cases, scalar against";
+        for (auto isa: variants) {
+            std::cout << " " << TextScanner::name(isa);
+        }
+        std::cout << (variants.empty() ? " nothing (no vector unit)" : "") << ": " << failures << " mismatches"
+                  << std::endl;
+        return failures ? 1 : 0;
+    }
+
+    void printUsage() {
+        std::cout << "Usage: mcc_bench [options]" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  --sizes=<list>   Comma-separated input sizes with K or M suffixes" << std::endl;
+        std::cout << "                   (default: 1K,16K,256K,4M,100M; 100M needs about 7 GB of memory)"
+                  << std::endl;
+        std::cout << "  --min-time=<s>   Repeat each benchmark for at least this long (default: 0.5)" << std::endl;
+        std::cout << "  --threads=<n>    Lex n chunks, or generate code for n functions, at once (default: 1)"
+                  << std::endl;
+        std::cout << "  --seed=<n>       Seed for the input generator (default: 1)" << std::endl;
+        std::cout << "  --json=<file>    Also write the results as JSON" << std::endl;
+        std::cout << "  --isa=<name>     Scan text with scalar, sse2 or avx2 code (default: the best supported)"
+                  << std::endl;
+        std::cout << "  --fuzz=<n>       Instead of benchmarking, check n random cases of every vectorised scan"
+                  << std::endl;
+        std::cout << "                   against the scalar one, and of the chunked lexer against the sequential one"
+                  << std::endl;
+    }
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--sizes=", 0) == 0) {
+            options.sizes.clear();
+            std::string list = arg.substr(8);
+            for (size_t start = 0; start <= list.size();) {
+                size_t comma = std::min(list.find(',', start), list.size());
+                size_t size = 0;
+                if (!parseSize(list.substr(start, comma - start), size)) {
+                    std::cerr << "Invalid size in " << arg << std::endl;
+                    return 1;
+                }
+                options.sizes.push_back(size);
+                start = comma + 1;
+            }
+        } else if (arg.rfind("--min-time=", 0) == 0) {
+            options.min_time = std::strtod(arg.c_str() + 11, nullptr);
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = static_cast<unsigned>(std::max(1L, std::strtol(arg.c_str() + 10, nullptr, 10)));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--json=", 0) == 0) {
+            options.json_file = arg.substr(7);
+        } else if (arg.rfind("--isa=", 0) == 0) {
+            options.isa = arg.substr(6);
+        } else if (arg.rfind("--fuzz=", 0) == 0) {
+            options.fuzz_cases = std::strtoull(arg.c_str() + 7, nullptr, 10);
+        } else {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (options.fuzz_cases) {
+        return fuzz(options);
+    }
+    if (!options.isa.empty()) {
+        auto isa = options.isa == "avx2" ? TextScanner::Isa::Avx2
+                 : options.isa == "sse2" ? TextScanner::Isa::Sse2 : TextScanner::Isa::Scalar;
+        if (TextScanner::name(isa) != options.isa || !TextScanner::supported(isa)) {
+            std::cerr << "Unsupported --isa=" << options.isa << std::endl;
+            return 1;
+        }
+        TextScanner::use(isa);
+    }
+    std::cout << "Text scans: " << TextScanner::name(TextScanner::isa()) << std::endl;
+
+    // The calling thread takes part in the work, so the pool needs one thread fewer
+    std::unique_ptr<ThreadPool> pool;
+    if (options.threads > 1) {
+        pool = std::make_unique<ThreadPool>(options.threads - 1);
+    }
+    std::vector<Result> results;
+    try {
+        for (size_t size: options.sizes) {
+            runStages(options, size, pool.get(), results);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!options.json_file.empty()) {
+        std::ofstream json(options.json_file);
+        writeJson(json, options, results);
+        if (!json.flush()) {
+            std::cerr << "Unable to write " << options.json_file << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
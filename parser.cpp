@@ -1,21 +1,60 @@
 #include "parser.h"
+#include <charconv>
 #include <sstream>
 
-Parser::Parser(std::vector<Token> tokens) : m_tokens(std::move(tokens)), m_position(0) {}
+/**
+ * @brief Creates a parser that pulls tokens from `tokens` as it needs them; the stream must outlive the parser.
+ */
+Parser::Parser(TokenStream &tokens, Arena &arena) : m_tokens(tokens), m_arena(arena) {}
 
-std::unique_ptr<Program> Parser::parse() {
+/**
+ * @brief Parses a translation unit: one or more function definitions.
+ *
+ * @return The program, with its function array allocated in the arena.
+ */
+Program *Parser::parse() {
+    std::vector<Function *> functions;
+    while (Function *function = next()) {
+        functions.push_back(function);
+    }
+
+    auto array = m_arena.makeArray<Function *>(functions.size());
+    std::copy(functions.begin(), functions.end(), array);
+    return m_arena.make<Program>(std::span<Function *>(array, functions.size()), functions.front()->location);
+}
+
+/**
+ * @brief Parses the next function definition on its own, so a caller can compile it and release its nodes
+ *        before reading on.
+ *
+ * @details The function is passed to the `onFunction` callback, if one is set, once it is complete and known
+ *          not to redefine an earlier one. A translation unit must define at least one function, so the first
+ *          call fails on empty input.
+ *
+ * @return The function, or nullptr at the end of the input.
+ */
+Function *Parser::next() {
+    if (!m_names.empty() && !m_tokens.peek()) {
+        return nullptr;
+    }
     auto function = parseFunction();
-    if (m_position < m_tokens.size()) {
-        throw ParseError("Unexpected tokens after function definition");
+    // The name is copied: the function's nodes may be released before the end of the translation unit
+    if (!m_names.emplace(function->name).second) {
+        throw ParseError("Redefinition of function '" + std::string(function->name) + "'", function->location);
+    }
+    if (m_on_function) {
+        m_on_function(function);
     }
-    return std::make_unique<Program>(std::move(function));
+    return function;
 }
 
-std::unique_ptr<Function> Parser::parseFunction() {
+Function *Parser::parseFunction() {
+    SourceLocation location = currentLocation();
     expect(TokenType::INT_KEYWORD);
     auto name = consumeToken();
     if (name.type != TokenType::IDENTIFIER) {
-        throw ParseError("Expected function name (identifier) but found " + tokenTypeToString(name.type));
+        throw ParseError("Expected function name (identifier) but found " + tokenTypeToString(name.type),
+                         name.location);
     }
     expect(TokenType::OPEN_PAREN);
     expect(TokenType::VOID_KEYWORD);
@@ -23,50 +62,200 @@ std::unique_ptr<Function> Parser::parseFunction() {
     expect(TokenType::OPEN_BRACE);
     auto body = parseStatement();
     expect(TokenType::CLOSE_BRACE);
-    return std::make_unique<Function>(name.value, std::move(body));
+    return m_arena.make<Function>(m_arena.copyString(name.value), body, location);
 }
 
-std::unique_ptr<Statement> Parser::parseStatement() {
+Statement *Parser::parseStatement() {
+    SourceLocation location = currentLocation();
     expect(TokenType::RETURN_KEYWORD);
     auto exp = parseExp();
     expect(TokenType::SEMICOLON);
-    return std::make_unique<Return>(std::move(exp));
+    return m_arena.make<Return>(exp, location);
 }
 
-std::unique_ptr<Exp> Parser::parseExp() {
+/**
+ * @brief Parses an expression by precedence climbing.
+ *
+ * @details Parses a factor, then folds in binary operators whose precedence is at least `min_precedence`. The
+ *          right operand is parsed with a higher minimum, which makes every binary operator left-associative.
+ *
+ * @param min_precedence The lowest operator precedence this call may consume.
+ * @return The expression node.
+ */
+Exp *Parser::parseExp(int min_precedence) {
+    Exp *left = parseFactor();
+    BinaryOperator op;
+    while (const Token *next = peek()) {
+        if (!binaryOperator(next->type, op) || precedence(op) < min_precedence) {
+            break;
+        }
+        SourceLocation location = consumeToken().location;
+        Exp *right = parseExp(precedence(op) + 1);
+        left = m_arena.make<Binary>(op, left, right, location);
+    }
+    return left;
+}
+
+/**
+ * @brief Parses a constant, a unary operator applied to a factor, or a parenthesised expression.
+ *
+ * @return The expression node.
+ */
+Exp *Parser::parseFactor() {
     auto token = consumeToken();
-    if (token.type != TokenType::CONSTANT) {
-        throw ParseError("Expected constant but found " + tokenTypeToString(token.type));
+    switch (token.type) {
+        case TokenType::CONSTANT:
+            return parseConstant(token);
+        case TokenType::MINUS:
+            return m_arena.make<Unary>(UnaryOperator::Negate, parseFactor(), token.location);
+        case TokenType::TILDE:
+            return m_arena.make<Unary>(UnaryOperator::Complement, parseFactor(), token.location);
+        case TokenType::BANG:
+            return m_arena.make<Unary>(UnaryOperator::Not, parseFactor(), token.location);
+        case TokenType::DECREMENT:
+            throw ParseError("Operand of -- must be an lvalue", token.location);
+        case TokenType::OPEN_PAREN: {
+            auto exp = parseExp();
+            expect(TokenType::CLOSE_PAREN);
+            return exp;
+        }
+        default:
+            throw ParseError("Expected expression but found " + tokenTypeToString(token.type), token.location);
+    }
+}
+
+Constant *Parser::parseConstant(const Token &token) {
+    int value = 0;
+    auto [end, error] = std::from_chars(token.value.data(), token.value.data() + token.value.size(), value);
+    if (error != std::errc() || end != token.value.data() + token.value.size()) {
+        throw ParseError("Constant " + std::string(token.value) + " is out of range", token.location);
     }
-    return std::make_unique<Constant>(std::stoi(token.value));
+    return m_arena.make<Constant>(value, token.location);
+}
+
+/**
+ * @brief Maps a token to the binary operator it spells.
+ *
+ * @param type The token type.
+ * @param op Receives the operator.
+ * @return `true` if the token is a binary operator.
+ */
+bool Parser::binaryOperator(TokenType type, BinaryOperator &op) {
+    switch (type) {
+        case TokenType::PLUS:
+            op = BinaryOperator::Add;
+            return true;
+        case TokenType::MINUS:
+            op = BinaryOperator::Subtract;
+            return true;
+        case TokenType::STAR:
+            op = BinaryOperator::Multiply;
+            return true;
+        case TokenType::SLASH:
+            op = BinaryOperator::Divide;
+            return true;
+        case TokenType::PERCENT:
+            op = BinaryOperator::Remainder;
+            return true;
+        case TokenType::EQUAL_EQUAL:
+            op = BinaryOperator::Equal;
+            return true;
+        case TokenType::NOT_EQUAL:
+            op = BinaryOperator::NotEqual;
+            return true;
+        case TokenType::LESS:
+            op = BinaryOperator::LessThan;
+            return true;
+        case TokenType::LESS_EQUAL:
+            op = BinaryOperator::LessOrEqual;
+            return true;
+        case TokenType::GREATER:
+            op = BinaryOperator::GreaterThan;
+            return true;
+        case TokenType::GREATER_EQUAL:
+            op = BinaryOperator::GreaterOrEqual;
+            return true;
+        case TokenType::LOGICAL_AND:
+            op = BinaryOperator::And;
+            return true;
+        case TokenType::LOGICAL_OR:
+            op = BinaryOperator::Or;
+            return true;
+        default:
+            return false;
+    }
+}
+
+int Parser::precedence(BinaryOperator op) {
+    switch (op) {
+        case BinaryOperator::Multiply:
+        case BinaryOperator::Divide:
+        case BinaryOperator::Remainder:
+            return 50;
+        case BinaryOperator::Add:
+        case BinaryOperator::Subtract:
+            return 45;
+        case BinaryOperator::LessThan:
+        case BinaryOperator::LessOrEqual:
+        case BinaryOperator::GreaterThan:
+        case BinaryOperator::GreaterOrEqual:
+            return 35;
+        case BinaryOperator::Equal:
+        case BinaryOperator::NotEqual:
+            return 30;
+        case BinaryOperator::And:
+            return 10;
+        case BinaryOperator::Or:
+            return 5;
+    }
+    return 0;
 }
 
 void Parser::expect(TokenType type) {
-    if (m_position >= m_tokens.size()) {
-        throw ParseError("Expected " + tokenTypeToString(type) + " but found end of input");
+    const Token *token = m_tokens.peek();
+    if (!token) {
+        throw ParseError("Expected " + tokenTypeToString(type) + " but found end of input", currentLocation());
     }
-    if (m_tokens[m_position].type != type) {
-        throw ParseError(
-                "Expected " + tokenTypeToString(type) + " but found " + tokenTypeToString(m_tokens[m_position].type));
+    if (token->type != type) {
+        throw ParseError("Expected " + tokenTypeToString(type) + " but found " + tokenTypeToString(token->type),
+                         token->location);
     }
-    m_position++;
+    m_tokens.advance();
 }
 
 Token Parser::consumeToken() {
-    if (m_position >= m_tokens.size()) {
-        throw ParseError("Unexpected end of input");
+    const Token *token = m_tokens.peek();
+    if (!token) {
+        throw ParseError("Unexpected end of input", currentLocation());
     }
-    return m_tokens[m_position++];
+    Token result = *token;
+    m_tokens.advance();
+    return result;
+}
+
+const Token *Parser::peek() {
+    return m_tokens.peek();
 }
 
 bool Parser::match(TokenType type) {
-    if (m_position < m_tokens.size() && m_tokens[m_position].type == type) {
-        m_position++;
+    const Token *token = m_tokens.peek();
+    if (token && token->type == type) {
+        m_tokens.advance();
         return true;
     }
     return false;
 }
 
+/**
+ * @brief Returns the location diagnostics should point at for the current position.
+ *
+ * @return The location of the next token, or the end of the last token once the input is exhausted.
+ */
+SourceLocation Parser::currentLocation() {
+    const Token *token = m_tokens.peek();
+    return token ? token->location : m_tokens.endLocation();
+}
+
 std::string Parser::tokenTypeToString(TokenType type) const {
     switch (type) {
         case TokenType::IDENTIFIER:
@@ -79,17 +268,8 @@ std::string Parser::tokenTypeToString(TokenType type) const {
             return "VOID";
         case TokenType::RETURN_KEYWORD:
             return "RETURN";
-        case TokenType::OPEN_PAREN:
-            return "(";
-        case TokenType::CLOSE_PAREN:
-            return ")";
-        case TokenType::OPEN_BRACE:
-            return "{";
-        case TokenType::CLOSE_BRACE:
-            return "}";
-        case TokenType::SEMICOLON:
-            return ";";
         default:
-            return "UNKNOWN";
+            // Punctuation and operators carry no payload, so their spelling names them
+            return std::string(tokenText({type, {}, {}}));
     }
 }
\ No newline at end of file
@@ -1,37 +1,60 @@
 #pragma once
 
-#include <vector>
+#include <functional>
 #include <stdexcept>
 #include <string>
+#include <unordered_set>
 #include "ast.h"
 #include "lexer.h"
+#include "token_stream.h"
 
 class ParseError : public std::runtime_error {
 public:
-    ParseError(const std::string &message) : std::runtime_error(message) {}
+    ParseError(const std::string &message, SourceLocation location)
+            : std::runtime_error(message), location(location) {}
+
+    SourceLocation location;
 };
 
 class Parser {
 public:
-    explicit Parser(std::vector<Token> tokens);
+    Parser(TokenStream &tokens, Arena &arena);
+
+    void onFunction(std::function<void(Function *)> callback) { m_on_function = std::move(callback); }
+
+    Program *parse();
 
-    std::unique_ptr<Program> parse();
+    Function *next();
 
 private:
-    std::vector<Token> m_tokens;
-    size_t m_position;
+    TokenStream &m_tokens;
+    Arena &m_arena;
+    std::function<void(Function *)> m_on_function;
+    std::unordered_set<std::string> m_names;  // Functions defined so far
+
+    Function *parseFunction();
+
+    Statement *parseStatement();
 
-    std::unique_ptr<Function> parseFunction();
+    Exp *parseExp(int min_precedence = 0);
 
-    std::unique_ptr<Statement> parseStatement();
+    Exp *parseFactor();
 
-    std::unique_ptr<Exp> parseExp();
+    Constant *parseConstant(const Token &token);
+
+    static bool binaryOperator(TokenType type, BinaryOperator &op);
+
+    static int precedence(BinaryOperator op);
 
     void expect(TokenType type);
 
     Token consumeToken();
 
+    const Token *peek();
+
     bool match(TokenType type);
 
+    SourceLocation currentLocation();
+
     std::string tokenTypeToString(TokenType type) const;
 };
\ No newline at end of file
@@ -0,0 +1,632 @@
+#include "peephole.h"
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+#include "sparse_set.h"
+
+namespace {
+
+    using assembly::Instruction;
+    using assembly::Operand;
+    using InstructionList = std::vector<std::unique_ptr<Instruction>>;
+
+    /**
+     * @brief Returns whether two operands name the same location (or the same immediate).
+     *
+     * @details Registers compare by number, so `%eax` and `%al` alias.
+     */
+    bool sameLocation(const Operand &a, const Operand &b) {
+        if (a.kind != b.kind) {
+            return false;
+        }
+        switch (a.kind) {
+            case Operand::Kind::Imm:
+                return static_cast<const assembly::Imm &>(a).value == static_cast<const assembly::Imm &>(b).value;
+            case Operand::Kind::Register:
+                return static_cast<const assembly::Register &>(a).number ==
+                       static_cast<const assembly::Register &>(b).number;
+            case Operand::Kind::Pseudo:
+                return static_cast<const assembly::Pseudo &>(a).id == static_cast<const assembly::Pseudo &>(b).id;
+            case Operand::Kind::Stack:
+                return static_cast<const assembly::Stack &>(a).offset ==
+                       static_cast<const assembly::Stack &>(b).offset;
+        }
+        return false;
+    }
+
+    bool isRegister(const Operand &operand, uint8_t number) {
+        return operand.kind == Operand::Kind::Register &&
+               static_cast<const assembly::Register &>(operand).number == number;
+    }
+
+    /**
+     * @brief Returns whether an instruction reads the location, including implicit register uses.
+     *
+     * @details `setcc` counts as a read because it leaves the upper bytes of its operand unchanged.
+     */
+    bool reads(const Instruction &instruction, const Operand &location) {
+        switch (instruction.kind) {
+            case Instruction::Kind::Mov:
+                return sameLocation(*static_cast<const assembly::Mov &>(instruction).src, location);
+            case Instruction::Kind::Unary:
+                return sameLocation(*static_cast<const assembly::Unary &>(instruction).operand, location);
+            case Instruction::Kind::Binary: {
+                const auto &binary = static_cast<const assembly::Binary &>(instruction);
+                if (binary.op == assembly::BinaryOp::Xor && sameLocation(*binary.src, *binary.dst)) {
+                    return false;  // The zero idiom does not depend on the old value
+                }
+                return sameLocation(*binary.src, location) || sameLocation(*binary.dst, location);
+            }
+            case Instruction::Kind::Cmp: {
+                const auto &cmp = static_cast<const assembly::Cmp &>(instruction);
+                return sameLocation(*cmp.src, location) || sameLocation(*cmp.dst, location);
+            }
+            case Instruction::Kind::Idiv:
+                return sameLocation(*static_cast<const assembly::Idiv &>(instruction).operand, location) ||
+                       isRegister(location, x86::AX) || isRegister(location, x86::DX);
+            case Instruction::Kind::Cdq:
+                return isRegister(location, x86::AX);
+            case Instruction::Kind::SetCC:
+                return sameLocation(*static_cast<const assembly::SetCC &>(instruction).operand, location);
+            case Instruction::Kind::Ret:
+                return isRegister(location, x86::AX);
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * @brief Returns whether an instruction overwrites all of the location.
+     */
+    bool writes(const Instruction &instruction, const Operand &location) {
+        switch (instruction.kind) {
+            case Instruction::Kind::Mov:
+                return sameLocation(*static_cast<const assembly::Mov &>(instruction).dst, location);
+            case Instruction::Kind::Unary:
+                return sameLocation(*static_cast<const assembly::Unary &>(instruction).operand, location);
+            case Instruction::Kind::Binary:
+                return sameLocation(*static_cast<const assembly::Binary &>(instruction).dst, location);
+            case Instruction::Kind::Idiv:
+                return isRegister(location, x86::AX) || isRegister(location, x86::DX);
+            case Instruction::Kind::Cdq:
+                return isRegister(location, x86::DX);
+            default:
+                return false;
+        }
+    }
+
+    constexpr uint32_t kNoLocation = UINT32_MAX;
+
+    /**
+     * Which registers, stack slots and pseudos may still be read, computed once for a function by backward
+     * dataflow over its basic blocks. Within a block a caller refines it by walking backwards from the block's
+     * live-out set, applying `step` to each instruction.
+     *
+     * The rules reset instructions while they consult it. They only remove writes nobody reads and the reads of
+     * such values, which cannot make a location live anywhere it was not, so the answers stay safe.
+     */
+    class Liveness {
+    public:
+        explicit Liveness(const InstructionList &instructions);
+
+        uint32_t locationCount() const { return m_location_count; }
+
+        uint32_t locationOf(const Operand &operand) const;
+
+        size_t blockCount() const { return m_blocks.size(); }
+
+        size_t blockBegin(size_t block) const { return m_blocks[block].begin; }
+
+        size_t blockEnd(size_t block) const { return m_blocks[block].end; }
+
+        size_t blockOf(size_t index) const { return m_block_of[index]; }
+
+        bool liveOut(size_t block, uint32_t location) const;
+
+        void liveOut(size_t block, SparseSet &live) const;
+
+        void step(size_t index, SparseSet &live) const;
+
+    private:
+        struct Access {
+            uint32_t uses[3];
+            uint32_t defs[2];
+            uint8_t use_count = 0;
+            uint8_t def_count = 0;
+
+            void use(uint32_t location) {
+                if (location != kNoLocation) uses[use_count++] = location;
+            }
+
+            void def(uint32_t location) {
+                if (location != kNoLocation) defs[def_count++] = location;
+            }
+        };
+
+        struct Block {
+            size_t begin;
+            size_t end;
+            std::vector<size_t> successors;
+            std::vector<uint32_t> live_in;  // Sorted
+        };
+
+        uint32_t addLocation(const Operand &operand);
+
+        Access accessOf(const Instruction &instruction);
+
+        static uint64_t key(const Operand &operand);
+
+        uint32_t m_location_count = 16;  // Ids below 16 are the hard registers, by number
+        std::unordered_map<uint64_t, uint32_t> m_locations;
+        std::vector<Access> m_access;
+        std::vector<Block> m_blocks;
+        std::vector<uint32_t> m_block_of;
+    };
+
+    Liveness::Liveness(const InstructionList &instructions) {
+        m_access.reserve(instructions.size());
+        for (const auto &instruction: instructions) {
+            m_access.push_back(accessOf(*instruction));
+        }
+
+        // Split into basic blocks, as the register allocator does
+        std::unordered_map<std::string_view, size_t> label_blocks;
+        size_t begin = 0;
+        for (size_t i = 0; i < instructions.size(); ++i) {
+            auto kind = instructions[i]->kind;
+            if (kind == Instruction::Kind::Label && i != begin) {
+                m_blocks.push_back({begin, i, {}, {}});
+                begin = i;
+            }
+            if (kind == Instruction::Kind::Label) {
+                label_blocks[static_cast<const assembly::Label &>(*instructions[i]).name] = m_blocks.size();
+            }
+            if (kind == Instruction::Kind::Jmp || kind == Instruction::Kind::JmpCC || kind == Instruction::Kind::Ret) {
+                m_blocks.push_back({begin, i + 1, {}, {}});
+                begin = i + 1;
+            }
+        }
+        if (begin < instructions.size()) {
+            m_blocks.push_back({begin, instructions.size(), {}, {}});
+        }
+        m_block_of.resize(instructions.size());
+        for (size_t b = 0; b < m_blocks.size(); ++b) {
+            Block &block = m_blocks[b];
+            std::fill(m_block_of.begin() + static_cast<std::ptrdiff_t>(block.begin),
+                      m_block_of.begin() + static_cast<std::ptrdiff_t>(block.end), static_cast<uint32_t>(b));
+            const Instruction &last = *instructions[block.end - 1];
+            if (last.kind == Instruction::Kind::Jmp) {
+                block.successors.push_back(label_blocks.at(static_cast<const assembly::Jmp &>(last).label));
+            } else if (last.kind != Instruction::Kind::Ret) {
+                if (last.kind == Instruction::Kind::JmpCC) {
+                    block.successors.push_back(label_blocks.at(static_cast<const assembly::JmpCC &>(last).label));
+                }
+                if (b + 1 < m_blocks.size()) {
+                    block.successors.push_back(b + 1);
+                }
+            }
+        }
+
+        // Backward dataflow to a fixed point. Live sets at block boundaries are small, so they are kept as
+        // sorted vectors; only the set being walked is a SparseSet over every location.
+        SparseSet live(m_location_count);
+        std::vector<uint32_t> live_in;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t b = m_blocks.size(); b-- > 0;) {
+                liveOut(b, live);
+                for (size_t i = m_blocks[b].end; i-- > m_blocks[b].begin;) {
+                    step(i, live);
+                }
+                live_in = live.members();
+                std::sort(live_in.begin(), live_in.end());
+                if (live_in != m_blocks[b].live_in) {
+                    m_blocks[b].live_in.swap(live_in);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the location id of a register, stack slot or pseudo, or kNoLocation for an immediate or a
+     *        location the function never mentions.
+     */
+    uint32_t Liveness::locationOf(const Operand &operand) const {
+        if (operand.kind == Operand::Kind::Register) {
+            return static_cast<const assembly::Register &>(operand).number;
+        }
+        if (operand.kind == Operand::Kind::Imm) {
+            return kNoLocation;
+        }
+        auto it = m_locations.find(key(operand));
+        return it == m_locations.end() ? kNoLocation : it->second;
+    }
+
+    /** @brief Returns whether `location` may be read after the last instruction of `block`. */
+    bool Liveness::liveOut(size_t block, uint32_t location) const {
+        return std::any_of(m_blocks[block].successors.begin(), m_blocks[block].successors.end(), [&](size_t b) {
+            return std::binary_search(m_blocks[b].live_in.begin(), m_blocks[b].live_in.end(), location);
+        });
+    }
+
+    /** @brief Replaces the contents of `live` with the locations that may be read after `block`. */
+    void Liveness::liveOut(size_t block, SparseSet &live) const {
+        live.clear();
+        for (size_t successor: m_blocks[block].successors) {
+            for (uint32_t location: m_blocks[successor].live_in) {
+                live.insert(location);
+            }
+        }
+    }
+
+    /** @brief Turns the locations live after instruction `index` into those live before it. */
+    void Liveness::step(size_t index, SparseSet &live) const {
+        const Access &access = m_access[index];
+        for (int d = 0; d < access.def_count; ++d) live.erase(access.defs[d]);
+        for (int u = 0; u < access.use_count; ++u) live.insert(access.uses[u]);
+    }
+
+    uint32_t Liveness::addLocation(const Operand &operand) {
+        if (operand.kind != Operand::Kind::Stack && operand.kind != Operand::Kind::Pseudo) {
+            return locationOf(operand);
+        }
+        auto [it, inserted] = m_locations.try_emplace(key(operand), m_location_count);
+        if (inserted) {
+            ++m_location_count;
+        }
+        return it->second;
+    }
+
+    uint64_t Liveness::key(const Operand &operand) {
+        uint32_t value = operand.kind == Operand::Kind::Stack
+                         ? static_cast<uint32_t>(static_cast<const assembly::Stack &>(operand).offset)
+                         : static_cast<const assembly::Pseudo &>(operand).id;
+        return uint64_t{static_cast<uint8_t>(operand.kind)} << 32 | value;
+    }
+
+    /**
+     * @brief Lists the locations an instruction reads and overwrites; the same rules as `reads` and `writes`.
+     */
+    Liveness::Access Liveness::accessOf(const Instruction &instruction) {
+        Access access;
+        switch (instruction.kind) {
+            case Instruction::Kind::Mov: {
+                const auto &mov = static_cast<const assembly::Mov &>(instruction);
+                access.use(addLocation(*mov.src));
+                access.def(addLocation(*mov.dst));
+                break;
+            }
+            case Instruction::Kind::Unary: {
+                uint32_t location = addLocation(*static_cast<const assembly::Unary &>(instruction).operand);
+                access.use(location);
+                access.def(location);
+                break;
+            }
+            case Instruction::Kind::Binary: {
+                const auto &binary = static_cast<const assembly::Binary &>(instruction);
+                uint32_t src = addLocation(*binary.src);
+                uint32_t dst = addLocation(*binary.dst);
+                if (!(binary.op == assembly::BinaryOp::Xor && sameLocation(*binary.src, *binary.dst))) {
+                    access.use(src);
+                    access.use(dst);
+                }
+                access.def(dst);
+                break;
+            }
+            case Instruction::Kind::Cmp: {
+                const auto &cmp = static_cast<const assembly::Cmp &>(instruction);
+                access.use(addLocation(*cmp.src));
+                access.use(addLocation(*cmp.dst));
+                break;
+            }
+            case Instruction::Kind::Idiv:
+                access.use(addLocation(*static_cast<const assembly::Idiv &>(instruction).operand));
+                access.use(x86::AX);
+                access.use(x86::DX);
+                access.def(x86::AX);
+                access.def(x86::DX);
+                break;
+            case Instruction::Kind::Cdq:
+                access.use(x86::AX);
+                access.def(x86::DX);
+                break;
+            case Instruction::Kind::SetCC:
+                // Only the low byte is written, so the rest of the old value survives
+                access.use(addLocation(*static_cast<const assembly::SetCC &>(instruction).operand));
+                break;
+            case Instruction::Kind::Ret:
+                access.use(x86::AX);
+                break;
+            default:
+                break;
+        }
+        return access;
+    }
+
+    /**
+     * @brief Returns whether the condition flags set before instruction `index + 1` may still be consumed.
+     */
+    bool flagsLiveAfter(const InstructionList &instructions, size_t index) {
+        for (size_t j = index + 1; j < instructions.size(); ++j) {
+            switch (instructions[j]->kind) {
+                case Instruction::Kind::SetCC:
+                case Instruction::Kind::JmpCC:
+                case Instruction::Kind::Jmp:
+                case Instruction::Kind::Label:
+                    return true;
+                case Instruction::Kind::Cmp:
+                case Instruction::Kind::Binary:
+                case Instruction::Kind::Idiv:
+                case Instruction::Kind::LeaveFrame:
+                case Instruction::Kind::Ret:
+                    return false;
+                case Instruction::Kind::Unary:
+                    if (static_cast<const assembly::Unary &>(*instructions[j]).op == assembly::UnaryOp::Neg) {
+                        return false;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return false;
+    }
+
+    x86::Condition invert(x86::Condition condition) {
+        return static_cast<x86::Condition>(static_cast<uint8_t>(condition) ^ 1);
+    }
+
+    const assembly::Mov *asMov(const std::unique_ptr<Instruction> &instruction) {
+        return instruction && instruction->kind == Instruction::Kind::Mov
+               ? static_cast<const assembly::Mov *>(instruction.get()) : nullptr;
+    }
+
+    bool isImm(const Operand &operand, int value) {
+        return operand.kind == Operand::Kind::Imm && static_cast<const assembly::Imm &>(operand).value == value;
+    }
+
+    void compact(InstructionList &instructions) {
+        std::erase(instructions, nullptr);
+    }
+
+} // namespace
+
+std::string_view Peephole::ruleName(Rule rule) {
+    switch (rule) {
+        case Rule::RedundantMov:
+            return "redundant-mov";
+        case Rule::MemoryBounce:
+            return "memory-bounce";
+        case Rule::DeadMov:
+            return "dead-mov";
+        case Rule::ZeroIdiom:
+            return "zero-idiom";
+        case Rule::BranchFusion:
+            return "branch-fusion";
+        case Rule::Count:
+            break;
+    }
+    return {};
+}
+
+/**
+ * @brief Parses a comma-separated list of rule names.
+ *
+ * @param list The rule names, e.g. `dead-mov,zero-idiom`.
+ * @param rules Receives the enabled-rule mask.
+ * @return `false` if the list names an unknown rule.
+ */
+bool Peephole::parseRules(const std::string &list, uint32_t &rules) {
+    rules = 0;
+    std::istringstream stream(list);
+    std::string name;
+    while (std::getline(stream, name, ',')) {
+        bool found = false;
+        for (size_t i = 0; i < kRuleCount; ++i) {
+            if (name == ruleName(static_cast<Rule>(i))) {
+                rules |= 1u << i;
+                found = true;
+            }
+        }
+        if (!found && !name.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Peephole::run(assembly::Program &program) {
+    for (auto &function: program.functions) {
+        run(*function);
+    }
+}
+
+/**
+ * @brief Applies the enabled rules to one function until none of them fires any more.
+ *
+ * @details Branch fusion runs first since the move rules would otherwise break up the compare/setcc pattern,
+ *          and the zero idiom runs last since it turns moves into instructions the other rules do not track.
+ */
+void Peephole::run(assembly::Function &function) {
+    auto &instructions = function.instructions;
+    for (int round = 0; round < 8; ++round) {
+        size_t changes = 0;
+        if (enabled(Rule::BranchFusion)) changes += fuseBranches(instructions);
+        if (enabled(Rule::RedundantMov)) changes += removeRedundantMoves(instructions);
+        if (enabled(Rule::MemoryBounce)) changes += forwardStores(instructions);
+        if (enabled(Rule::DeadMov)) changes += removeDeadMoves(instructions);
+        if (changes == 0) {
+            break;
+        }
+    }
+    if (enabled(Rule::ZeroIdiom)) {
+        useZeroIdiom(instructions);
+    }
+}
+
+/**
+ * @brief Replaces a materialised comparison that only feeds a branch with a direct conditional jump.
+ *
+ * @details Matches `cmp; mov $0, t; setcc t; cmp $0, t; je/jne L` where `t` is not read afterwards, and keeps
+ *          only the first compare and a jump on the (possibly inverted) original condition.
+ */
+size_t Peephole::fuseBranches(InstructionList &instructions) {
+    Liveness liveness(instructions);
+    size_t count = 0;
+    for (size_t i = 0; i + 4 < instructions.size(); ++i) {
+        if (instructions[i]->kind != Instruction::Kind::Cmp) continue;
+        const assembly::Mov *zero = asMov(instructions[i + 1]);
+        if (!zero || !isImm(*zero->src, 0)) continue;
+        if (instructions[i + 2]->kind != Instruction::Kind::SetCC) continue;
+        const auto &setcc = static_cast<const assembly::SetCC &>(*instructions[i + 2]);
+        if (instructions[i + 3]->kind != Instruction::Kind::Cmp) continue;
+        const auto &test = static_cast<const assembly::Cmp &>(*instructions[i + 3]);
+        if (instructions[i + 4]->kind != Instruction::Kind::JmpCC) continue;
+        auto &jump = static_cast<assembly::JmpCC &>(*instructions[i + 4]);
+
+        const Operand &flag = *zero->dst;
+        if (!sameLocation(*setcc.operand, flag) || !isImm(*test.src, 0) || !sameLocation(*test.dst, flag)) continue;
+        if (jump.condition != x86::Condition::E && jump.condition != x86::Condition::NE) continue;
+        uint32_t location = liveness.locationOf(flag);
+        if (location != kNoLocation && liveness.liveOut(liveness.blockOf(i + 4), location)) continue;
+
+        jump.condition = jump.condition == x86::Condition::NE ? setcc.condition : invert(setcc.condition);
+        instructions[i + 1].reset();
+        instructions[i + 2].reset();
+        instructions[i + 3].reset();
+        i += 4;
+        hit(Rule::BranchFusion);
+        ++count;
+    }
+    compact(instructions);
+    return count;
+}
+
+/**
+ * @brief Removes self-moves and the second move of a `mov a, b; mov b, a` pair.
+ */
+size_t Peephole::removeRedundantMoves(InstructionList &instructions) {
+    size_t count = 0;
+    const assembly::Mov *previous = nullptr;
+    for (auto &instruction: instructions) {
+        const assembly::Mov *mov = asMov(instruction);
+        if (mov && (sameLocation(*mov->src, *mov->dst) ||
+                    (previous && sameLocation(*previous->src, *mov->dst) &&
+                     sameLocation(*previous->dst, *mov->src)))) {
+            instruction.reset();
+            hit(Rule::RedundantMov);
+            ++count;
+            continue;
+        }
+        previous = mov;
+    }
+    compact(instructions);
+    return count;
+}
+
+/**
+ * @brief Serves reloads of a stack slot from the register that was last stored to, or loaded from, it.
+ *
+ * @details Code generation bounces every memory-to-memory move through a scratch register, so a chain of
+ *          copies reloads each slot it just wrote. Tracking which register mirrors which slot within a basic
+ *          block turns `mov A, %r10d; mov %r10d, B; mov B, %r10d; mov %r10d, C` into a single bounce, and lets
+ *          the dead-move rule drop `B` if nothing else reads it.
+ */
+size_t Peephole::forwardStores(InstructionList &instructions) {
+    struct Mirror {
+        int offset;
+        uint8_t reg;
+    };
+    std::vector<Mirror> mirrors;
+    auto forget = [&mirrors](const Instruction &instruction) {
+        std::erase_if(mirrors, [&instruction](const Mirror &mirror) {
+            assembly::Stack slot(mirror.offset);
+            assembly::Register reg(mirror.reg);
+            // setcc only writes one byte, which still breaks the copy
+            bool partial = instruction.kind == Instruction::Kind::SetCC;
+            return writes(instruction, slot) || writes(instruction, reg) ||
+                   (partial && (reads(instruction, slot) || reads(instruction, reg)));
+        });
+    };
+
+    size_t count = 0;
+    for (auto &instruction: instructions) {
+        if (instruction->kind == Instruction::Kind::Label) {
+            mirrors.clear();
+            continue;
+        }
+        auto *mov = instruction->kind == Instruction::Kind::Mov ? static_cast<assembly::Mov *>(instruction.get())
+                                                                 : nullptr;
+        if (mov && mov->src->kind == Operand::Kind::Stack && mov->dst->kind == Operand::Kind::Register) {
+            int offset = static_cast<const assembly::Stack &>(*mov->src).offset;
+            auto mirror = std::find_if(mirrors.begin(), mirrors.end(),
+                                       [offset](const Mirror &m) { return m.offset == offset; });
+            if (mirror != mirrors.end()) {
+                if (mirror->reg == static_cast<const assembly::Register &>(*mov->dst).number) {
+                    instruction.reset();
+                    hit(Rule::MemoryBounce);
+                    ++count;
+                    continue;
+                }
+                mov->src = std::make_unique<assembly::Register>(mirror->reg);
+                hit(Rule::MemoryBounce);
+                ++count;
+            }
+        }
+        forget(*instruction);
+        if (mov && mov->dst->kind == Operand::Kind::Stack && mov->src->kind == Operand::Kind::Register) {
+            mirrors.push_back({static_cast<const assembly::Stack &>(*mov->dst).offset,
+                               static_cast<const assembly::Register &>(*mov->src).number});
+        } else if (mov && mov->src->kind == Operand::Kind::Stack && mov->dst->kind == Operand::Kind::Register) {
+            mirrors.push_back({static_cast<const assembly::Stack &>(*mov->src).offset,
+                               static_cast<const assembly::Register &>(*mov->dst).number});
+        }
+    }
+    compact(instructions);
+    return count;
+}
+
+/**
+ * @brief Removes moves whose destination is overwritten or abandoned before anything reads it.
+ */
+size_t Peephole::removeDeadMoves(InstructionList &instructions) {
+    Liveness liveness(instructions);
+    SparseSet live(liveness.locationCount());
+    size_t count = 0;
+    for (size_t b = 0; b < liveness.blockCount(); ++b) {
+        liveness.liveOut(b, live);
+        for (size_t i = liveness.blockEnd(b); i-- > liveness.blockBegin(b);) {
+            const assembly::Mov *mov = asMov(instructions[i]);
+            if (mov && !live.contains(liveness.locationOf(*mov->dst))) {
+                // Its source is not read either, which may make an earlier move dead in the same walk
+                instructions[i].reset();
+                hit(Rule::DeadMov);
+                ++count;
+                continue;
+            }
+            liveness.step(i, live);
+        }
+    }
+    compact(instructions);
+    return count;
+}
+
+/**
+ * @brief Rewrites `movl $0, %reg` as the shorter `xorl %reg, %reg` where nothing consumes the flags it clobbers.
+ */
+size_t Peephole::useZeroIdiom(InstructionList &instructions) {
+    size_t count = 0;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        const assembly::Mov *mov = asMov(instructions[i]);
+        if (!mov || !isImm(*mov->src, 0) || mov->dst->kind != Operand::Kind::Register ||
+            flagsLiveAfter(instructions, i)) {
+            continue;
+        }
+        instructions[i] = std::make_unique<assembly::Binary>(assembly::BinaryOp::Xor, mov->dst->clone(),
+                                                             mov->dst->clone());
+        hit(Rule::ZeroIdiom);
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "assembly_ast.h"
+
+/**
+ * Local rewrites over each assembly::Function's instruction list, run after code generation and before the
+ * program is emitted or encoded. Each rule can be switched off on its own, and the pass counts how often each
+ * one fired.
+ */
+class Peephole {
+public:
+    enum class Rule : uint8_t {
+        RedundantMov,   // `mov a, b; mov b, a` and `mov a, a`
+        MemoryBounce,   // reload of a slot a register already holds
+        DeadMov,        // mov whose destination is never read
+        ZeroIdiom,      // `movl $0, %reg` -> `xorl %reg, %reg`
+        BranchFusion,   // cmp; setcc; cmp $0; jcc -> cmp; jcc
+        Count
+    };
+
+    static constexpr size_t kRuleCount = static_cast<size_t>(Rule::Count);
+    static constexpr uint32_t kAllRules = (1u << kRuleCount) - 1;
+
+    using Hits = std::array<size_t, kRuleCount>;
+
+    explicit Peephole(uint32_t enabled_rules = kAllRules) : m_enabled_rules(enabled_rules) {}
+
+    void run(assembly::Program &program);
+
+    void run(assembly::Function &function);
+
+    const Hits &hits() const { return m_hits; }
+
+    static std::string_view ruleName(Rule rule);
+
+    static bool parseRules(const std::string &list, uint32_t &rules);
+
+private:
+    using InstructionList = std::vector<std::unique_ptr<assembly::Instruction>>;
+
+    bool enabled(Rule rule) const { return m_enabled_rules & (1u << static_cast<unsigned>(rule)); }
+
+    void hit(Rule rule) { ++m_hits[static_cast<size_t>(rule)]; }
+
+    size_t fuseBranches(InstructionList &instructions);
+
+    size_t removeRedundantMoves(InstructionList &instructions);
+
+    size_t forwardStores(InstructionList &instructions);
+
+    size_t removeDeadMoves(InstructionList &instructions);
+
+    size_t useZeroIdiom(InstructionList &instructions);
+
+    uint32_t m_enabled_rules;
+    Hits m_hits{};
+};
@@ -0,0 +1,1369 @@
+#include "preprocessor.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <climits>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    const char *const kPunctuators[] = {
+            "%:%:", "...", "<<=", ">>=",
+            "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "*=", "/=", "%=", "+=", "-=", "&=",
+            "^=", "|=", "##", "<:", ":>", "<%", "%>", "%:"
+    };
+
+    bool isIdentifierStart(char c) {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isIdentifierChar(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isHorizontalSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    std::string directoryOf(const std::string &path) {
+        auto slash = path.find_last_of('/');
+        return slash == std::string::npos ? "." : path.substr(0, slash);
+    }
+
+    bool isRegularFile(const std::string &path) {
+        struct stat st{};
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    /**
+     * A value in a preprocessor expression: intmax_t or uintmax_t, both 64 bits here. The bits are kept as
+     * unsigned, so wrapping is defined; `is_unsigned` says how to compare, divide, shift right and print them.
+     */
+    struct PPValue {
+        uint64_t bits = 0;
+        bool is_unsigned = false;
+
+        static PPValue fromSigned(int64_t value) { return {static_cast<uint64_t>(value), false}; }
+
+        int64_t asSigned() const { return static_cast<int64_t>(bits); }
+
+        std::string toString() const { return is_unsigned ? std::to_string(bits) : std::to_string(asSigned()); }
+    };
+
+    /**
+     * Evaluates the controlling expression of #if/#elif once `defined` has been resolved, macros have been
+     * expanded and the remaining identifiers have been replaced by 0. As in C, an operation on a signed and an
+     * unsigned operand is done in unsigned arithmetic, so `1u > -1` is false.
+     */
+    class ConditionParser {
+    public:
+        struct Item {
+            bool is_value;
+            PPValue value;
+            std::string op;
+        };
+
+        explicit ConditionParser(std::vector<Item> items) : m_items(std::move(items)) {}
+
+        PPValue parse() {
+            PPValue value = parseConditional();
+            if (m_position != m_items.size()) {
+                throw std::runtime_error("Missing binary operator before '" + describe(m_items[m_position]) + "'");
+            }
+            return value;
+        }
+
+    private:
+        std::vector<Item> m_items;
+        size_t m_position = 0;
+
+        static std::string describe(const Item &item) {
+            return item.is_value ? item.value.toString() : item.op;
+        }
+
+        bool peekOp(const char *op) const {
+            return m_position < m_items.size() && !m_items[m_position].is_value && m_items[m_position].op == op;
+        }
+
+        bool matchOp(const char *op) {
+            if (peekOp(op)) {
+                ++m_position;
+                return true;
+            }
+            return false;
+        }
+
+        void expectOp(const char *op) {
+            if (!matchOp(op)) {
+                throw std::runtime_error(std::string("Expected '") + op + "' in preprocessor expression");
+            }
+        }
+
+        PPValue parseConditional() {
+            PPValue condition = parseBinary(0);
+            if (matchOp("?")) {
+                PPValue if_true = parseConditional();
+                expectOp(":");
+                PPValue if_false = parseConditional();
+                // The result has the common type of both arms, whichever is chosen
+                PPValue result = condition.bits ? if_true : if_false;
+                result.is_unsigned = if_true.is_unsigned || if_false.is_unsigned;
+                return result;
+            }
+            return condition;
+        }
+
+        static int precedence(const std::string &op) {
+            static const std::pair<const char *, int> table[] = {
+                    {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5}, {"==", 6}, {"!=", 6}, {"<", 7}, {">", 7},
+                    {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8}, {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10}
+            };
+            for (const auto &[name, level]: table) {
+                if (op == name) return level;
+            }
+            return -1;
+        }
+
+        PPValue parseBinary(int min_precedence) {
+            PPValue lhs = parseUnary();
+            while (m_position < m_items.size() && !m_items[m_position].is_value) {
+                std::string op = m_items[m_position].op;
+                int level = precedence(op);
+                if (level < 0 || level < min_precedence) break;
+                ++m_position;
+                PPValue rhs = parseBinary(level + 1);
+                lhs = apply(op, lhs, rhs);
+            }
+            return lhs;
+        }
+
+        static PPValue truth(bool value) { return {value, false}; }
+
+        static PPValue apply(const std::string &op, PPValue lhs, PPValue rhs) {
+            if (op == "||") return truth(lhs.bits || rhs.bits);
+            if (op == "&&") return truth(lhs.bits && rhs.bits);
+            // A shift has the type of its left operand; the count does not convert it
+            if (op == "<<") return {lhs.bits << (rhs.bits & 63), lhs.is_unsigned};
+            if (op == ">>") {
+                return lhs.is_unsigned ? PPValue{lhs.bits >> (rhs.bits & 63), true}
+                                       : PPValue::fromSigned(lhs.asSigned() >> (rhs.bits & 63));
+            }
+
+            // The usual arithmetic conversions: unsigned if either operand is
+            bool is_unsigned = lhs.is_unsigned || rhs.is_unsigned;
+            uint64_t a = lhs.bits;
+            uint64_t b = rhs.bits;
+            if (op == "==") return truth(a == b);
+            if (op == "!=") return truth(a != b);
+            if (op == "<") return truth(is_unsigned ? a < b : lhs.asSigned() < rhs.asSigned());
+            if (op == ">") return truth(is_unsigned ? a > b : lhs.asSigned() > rhs.asSigned());
+            if (op == "<=") return truth(is_unsigned ? a <= b : lhs.asSigned() <= rhs.asSigned());
+            if (op == ">=") return truth(is_unsigned ? a >= b : lhs.asSigned() >= rhs.asSigned());
+            if (op == "|") return {a | b, is_unsigned};
+            if (op == "^") return {a ^ b, is_unsigned};
+            if (op == "&") return {a & b, is_unsigned};
+            if (op == "+") return {a + b, is_unsigned};
+            if (op == "-") return {a - b, is_unsigned};
+            if (op == "*") return {a * b, is_unsigned};
+            if (b == 0) {
+                throw std::runtime_error("Division by zero in preprocessor expression");
+            }
+            if (is_unsigned) {
+                return {op == "/" ? a / b : a % b, true};
+            }
+            int64_t x = lhs.asSigned();
+            int64_t y = rhs.asSigned();
+            if (x == INT64_MIN && y == -1) return PPValue::fromSigned(op == "/" ? x : 0);
+            return PPValue::fromSigned(op == "/" ? x / y : x % y);
+        }
+
+        PPValue parseUnary() {
+            if (m_position >= m_items.size()) {
+                throw std::runtime_error("Unexpected end of preprocessor expression");
+            }
+            const Item &item = m_items[m_position++];
+            if (item.is_value) return item.value;
+            if (item.op == "(") {
+                PPValue value = parseConditional();
+                expectOp(")");
+                return value;
+            }
+            if (item.op == "+") return parseUnary();
+            if (item.op == "-") {
+                PPValue value = parseUnary();
+                return {0 - value.bits, value.is_unsigned};
+            }
+            if (item.op == "~") {
+                PPValue value = parseUnary();
+                return {~value.bits, value.is_unsigned};
+            }
+            if (item.op == "!") return truth(!parseUnary().bits);
+            throw std::runtime_error("Unexpected '" + item.op + "' in preprocessor expression");
+        }
+    };
+
+    /**
+     * @brief Reads an integer constant, which is unsigned if it has a `u` suffix or does not fit in intmax_t.
+     */
+    PPValue parseIntegerLiteral(const std::string &text) {
+        std::string digits = text;
+        bool is_unsigned = false;
+        while (!digits.empty() && std::strchr("uUlL", digits.back())) {
+            is_unsigned |= digits.back() == 'u' || digits.back() == 'U';
+            digits.pop_back();
+        }
+        int base = 10;
+        size_t start = 0;
+        if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+            base = 16;
+            start = 2;
+        } else if (digits.size() > 2 && digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B')) {
+            base = 2;
+            start = 2;
+        } else if (digits.size() > 1 && digits[0] == '0') {
+            base = 8;
+            start = 1;
+        }
+        uint64_t value = 0;
+        for (size_t i = start; i < digits.size(); ++i) {
+            char c = static_cast<char>(std::tolower(static_cast<unsigned char>(digits[i])));
+            int digit = std::isdigit(static_cast<unsigned char>(c)) ? c - '0'
+                                                                    : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : 99;
+            if (digit >= base) {
+                throw std::runtime_error("Invalid integer constant '" + text + "' in preprocessor expression");
+            }
+            value = value * base + digit;
+        }
+        return {value, is_unsigned || value > static_cast<uint64_t>(INT64_MAX)};
+    }
+
+    int64_t parseCharLiteral(const std::string &text) {
+        size_t quote = text.find('\'');
+        if (quote == std::string::npos || quote + 2 >= text.size()) {
+            throw std::runtime_error("Invalid character constant " + text);
+        }
+        size_t i = quote + 1;
+        if (text[i] != '\\') {
+            return static_cast<unsigned char>(text[i]);
+        }
+        char escape = text[i + 1];
+        switch (escape) {
+            case 'n': return '\n';
+            case 't': return '\t';
+            case 'r': return '\r';
+            case 'a': return '\a';
+            case 'b': return '\b';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            case 'x':
+                return std::stoll(text.substr(i + 2, text.size() - i - 3), nullptr, 16);
+            default:
+                if (escape >= '0' && escape <= '7') {
+                    return std::stoll(text.substr(i + 1, text.size() - i - 2), nullptr, 8);
+                }
+                return static_cast<unsigned char>(escape);
+        }
+    }
+
+} // namespace
+
+Preprocessor::Preprocessor(PreprocessorOptions options, IncludeCache *cache)
+        : m_options(std::move(options)), m_cache(cache) {
+    static const std::pair<const char *, const char *> predefined[] = {
+            {"__STDC__", "1"}, {"__STDC_VERSION__", "201710L"}, {"__STDC_HOSTED__", "1"}, {"__x86_64__", "1"},
+            {"__x86_64", "1"}, {"__linux__", "1"}, {"__linux", "1"}, {"__unix__", "1"}, {"__unix", "1"},
+            {"__LP64__", "1"}, {"_LP64", "1"}, {"__CHAR_BIT__", "8"}, {"__mcc__", "1"}
+    };
+    for (const auto &[name, value]: predefined) {
+        defineFromCommandLine(name, value);
+    }
+    for (const auto &[name, value]: m_options.defines) {
+        defineFromCommandLine(name, value);
+    }
+    for (const auto &name: m_options.undefines) {
+        m_macros.erase(name);
+    }
+}
+
+/**
+ * @brief Preprocesses a source file.
+ *
+ * @param path The path of the main source file.
+ * @return The preprocessed translation unit.
+ * @throws PreprocessError on malformed directives, missing includes or #error.
+ */
+std::string Preprocessor::preprocess(const std::string &path) {
+    m_output.clear();
+    m_output.reserve(64 * 1024);
+    m_output_line = 1;
+    m_line_marks.clear();
+    m_at_line_start = true;
+    m_last_char = '\n';
+    processFile(path, 0);
+    return std::move(m_output);
+}
+
+/**
+ * @brief Defines a macro from a `-D` style name and replacement text.
+ */
+void Preprocessor::defineFromCommandLine(const std::string &name, const std::string &value) {
+    std::vector<PPToken> tokens;
+    tokenizeLine(name + " " + value, 0, tokens);
+    m_file_stack.push_back({"<command line>", ".", 0});
+    handleDefine(tokens);
+    m_file_stack.pop_back();
+}
+
+[[noreturn]] void Preprocessor::error(const std::string &message) const {
+    if (m_file_stack.empty()) {
+        throw PreprocessError(message, "<command line>", 0);
+    }
+    throw PreprocessError(message, m_file_stack.back().path, m_file_stack.back().line);
+}
+
+bool Preprocessor::isActive() const {
+    return m_conditionals.empty() || m_conditionals.back().active;
+}
+
+/**
+ * @brief Reads a file through the mapped-file cache.
+ *
+ * @details Headers included several times are only mapped once per Preprocessor, and only once overall while
+ *          they are unchanged if the Preprocessor was given an IncludeCache. The buffers are held until the
+ *          Preprocessor is destroyed, so views into them stay valid even if the shared cache replaces them.
+ */
+std::string_view Preprocessor::readFile(const std::string &path) {
+    auto it = m_files.find(path);
+    if (it == m_files.end()) {
+        try {
+            auto buffer = m_cache ? m_cache->get(path)
+                                  : std::make_shared<const SourceBuffer>(SourceBuffer::mapFile(path));
+            it = m_files.emplace(path, std::move(buffer)).first;
+        } catch (const std::exception &e) {
+            error(e.what());
+        }
+    }
+    return it->second->text();
+}
+
+/**
+ * @brief Returns the mapping of a file, reusing the cached one if the file has not changed since it was mapped.
+ *
+ * @details Relative paths are keyed by the current directory as well, since a server's requests each run in
+ *          their client's directory.
+ *
+ * @param path The path of the file.
+ * @return The mapped file.
+ * @throws std::runtime_error if the file cannot be opened or mapped.
+ */
+std::shared_ptr<const SourceBuffer> IncludeCache::get(const std::string &path) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0) {
+        throw std::runtime_error("Unable to open file " + path);
+    }
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    std::string key = path;
+    if (key.empty() || key[0] != '/') {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd))) {
+            key = std::string(cwd) + "/" + path;
+        }
+    }
+    {
+        std::lock_guard lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end() && it->second.device == st.st_dev && it->second.inode == st.st_ino &&
+            it->second.size == st.st_size && it->second.mtime_ns == mtime_ns) {
+            return it->second.buffer;
+        }
+    }
+
+    // Map outside the lock; if two threads race on the same file, the last one's mapping is kept
+    auto buffer = std::make_shared<const SourceBuffer>(SourceBuffer::mapFile(path));
+    std::lock_guard lock(m_mutex);
+    m_entries[key] = {buffer, st.st_dev, st.st_ino, st.st_size, mtime_ns};
+    return buffer;
+}
+
+/**
+ * @brief Splits text into logical lines (translation phases 1-3), one at a time as the caller asks for them.
+ *
+ * @details Backslash-newline splices are removed and comments are replaced by spaces. Physical newlines
+ *          swallowed by splices or block comments are counted in `extra_newlines`, so the output can keep the
+ *          original line structure.
+ */
+Generator<Preprocessor::LogicalLine> Preprocessor::logicalLines(std::string_view text) {
+    LogicalLine current{{}, 1, 0};
+    uint32_t physical_line = 1;
+    size_t i = 0;
+    const size_t n = text.size();
+
+    auto isSplice = [&](size_t at) {
+        if (text[at] != '\\') return size_t{0};
+        if (at + 1 < n && text[at + 1] == '\n') return size_t{2};
+        if (at + 2 < n && text[at + 1] == '\r' && text[at + 2] == '\n') return size_t{3};
+        return size_t{0};
+    };
+
+    while (i < n) {
+        if (size_t splice = isSplice(i)) {
+            i += splice;
+            ++physical_line;
+            ++current.extra_newlines;
+            continue;
+        }
+        char c = text[i];
+        if (c == '\n') {
+            co_yield current;
+            ++physical_line;
+            // The consumer is done with the line by now, so its text buffer is kept for the next one
+            current.text.clear();
+            current.line = physical_line;
+            current.extra_newlines = 0;
+            ++i;
+            continue;
+        }
+        if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+            // Line comment: runs to the end of the logical line
+            while (i < n && text[i] != '\n') {
+                if (size_t splice = isSplice(i)) {
+                    i += splice;
+                    ++physical_line;
+                    ++current.extra_newlines;
+                } else {
+                    ++i;
+                }
+            }
+            current.text += ' ';
+            continue;
+        }
+        if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+            uint32_t comment_line = physical_line;
+            i += 2;
+            bool closed = false;
+            size_t width = 2;
+            bool multi_line = false;
+            while (i < n) {
+                if (text[i] == '*' && i + 1 < n && text[i + 1] == '/') {
+                    i += 2;
+                    width += 2;
+                    closed = true;
+                    break;
+                }
+                if (text[i] == '\n') {
+                    ++physical_line;
+                    ++current.extra_newlines;
+                    multi_line = true;
+                }
+                ++i;
+                ++width;
+            }
+            if (!closed) {
+                throw PreprocessError("Unterminated comment", "", comment_line);
+            }
+            // Keep columns stable for single-line comments; a multi-line comment is a single space
+            current.text.append(multi_line ? 1 : width, ' ');
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            char quote = c;
+            current.text += c;
+            ++i;
+            while (i < n && text[i] != '\n') {
+                if (size_t splice = isSplice(i)) {
+                    i += splice;
+                    ++physical_line;
+                    ++current.extra_newlines;
+                    continue;
+                }
+                current.text += text[i];
+                if (text[i] == '\\' && i + 1 < n && text[i + 1] != '\n') {
+                    current.text += text[i + 1];
+                    i += 2;
+                    continue;
+                }
+                ++i;
+                if (current.text.back() == quote) break;
+            }
+            continue;
+        }
+        // Copy up to the next character that could start a splice, a newline, a comment or a literal
+        size_t end = i + 1;
+        while (end < n && text[end] != '\\' && text[end] != '\n' && text[end] != '/' && text[end] != '"' &&
+               text[end] != '\'') {
+            ++end;
+        }
+        current.text.append(text.substr(i, end - i));
+        i = end;
+    }
+    if (!current.text.empty() || current.extra_newlines > 0) {
+        co_yield current;
+    }
+}
+
+/**
+ * @brief Splits a logical line into preprocessing tokens.
+ *
+ * @details Each token records how many whitespace characters preceded it so unexpanded text is emitted with
+ *          its original columns. Unterminated quotes are kept as a single `Other` token rather than rejected,
+ *          since they are legal inside skipped groups.
+ */
+void Preprocessor::tokenizeLine(std::string_view line, uint32_t line_number, std::vector<PPToken> &out) const {
+    size_t i = 0;
+    const size_t n = line.size();
+    while (i < n) {
+        uint16_t spaces = 0;
+        while (i < n && isHorizontalSpace(line[i])) {
+            ++i;
+            if (spaces < UINT16_MAX) ++spaces;
+        }
+        if (i >= n) break;
+
+        size_t start = i;
+        PPKind kind;
+        char c = line[i];
+        if (std::isdigit(static_cast<unsigned char>(c)) ||
+            (c == '.' && i + 1 < n && std::isdigit(static_cast<unsigned char>(line[i + 1])))) {
+            kind = PPKind::Number;
+            ++i;
+            while (i < n) {
+                char d = line[i];
+                if ((d == '+' || d == '-') && std::strchr("eEpP", line[i - 1])) {
+                    ++i;
+                } else if (isIdentifierChar(d) || d == '.') {
+                    ++i;
+                } else {
+                    break;
+                }
+            }
+        } else if ((c == 'L' || c == 'u' || c == 'U') && i + 1 < n && (line[i + 1] == '\'' || line[i + 1] == '"')) {
+            kind = line[i + 1] == '"' ? PPKind::StringLiteral : PPKind::CharLiteral;
+            i += 1;
+            goto quoted;
+        } else if (isIdentifierStart(c)) {
+            kind = PPKind::Identifier;
+            while (i < n && isIdentifierChar(line[i])) ++i;
+        } else if (c == '"' || c == '\'') {
+            kind = c == '"' ? PPKind::StringLiteral : PPKind::CharLiteral;
+        quoted:
+            {
+                char quote = line[i];
+                ++i;
+                bool closed = false;
+                while (i < n) {
+                    if (line[i] == '\\' && i + 1 < n) {
+                        i += 2;
+                        continue;
+                    }
+                    if (line[i++] == quote) {
+                        closed = true;
+                        break;
+                    }
+                }
+                if (!closed) kind = PPKind::Other;
+            }
+        } else {
+            kind = PPKind::Punctuator;
+            size_t length = 1;
+            for (const char *punctuator: kPunctuators) {
+                if (punctuator[0] != c) continue;
+                size_t candidate = std::strlen(punctuator);
+                if (line.compare(i, candidate, punctuator) == 0) {
+                    length = candidate;
+                    break;
+                }
+            }
+            if (length == 1 && !std::ispunct(static_cast<unsigned char>(c))) {
+                kind = PPKind::Other;
+            }
+            i += length;
+        }
+        out.push_back({kind, spaces, line_number, std::string(line.substr(start, i - start)), nullptr});
+    }
+}
+
+/**
+ * @brief Resolves an #include name against the search path.
+ *
+ * @details Quoted names are looked up next to the including file first, then in the `-I` directories and the
+ *          system directories; angled names skip the first step.
+ *
+ * @return The path of the header, or an empty string if it was not found.
+ */
+std::string Preprocessor::resolveInclude(const std::string &name, bool angled) const {
+    if (!name.empty() && name[0] == '/') {
+        return isRegularFile(name) ? name : std::string();
+    }
+    if (!angled && !m_file_stack.empty()) {
+        std::string candidate = m_file_stack.back().directory + "/" + name;
+        if (isRegularFile(candidate)) return candidate;
+    }
+    for (const auto *dirs: {&m_options.include_dirs, &m_options.system_include_dirs}) {
+        for (const auto &dir: *dirs) {
+            std::string candidate = dir + "/" + name;
+            if (isRegularFile(candidate)) return candidate;
+        }
+    }
+    return {};
+}
+
+namespace {
+
+    bool isPunctuator(const std::string &text, const char *spelling) {
+        return text == spelling;
+    }
+
+} // namespace
+
+/**
+ * @brief Preprocesses one file, appending its expansion to the output.
+ *
+ * @details Consecutive text lines are collected into one group before expansion, so function-like macro
+ *          invocations may span lines. Directives end the current group, and so does a line that cannot continue an
+ *          invocation (one not starting with '(' while every parenthesis so far is closed), which keeps groups
+ *          short in long files with few directives. A line that starts no group and names no macro is copied to
+ *          the output as it is, without being split into tokens.
+ *
+ * @param path The file to process.
+ * @param depth The current #include nesting depth.
+ */
+void Preprocessor::processFile(const std::string &path, int depth) {
+    if (depth > 200) {
+        error("#include nested too deeply");
+    }
+    if (m_pragma_once.count(path)) {
+        return;
+    }
+
+    // The main file's expansion is usually about as long as the file, so reserve that much up front
+    std::string_view text = readFile(path);
+    if (depth == 0) {
+        m_output.reserve(m_output.size() + text.size() + text.size() / 8);
+    }
+    Generator<LogicalLine> lines = logicalLines(text);
+    auto nextLine = [&lines, &path]() {
+        try {
+            return lines.next();
+        } catch (const PreprocessError &e) {
+            throw PreprocessError(e.what(), path, e.line);
+        }
+    };
+    m_file_stack.push_back({path, directoryOf(path), 1});
+    markLine();
+    size_t conditional_depth = m_conditionals.size();
+
+    // Both buffers are cleared rather than replaced, so their storage is reused from line to line
+    std::vector<PPToken> group;
+    std::vector<PPToken> tokens;
+    long group_parens = 0;
+    auto flushGroup = [&]() {
+        if (!group.empty()) {
+            emit(expand(group));
+            group.clear();
+        }
+        group_parens = 0;
+    };
+
+    while (const LogicalLine *next = nextLine()) {
+        const LogicalLine &line = *next;
+        m_file_stack.back().line = line.line;
+        uint32_t newlines = 1 + line.extra_newlines;
+
+        // Only a line starting with '#' or '%:' can be a directive, so other lines are not split up front
+        size_t first = 0;
+        while (first < line.text.size() && isHorizontalSpace(line.text[first])) ++first;
+        char first_char = first < line.text.size() ? line.text[first] : '\n';
+        tokens.clear();
+        if (first_char == '#' || first_char == '%') {
+            tokenizeLine(line.text, line.line, tokens);
+        }
+
+        if (!tokens.empty() && tokens[0].kind == PPKind::Punctuator &&
+            (tokens[0].text == "#" || tokens[0].text == "%:")) {
+            flushGroup();
+            handleDirective(tokens, depth);
+            m_file_stack.back().line = line.line;
+            emitNewlines(newlines);
+        } else if (isActive()) {
+            if (group_parens <= 0 && first_char != '\n' && first_char != '(') {
+                flushGroup();
+            }
+            if (group.empty() && !needsExpansion(line.text)) {
+                // Trailing blanks (often a comment) are dropped, as they would be when emitting tokens
+                size_t last = line.text.size();
+                while (last > 0 && isHorizontalSpace(line.text[last - 1])) --last;
+                m_output.append(line.text, 0, last);
+                emitNewlines(newlines);
+                continue;
+            }
+            if (tokens.empty()) {
+                tokenizeLine(line.text, line.line, tokens);
+            }
+            for (auto &token: tokens) {
+                if (token.kind == PPKind::Punctuator) {
+                    group_parens += isPunctuator(token.text, "(") - isPunctuator(token.text, ")");
+                }
+                group.push_back(std::move(token));
+            }
+            for (uint32_t i = 0; i < newlines; ++i) {
+                group.push_back({PPKind::Newline, 0, line.line, {}, nullptr});
+            }
+        } else {
+            emitNewlines(newlines);
+        }
+    }
+    flushGroup();
+
+    if (m_conditionals.size() != conditional_depth) {
+        m_file_stack.back().line = m_conditionals.back().line;
+        error("Unterminated conditional directive");
+    }
+    m_file_stack.pop_back();
+}
+
+/**
+ * @brief Handles one directive line.
+ *
+ * @details Conditional directives are tracked even inside skipped groups so nesting stays balanced; every other
+ *          directive is ignored unless the current group is active.
+ *
+ * @param tokens The tokens of the directive line, starting with `#`.
+ * @param depth The current #include nesting depth.
+ */
+void Preprocessor::handleDirective(std::vector<PPToken> &tokens, int depth) {
+    if (tokens.size() == 1) {
+        return;  // Null directive
+    }
+    const std::string &name = tokens[1].text;
+    std::vector<PPToken> rest(std::make_move_iterator(tokens.begin() + 2), std::make_move_iterator(tokens.end()));
+
+    if (name == "if" || name == "ifdef" || name == "ifndef") {
+        if (!isActive()) {
+            m_conditionals.push_back({m_file_stack.back().line, false, true, false, false});
+            return;
+        }
+        bool value;
+        if (name == "if") {
+            value = evaluateCondition(std::move(rest));
+        } else {
+            if (rest.empty() || rest[0].kind != PPKind::Identifier) {
+                error("Macro name missing after #" + name);
+            }
+            value = m_macros.count(rest[0].text) > 0;
+            if (name == "ifndef") value = !value;
+        }
+        m_conditionals.push_back({m_file_stack.back().line, true, value, value, false});
+        return;
+    }
+    if (name == "elif") {
+        if (m_conditionals.empty()) error("#elif without #if");
+        Conditional &conditional = m_conditionals.back();
+        if (conditional.seen_else) error("#elif after #else");
+        if (!conditional.parent_active || conditional.taken) {
+            conditional.active = false;
+        } else {
+            conditional.active = evaluateCondition(std::move(rest));
+            conditional.taken = conditional.active;
+        }
+        return;
+    }
+    if (name == "else") {
+        if (m_conditionals.empty()) error("#else without #if");
+        Conditional &conditional = m_conditionals.back();
+        if (conditional.seen_else) error("#else after #else");
+        conditional.active = conditional.parent_active && !conditional.taken;
+        conditional.taken = true;
+        conditional.seen_else = true;
+        return;
+    }
+    if (name == "endif") {
+        if (m_conditionals.empty()) error("#endif without #if");
+        m_conditionals.pop_back();
+        return;
+    }
+
+    if (!isActive()) {
+        return;
+    }
+
+    if (name == "define") {
+        handleDefine(rest);
+    } else if (name == "undef") {
+        if (rest.empty() || rest[0].kind != PPKind::Identifier) error("Macro name missing after #undef");
+        m_macros.erase(rest[0].text);
+    } else if (name == "include") {
+        handleInclude(std::move(rest), depth);
+    } else if (name == "include_next") {
+        error("#include_next is not supported by the built-in preprocessor (use --gcc-preprocess)");
+    } else if (name == "error" || name == "warning") {
+        std::string message = "#" + name;
+        for (const auto &token: rest) {
+            message += (token.spaces > 0 || &token == &rest.front() ? " " : "") + token.text;
+        }
+        if (name == "error") error(message);
+        m_warnings.push_back(m_file_stack.back().path + ":" + std::to_string(m_file_stack.back().line) + ": " +
+                             message);
+    } else if (name == "pragma") {
+        if (!rest.empty() && rest[0].text == "once") {
+            m_pragma_once.insert(m_file_stack.back().path);
+        }
+    } else if (name == "line" || name == "ident" || tokens[1].kind == PPKind::Number) {
+        // Line control only affects line markers, which are never emitted
+    } else {
+        error("Invalid preprocessing directive #" + name);
+    }
+}
+
+/**
+ * @brief Handles #include, including the macro-expanded form.
+ */
+void Preprocessor::handleInclude(std::vector<PPToken> tokens, int depth) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string name;
+        bool angled = false;
+        bool parsed = false;
+        if (!tokens.empty() && tokens[0].kind == PPKind::StringLiteral && tokens[0].text.front() == '"') {
+            name = tokens[0].text.substr(1, tokens[0].text.size() - 2);
+            parsed = true;
+        } else if (!tokens.empty() && isPunctuator(tokens[0].text, "<")) {
+            angled = true;
+            for (size_t i = 1; i < tokens.size(); ++i) {
+                if (isPunctuator(tokens[i].text, ">")) {
+                    parsed = true;
+                    break;
+                }
+                if (i > 1 && tokens[i].spaces > 0) name += ' ';
+                name += tokens[i].text;
+            }
+        }
+
+        if (parsed) {
+            std::string path = resolveInclude(name, angled);
+            if (path.empty()) {
+                error("'" + name + "' file not found");
+            }
+            processFile(path, depth + 1);
+            // The directive's own blank line comes next, so output resumes at the includer's current line
+            markLine();
+            return;
+        }
+        tokens = expand(tokens);
+    }
+    error("#include expects \"FILENAME\" or <FILENAME>");
+}
+
+/**
+ * @brief Records a macro definition.
+ *
+ * @param tokens The tokens after `#define`, starting with the macro name.
+ */
+void Preprocessor::handleDefine(const std::vector<PPToken> &tokens) {
+    if (tokens.empty() || tokens[0].kind != PPKind::Identifier) {
+        error("Macro names must be identifiers");
+    }
+    if (tokens[0].text == "defined") {
+        error("\"defined\" cannot be used as a macro name");
+    }
+
+    Macro macro;
+    size_t i = 1;
+    if (i < tokens.size() && tokens[i].spaces == 0 && isPunctuator(tokens[i].text, "(")) {
+        macro.function_like = true;
+        ++i;
+        bool closed = false;
+        while (i < tokens.size()) {
+            const PPToken &token = tokens[i++];
+            if (isPunctuator(token.text, ")") && macro.params.empty()) {
+                closed = true;
+                break;
+            }
+            if (token.kind == PPKind::Identifier && !macro.variadic) {
+                macro.params.push_back(token.text);
+            } else if (isPunctuator(token.text, "...") && !macro.variadic) {
+                macro.variadic = true;
+                macro.params.emplace_back("__VA_ARGS__");
+            } else {
+                error("Expected parameter name in macro parameter list");
+            }
+            if (i < tokens.size() && isPunctuator(tokens[i].text, ",")) {
+                ++i;
+            } else if (i < tokens.size() && isPunctuator(tokens[i].text, ")")) {
+                ++i;
+                closed = true;
+                break;
+            } else {
+                error("Expected ',' or ')' in macro parameter list");
+            }
+        }
+        if (!closed) {
+            error("Missing ')' in macro parameter list");
+        }
+    }
+
+    macro.body.assign(tokens.begin() + static_cast<ptrdiff_t>(i), tokens.end());
+    if (!macro.body.empty()) {
+        macro.body.front().spaces = 0;
+        if (isPunctuator(macro.body.front().text, "##") || isPunctuator(macro.body.back().text, "##")) {
+            error("'##' cannot appear at either end of a macro expansion");
+        }
+    }
+    if (macro.function_like) {
+        for (size_t j = 0; j < macro.body.size(); ++j) {
+            if (isPunctuator(macro.body[j].text, "#") &&
+                (j + 1 >= macro.body.size() ||
+                 std::find(macro.params.begin(), macro.params.end(), macro.body[j + 1].text) == macro.params.end())) {
+                error("'#' is not followed by a macro parameter");
+            }
+        }
+    }
+    m_macros[tokens[0].text] = std::move(macro);
+}
+
+/**
+ * @brief Evaluates the controlling expression of an #if or #elif.
+ */
+bool Preprocessor::evaluateCondition(std::vector<PPToken> tokens) {
+    // `defined` has to be resolved before macro expansion can rewrite its operand
+    std::vector<PPToken> resolved;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].kind == PPKind::Identifier && tokens[i].text == "defined") {
+            bool parenthesised = i + 1 < tokens.size() && isPunctuator(tokens[i + 1].text, "(");
+            size_t name_index = i + (parenthesised ? 2 : 1);
+            if (name_index >= tokens.size() || tokens[name_index].kind != PPKind::Identifier) {
+                error("Operator \"defined\" requires an identifier");
+            }
+            if (parenthesised && (name_index + 1 >= tokens.size() || !isPunctuator(tokens[name_index + 1].text, ")"))) {
+                error("Missing ')' after \"defined\"");
+            }
+            bool defined = m_macros.count(tokens[name_index].text) > 0 || tokens[name_index].text == "__LINE__" ||
+                           tokens[name_index].text == "__FILE__";
+            resolved.push_back({PPKind::Number, 1, tokens[i].line, defined ? "1" : "0", nullptr});
+            i = name_index + (parenthesised ? 1 : 0);
+        } else {
+            resolved.push_back(std::move(tokens[i]));
+        }
+    }
+
+    std::vector<ConditionParser::Item> items;
+    for (const auto &token: expand(resolved)) {
+        switch (token.kind) {
+            case PPKind::Identifier:
+                items.push_back({true, {}, {}});
+                break;
+            case PPKind::Number:
+            case PPKind::CharLiteral:
+                try {
+                    items.push_back({true, token.kind == PPKind::Number
+                                           ? parseIntegerLiteral(token.text)
+                                           : PPValue::fromSigned(parseCharLiteral(token.text)), {}});
+                } catch (const std::exception &e) {
+                    error(e.what());
+                }
+                break;
+            case PPKind::Punctuator:
+                items.push_back({false, {}, token.text});
+                break;
+            case PPKind::Newline:
+            case PPKind::Placemarker:
+                break;
+            default:
+                error("Token \"" + token.text + "\" is not valid in preprocessor expressions");
+        }
+    }
+    if (items.empty()) {
+        error("#if with no expression");
+    }
+    try {
+        return ConditionParser(std::move(items)).parse().bits != 0;
+    } catch (const PreprocessError &) {
+        throw;
+    } catch (const std::exception &e) {
+        error(e.what());
+    }
+}
+
+namespace {
+
+    bool hideSetContains(const std::shared_ptr<const std::vector<std::string>> &hide_set, const std::string &name) {
+        return hide_set && std::binary_search(hide_set->begin(), hide_set->end(), name);
+    }
+
+    std::shared_ptr<const std::vector<std::string>> hideSetUnion(
+            const std::shared_ptr<const std::vector<std::string>> &a,
+            const std::shared_ptr<const std::vector<std::string>> &b) {
+        if (!a || a->empty() || a == b) return b;
+        if (!b || b->empty()) return a;
+        auto result = std::make_shared<std::vector<std::string>>();
+        std::set_union(a->begin(), a->end(), b->begin(), b->end(), std::back_inserter(*result));
+        return result;
+    }
+
+    std::shared_ptr<const std::vector<std::string>> hideSetIntersection(
+            const std::shared_ptr<const std::vector<std::string>> &a,
+            const std::shared_ptr<const std::vector<std::string>> &b) {
+        if (!a || !b) return nullptr;
+        if (a == b) return a;
+        auto result = std::make_shared<std::vector<std::string>>();
+        std::set_intersection(a->begin(), a->end(), b->begin(), b->end(), std::back_inserter(*result));
+        return result;
+    }
+
+    std::shared_ptr<const std::vector<std::string>> hideSetAdd(
+            const std::shared_ptr<const std::vector<std::string>> &hide_set, const std::string &name) {
+        return hideSetUnion(hide_set, std::make_shared<const std::vector<std::string>>(1, name));
+    }
+
+} // namespace
+
+/**
+ * @brief Fully macro-expands a token sequence.
+ *
+ * @details Follows Prosser's algorithm: every token carries the set of macros whose expansion produced it, and
+ *          a macro name is not expanded again inside its own expansion. Replacement lists are pushed back onto
+ *          the input so they are rescanned together with the tokens that follow.
+ *
+ * @param tokens The tokens to expand. They are consumed, leaving the vector empty but with its capacity, so a
+ *               caller expanding line after line can keep refilling the same buffer.
+ * @return The expanded tokens.
+ */
+std::vector<Preprocessor::PPToken> Preprocessor::expand(std::vector<PPToken> &tokens) {
+    std::vector<PPToken> output;
+    output.reserve(tokens.size());
+    std::reverse(tokens.begin(), tokens.end());
+    std::vector<PPToken> &input = tokens;  // Used as a stack: the next token is at the back
+
+    while (!input.empty()) {
+        PPToken token = std::move(input.back());
+        input.pop_back();
+
+        if (token.kind != PPKind::Identifier || hideSetContains(token.hide_set, token.text)) {
+            output.push_back(std::move(token));
+            continue;
+        }
+
+        auto it = m_macros.find(token.text);
+        if (it == m_macros.end()) {
+            if (token.text == "__LINE__") {
+                output.push_back({PPKind::Number, token.spaces, token.line, std::to_string(token.line), nullptr});
+            } else if (token.text == "__FILE__") {
+                output.push_back({PPKind::StringLiteral, token.spaces, token.line,
+                                  "\"" + m_file_stack.back().path + "\"", nullptr});
+            } else {
+                output.push_back(std::move(token));
+            }
+            continue;
+        }
+        const Macro &macro = it->second;
+
+        if (!macro.function_like) {
+            std::vector<PPToken> replacement = substitute(macro, {}, hideSetAdd(token.hide_set, token.text), token);
+            input.insert(input.end(), std::make_move_iterator(replacement.rbegin()),
+                         std::make_move_iterator(replacement.rend()));
+            continue;
+        }
+
+        // A function-like macro name is only an invocation when followed by '(' (possibly on a later line)
+        size_t lookahead = input.size();
+        while (lookahead > 0 && input[lookahead - 1].kind == PPKind::Newline) --lookahead;
+        if (lookahead == 0 || !isPunctuator(input[lookahead - 1].text, "(")) {
+            output.push_back(std::move(token));
+            continue;
+        }
+        size_t newlines = input.size() - lookahead;
+        input.resize(lookahead - 1);
+
+        std::vector<std::vector<PPToken>> args(1);
+        int nesting = 0;
+        bool closed = false;
+        PPToken close_paren;
+        while (!input.empty()) {
+            PPToken arg_token = std::move(input.back());
+            input.pop_back();
+            if (arg_token.kind == PPKind::Newline) {
+                ++newlines;
+                continue;
+            }
+            if (isPunctuator(arg_token.text, "(")) {
+                ++nesting;
+            } else if (isPunctuator(arg_token.text, ")")) {
+                if (nesting == 0) {
+                    close_paren = std::move(arg_token);
+                    closed = true;
+                    break;
+                }
+                --nesting;
+            } else if (isPunctuator(arg_token.text, ",") && nesting == 0 &&
+                       !(macro.variadic && args.size() == macro.params.size())) {
+                args.emplace_back();
+                continue;
+            }
+            args.back().push_back(std::move(arg_token));
+        }
+        if (!closed) {
+            error("Unterminated argument list invoking macro \"" + token.text + "\"");
+        }
+
+        size_t expected = macro.params.size();
+        if (expected == 0 && args.size() == 1 && args[0].empty()) {
+            args.clear();
+        } else if (macro.variadic && args.size() == expected - 1) {
+            args.emplace_back();
+        }
+        if (args.size() != expected) {
+            error("Macro \"" + token.text + "\" passed " + std::to_string(args.size()) + " arguments, but takes " +
+                  std::to_string(expected));
+        }
+
+        HideSet hide_set = hideSetAdd(hideSetIntersection(token.hide_set, close_paren.hide_set), token.text);
+        std::vector<PPToken> replacement = substitute(macro, args, hide_set, token);
+        // Lines swallowed by a multi-line invocation are re-emitted after it to keep line numbers in step
+        for (size_t i = 0; i < newlines; ++i) {
+            input.push_back({PPKind::Newline, 0, token.line, {}, nullptr});
+        }
+        input.insert(input.end(), std::make_move_iterator(replacement.rbegin()),
+                     std::make_move_iterator(replacement.rend()));
+    }
+    return output;
+}
+
+/**
+ * @brief Builds the replacement list of one macro invocation.
+ *
+ * @details Parameters are replaced by their fully expanded arguments, except as operands of `#` (stringized) or
+ *          `##` (pasted unexpanded). Every resulting token gets the invocation's hide set.
+ */
+std::vector<Preprocessor::PPToken> Preprocessor::substitute(const Macro &macro,
+                                                            const std::vector<std::vector<PPToken>> &args,
+                                                            const HideSet &hide_set, const PPToken &invocation) {
+    auto paramIndex = [&macro](const PPToken &token) -> int {
+        if (!macro.function_like || token.kind != PPKind::Identifier) return -1;
+        for (size_t i = 0; i < macro.params.size(); ++i) {
+            if (macro.params[i] == token.text) return static_cast<int>(i);
+        }
+        return -1;
+    };
+    auto isPaste = [](const PPToken &token) {
+        return token.kind == PPKind::Punctuator && (token.text == "##" || token.text == "%:%:");
+    };
+
+    std::vector<std::vector<PPToken>> expanded_args(args.size());
+    std::vector<bool> expanded(args.size(), false);
+    std::vector<PPToken> result;
+    const auto &body = macro.body;
+
+    for (size_t i = 0; i < body.size(); ++i) {
+        const PPToken &token = body[i];
+
+        if (macro.function_like && token.kind == PPKind::Punctuator && (token.text == "#" || token.text == "%:")) {
+            int param = i + 1 < body.size() ? paramIndex(body[i + 1]) : -1;
+            if (param >= 0) {
+                result.push_back(stringize(args[param], token.spaces, invocation.line));
+                ++i;
+                continue;
+            }
+        }
+
+        if (isPaste(token) && i + 1 < body.size()) {
+            const PPToken &next = body[++i];
+            int param = paramIndex(next);
+            std::vector<PPToken> rhs = param >= 0 ? args[param] : std::vector<PPToken>{next};
+            bool is_va_args = param >= 0 && macro.variadic && param == static_cast<int>(macro.params.size()) - 1;
+            if (is_va_args && !result.empty() && isPunctuator(result.back().text, ",")) {
+                // GNU extension: `, ## __VA_ARGS__` drops the comma when there are no variable arguments
+                if (rhs.empty()) result.pop_back();
+                result.insert(result.end(), rhs.begin(), rhs.end());
+                continue;
+            }
+            if (rhs.empty()) {
+                continue;
+            }
+            if (result.empty()) {
+                result.insert(result.end(), rhs.begin(), rhs.end());
+                continue;
+            }
+            PPToken lhs = std::move(result.back());
+            result.pop_back();
+            result.push_back(paste(lhs, rhs[0]));
+            result.insert(result.end(), rhs.begin() + 1, rhs.end());
+            continue;
+        }
+
+        int param = paramIndex(token);
+        if (param >= 0) {
+            std::vector<PPToken> replacement;
+            if (i + 1 < body.size() && isPaste(body[i + 1])) {
+                replacement = args[param];
+                if (replacement.empty()) {
+                    replacement.push_back({PPKind::Placemarker, 0, invocation.line, {}, nullptr});
+                }
+            } else {
+                if (!expanded[param]) {
+                    std::vector<PPToken> arg = args[param];
+                    expanded_args[param] = expand(arg);
+                    expanded[param] = true;
+                }
+                replacement = expanded_args[param];
+            }
+            if (!replacement.empty()) {
+                replacement.front().spaces = token.spaces;
+            }
+            result.insert(result.end(), std::make_move_iterator(replacement.begin()),
+                          std::make_move_iterator(replacement.end()));
+            continue;
+        }
+
+        result.push_back(token);
+    }
+
+    std::vector<PPToken> output;
+    output.reserve(result.size());
+    for (auto &token: result) {
+        if (token.kind == PPKind::Placemarker) continue;
+        token.hide_set = hideSetUnion(token.hide_set, hide_set);
+        token.line = invocation.line;
+        token.spaces = std::min<uint16_t>(token.spaces, 1);
+        output.push_back(std::move(token));
+    }
+    if (!output.empty()) {
+        output.front().spaces = invocation.spaces;
+    }
+    return output;
+}
+
+/**
+ * @brief Concatenates two tokens for the `##` operator.
+ */
+Preprocessor::PPToken Preprocessor::paste(const PPToken &lhs, const PPToken &rhs) {
+    if (lhs.kind == PPKind::Placemarker) return rhs;
+    if (rhs.kind == PPKind::Placemarker) return lhs;
+
+    std::vector<PPToken> tokens;
+    tokenizeLine(lhs.text + rhs.text, lhs.line, tokens);
+    if (tokens.size() != 1) {
+        error("Pasting \"" + lhs.text + "\" and \"" + rhs.text + "\" does not give a valid preprocessing token");
+    }
+    tokens[0].spaces = lhs.spaces;
+    tokens[0].hide_set = lhs.hide_set;
+    return std::move(tokens[0]);
+}
+
+/**
+ * @brief Converts a macro argument to a string literal for the `#` operator.
+ */
+Preprocessor::PPToken Preprocessor::stringize(const std::vector<PPToken> &arg, uint16_t spaces, uint32_t line) {
+    std::string text = "\"";
+    for (size_t i = 0; i < arg.size(); ++i) {
+        const PPToken &token = arg[i];
+        if (i > 0 && token.spaces > 0) {
+            text += ' ';
+        }
+        if (token.kind == PPKind::StringLiteral || token.kind == PPKind::CharLiteral) {
+            for (char c: token.text) {
+                if (c == '"' || c == '\\') text += '\\';
+                text += c;
+            }
+        } else {
+            text += token.text;
+        }
+    }
+    text += '"';
+    return {PPKind::StringLiteral, spaces, line, std::move(text), nullptr};
+}
+
+/**
+ * @brief Records that the output from the current line on comes from the current file and line.
+ */
+void Preprocessor::markLine() {
+    const FileState &file = m_file_stack.back();
+    if (!m_line_marks.empty() && m_line_marks.back().output_line == m_output_line) {
+        m_line_marks.pop_back();  // Nothing was written under the previous mark, e.g. an empty header
+    }
+    m_line_marks.push_back({m_output_line, file.line, file.path});
+}
+
+/**
+ * @brief Appends tokens to the output.
+ *
+ * @details Unexpanded tokens keep their original leading whitespace. A separating space is added whenever two
+ *          adjacent tokens would otherwise lex as one, e.g. `-` followed by `-1` from a macro.
+ */
+void Preprocessor::emit(const std::vector<PPToken> &tokens) {
+    for (const auto &token: tokens) {
+        if (token.kind == PPKind::Newline) {
+            emitNewlines(1);
+            continue;
+        }
+        if (token.kind == PPKind::Placemarker || token.text.empty()) {
+            continue;
+        }
+
+        size_t spaces = token.spaces;
+        if (spaces == 0 && !m_at_line_start) {
+            char first = token.text.front();
+            char pair[3] = {m_last_char, first, '\0'};
+            bool would_paste = (isIdentifierChar(m_last_char) && (isIdentifierChar(first) || first == '\'' ||
+                                                                  first == '"')) ||
+                               (m_last_char == '.' && std::isdigit(static_cast<unsigned char>(first))) ||
+                               (m_last_char == '/' && (first == '/' || first == '*'));
+            for (const char *punctuator: kPunctuators) {
+                would_paste = would_paste || (punctuator[0] == m_last_char && std::strncmp(punctuator, pair, 2) == 0);
+            }
+            spaces = would_paste ? 1 : 0;
+        }
+        m_output.append(spaces, ' ');
+        m_output += token.text;
+        m_at_line_start = false;
+        m_last_char = token.text.back();
+    }
+}
+
+void Preprocessor::emitNewlines(uint32_t count) {
+    m_output.append(count, '\n');
+    m_output_line += count;
+    m_at_line_start = true;
+    m_last_char = '\n';
+}
+
+/**
+ * @brief Returns whether expanding a line could change it: whether it names a macro, `__LINE__` or `__FILE__`.
+ *
+ * @details Scans the line the way tokenizeLine() splits it, so identifiers inside numbers and literals are not
+ *          mistaken for macro names, but without building any tokens.
+ */
+bool Preprocessor::needsExpansion(std::string_view line) const {
+    size_t i = 0;
+    const size_t n = line.size();
+    while (i < n) {
+        char c = line[i];
+        if (std::isdigit(static_cast<unsigned char>(c)) ||
+            (c == '.' && i + 1 < n && std::isdigit(static_cast<unsigned char>(line[i + 1])))) {
+            ++i;
+            while (i < n && (isIdentifierChar(line[i]) || line[i] == '.' ||
+                             ((line[i] == '+' || line[i] == '-') && std::strchr("eEpP", line[i - 1])))) {
+                ++i;
+            }
+        } else if (isIdentifierStart(c)) {
+            size_t start = i;
+            while (i < n && isIdentifierChar(line[i])) ++i;
+            std::string_view name = line.substr(start, i - start);
+            bool prefix = name.size() == 1 && (c == 'L' || c == 'u' || c == 'U') && i < n &&
+                          (line[i] == '\'' || line[i] == '"');
+            if (!prefix && (name == "__LINE__" || name == "__FILE__" || m_macros.find(name) != m_macros.end())) {
+                return true;
+            }
+        } else if (c == '"' || c == '\'') {
+            ++i;
+            while (i < n) {
+                if (line[i] == '\\' && i + 1 < n) {
+                    i += 2;
+                    continue;
+                }
+                if (line[i++] == c) break;
+            }
+        } else {
+            ++i;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "generator.h"
+#include "source_buffer.h"
+
+class PreprocessError : public std::runtime_error {
+public:
+    PreprocessError(const std::string &message, std::string file, uint32_t line)
+            : std::runtime_error(message), file(std::move(file)), line(line) {}
+
+    std::string file;
+    uint32_t line;
+};
+
+struct PreprocessorOptions {
+    std::vector<std::string> include_dirs;
+    std::vector<std::string> system_include_dirs = {"/usr/local/include", "/usr/include/x86_64-linux-gnu",
+                                                    "/usr/include"};
+    std::vector<std::pair<std::string, std::string>> defines;
+    std::vector<std::string> undefines;
+};
+
+/**
+ * Mapped files shared by every Preprocessor that uses it, e.g. across the requests a compile server handles.
+ * Each lookup checks the file's identity, size and modification time first, so edited files are mapped afresh.
+ */
+class IncludeCache {
+public:
+    std::shared_ptr<const SourceBuffer> get(const std::string &path);
+
+private:
+    struct Entry {
+        std::shared_ptr<const SourceBuffer> buffer;
+        uint64_t device;
+        uint64_t inode;
+        int64_t size;
+        int64_t mtime_ns;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+/**
+ * Where a stretch of preprocessed output came from: output line `output_line` (1-based) is line `line` of
+ * `file`, and each following output line is the next line of that file, up to the next mark.
+ */
+struct LineMark {
+    uint32_t output_line;
+    uint32_t line;
+    std::string file;
+};
+
+/**
+ * Built-in C preprocessor. Handles #include, object- and function-like #define (with #, ## and __VA_ARGS__),
+ * #undef, the #if family and #error, and produces the translation unit as a string that feeds the lexer
+ * directly. Output keeps each file's line structure (directives and comments become blank lines), and the
+ * line marks record where each included file starts and where its includer resumes, so a diagnostic at any
+ * output line can be traced back to its file and line.
+ */
+class Preprocessor {
+public:
+    explicit Preprocessor(PreprocessorOptions options, IncludeCache *cache = nullptr);
+
+    std::string preprocess(const std::string &path);
+
+    const std::vector<std::string> &warnings() const { return m_warnings; }
+
+    const std::vector<LineMark> &lineMarks() const { return m_line_marks; }
+
+private:
+    enum class PPKind : uint8_t {
+        Identifier,
+        Number,
+        CharLiteral,
+        StringLiteral,
+        Punctuator,
+        Other,
+        Newline,
+        Placemarker
+    };
+
+    using HideSet = std::shared_ptr<const std::vector<std::string>>;
+
+    struct PPToken {
+        PPKind kind;
+        uint16_t spaces;
+        uint32_t line;
+        std::string text;
+        HideSet hide_set;
+    };
+
+    struct LogicalLine {
+        std::string text;
+        uint32_t line;
+        uint32_t extra_newlines;
+    };
+
+    struct Macro {
+        bool function_like = false;
+        bool variadic = false;
+        std::vector<std::string> params;
+        std::vector<PPToken> body;
+    };
+
+    struct Conditional {
+        uint32_t line;
+        bool parent_active;
+        bool taken;
+        bool active;
+        bool seen_else;
+    };
+
+    struct FileState {
+        std::string path;
+        std::string directory;
+        uint32_t line;
+    };
+
+    // Lets m_macros be searched with a std::string_view into a line without building a std::string
+    struct NameHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+
+    void processFile(const std::string &path, int depth);
+
+    void handleDirective(std::vector<PPToken> &tokens, int depth);
+
+    void handleInclude(std::vector<PPToken> tokens, int depth);
+
+    void handleDefine(const std::vector<PPToken> &tokens);
+
+    bool evaluateCondition(std::vector<PPToken> tokens);
+
+    std::vector<PPToken> expand(std::vector<PPToken> &tokens);
+
+    std::vector<PPToken> substitute(const Macro &macro, const std::vector<std::vector<PPToken>> &args,
+                                    const HideSet &hide_set, const PPToken &invocation);
+
+    PPToken paste(const PPToken &lhs, const PPToken &rhs);
+
+    PPToken stringize(const std::vector<PPToken> &arg, uint16_t spaces, uint32_t line);
+
+    void emit(const std::vector<PPToken> &tokens);
+
+    void emitNewlines(uint32_t count);
+
+    bool needsExpansion(std::string_view line) const;
+
+    void markLine();
+
+    std::string resolveInclude(const std::string &name, bool angled) const;
+
+    std::string_view readFile(const std::string &path);
+
+    static Generator<LogicalLine> logicalLines(std::string_view text);
+
+    void tokenizeLine(std::string_view line, uint32_t line_number, std::vector<PPToken> &out) const;
+
+    bool isActive() const;
+
+    [[noreturn]] void error(const std::string &message) const;
+
+    void defineFromCommandLine(const std::string &name, const std::string &value);
+
+    PreprocessorOptions m_options;
+    IncludeCache *m_cache;
+    std::unordered_map<std::string, Macro, NameHash, std::equal_to<>> m_macros;
+    std::unordered_map<std::string, std::shared_ptr<const SourceBuffer>> m_files;
+    std::unordered_set<std::string> m_pragma_once;
+    std::vector<Conditional> m_conditionals;
+    std::vector<FileState> m_file_stack;
+    std::vector<std::string> m_warnings;
+    std::string m_output;
+    uint32_t m_output_line = 1;  // The line of m_output being written
+    std::vector<LineMark> m_line_marks;
+    bool m_at_line_start = true;
+    char m_last_char = '\n';
+};
@@ -0,0 +1,548 @@
+#include "register_allocator.h"
+#include <algorithm>
+#include <limits>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include "sparse_set.h"
+
+namespace {
+
+    using assembly::Instruction;
+    using assembly::Operand;
+
+    // Nodes 0..K-1 are these hard registers; node K + n is pseudo n.
+    constexpr uint8_t kAllocatable[] = {x86::AX, x86::CX, x86::DX, x86::SI, x86::DI, x86::R8, x86::R9};
+    constexpr uint32_t K = sizeof(kAllocatable);
+    constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+
+    uint32_t hardNode(uint8_t number) {
+        for (uint32_t i = 0; i < K; ++i) {
+            if (kAllocatable[i] == number) return i;
+        }
+        return kNoNode;
+    }
+
+    uint32_t nodeOf(const Operand &operand) {
+        if (operand.kind == Operand::Kind::Pseudo) {
+            return K + static_cast<const assembly::Pseudo &>(operand).id;
+        }
+        if (operand.kind == Operand::Kind::Register) {
+            return hardNode(static_cast<const assembly::Register &>(operand).number);
+        }
+        return kNoNode;
+    }
+
+    struct Access {
+        uint32_t uses[3];
+        uint32_t defs[2];
+        int use_count = 0;
+        int def_count = 0;
+
+        void use(uint32_t node) {
+            if (node != kNoNode) uses[use_count++] = node;
+        }
+
+        void def(uint32_t node) {
+            if (node != kNoNode) defs[def_count++] = node;
+        }
+    };
+
+    /**
+     * @brief Lists the register nodes an instruction reads and writes, including implicit %eax/%edx uses.
+     */
+    Access accessOf(const Instruction &instruction) {
+        Access access;
+        switch (instruction.kind) {
+            case Instruction::Kind::Mov: {
+                const auto &mov = static_cast<const assembly::Mov &>(instruction);
+                access.use(nodeOf(*mov.src));
+                access.def(nodeOf(*mov.dst));
+                break;
+            }
+            case Instruction::Kind::Unary: {
+                uint32_t node = nodeOf(*static_cast<const assembly::Unary &>(instruction).operand);
+                access.use(node);
+                access.def(node);
+                break;
+            }
+            case Instruction::Kind::Binary: {
+                const auto &binary = static_cast<const assembly::Binary &>(instruction);
+                uint32_t src = nodeOf(*binary.src);
+                uint32_t dst = nodeOf(*binary.dst);
+                if (!(binary.op == assembly::BinaryOp::Xor && src == dst && src != kNoNode)) {
+                    access.use(src);
+                    access.use(dst);
+                }
+                access.def(dst);
+                break;
+            }
+            case Instruction::Kind::Cmp: {
+                const auto &cmp = static_cast<const assembly::Cmp &>(instruction);
+                access.use(nodeOf(*cmp.src));
+                access.use(nodeOf(*cmp.dst));
+                break;
+            }
+            case Instruction::Kind::Idiv:
+                access.use(nodeOf(*static_cast<const assembly::Idiv &>(instruction).operand));
+                access.use(hardNode(x86::AX));
+                access.use(hardNode(x86::DX));
+                access.def(hardNode(x86::AX));
+                access.def(hardNode(x86::DX));
+                break;
+            case Instruction::Kind::Cdq:
+                access.use(hardNode(x86::AX));
+                access.def(hardNode(x86::DX));
+                break;
+            case Instruction::Kind::SetCC: {
+                // Only the low byte is written, so the old value is still needed
+                uint32_t node = nodeOf(*static_cast<const assembly::SetCC &>(instruction).operand);
+                access.use(node);
+                access.def(node);
+                break;
+            }
+            case Instruction::Kind::Ret:
+                access.use(hardNode(x86::AX));
+                break;
+            default:
+                break;
+        }
+        return access;
+    }
+
+    /**
+     * @brief Calls `fn` on every operand slot of an instruction, so it can be inspected or replaced.
+     */
+    template<typename Fn>
+    void forEachOperand(Instruction &instruction, Fn fn) {
+        switch (instruction.kind) {
+            case Instruction::Kind::Mov: {
+                auto &mov = static_cast<assembly::Mov &>(instruction);
+                fn(mov.src);
+                fn(mov.dst);
+                break;
+            }
+            case Instruction::Kind::Unary:
+                fn(static_cast<assembly::Unary &>(instruction).operand);
+                break;
+            case Instruction::Kind::Binary: {
+                auto &binary = static_cast<assembly::Binary &>(instruction);
+                fn(binary.src);
+                fn(binary.dst);
+                break;
+            }
+            case Instruction::Kind::Cmp: {
+                auto &cmp = static_cast<assembly::Cmp &>(instruction);
+                fn(cmp.src);
+                fn(cmp.dst);
+                break;
+            }
+            case Instruction::Kind::Idiv:
+                fn(static_cast<assembly::Idiv &>(instruction).operand);
+                break;
+            case Instruction::Kind::SetCC:
+                fn(static_cast<assembly::SetCC &>(instruction).operand);
+                break;
+            default:
+                break;
+        }
+    }
+
+    uint64_t edgeKey(uint32_t a, uint32_t b) {
+        return a < b ? uint64_t{a} << 32 | b : uint64_t{b} << 32 | a;
+    }
+
+    struct Block {
+        size_t begin;
+        size_t end;
+        std::vector<size_t> successors;
+        std::vector<uint32_t> live_in;  // Sorted
+    };
+
+} // namespace
+
+/**
+ * @brief Assigns hard registers to as many pseudo-registers as possible, rewriting the instructions in place.
+ *
+ * @param instructions The function body, with pseudo-register operands.
+ * @param pseudo_count One more than the highest pseudo-register number used.
+ */
+void RegisterAllocator::allocate(InstructionList &instructions, uint32_t pseudo_count) {
+    RegisterAllocator allocator(instructions, pseudo_count);
+    allocator.run();
+}
+
+RegisterAllocator::RegisterAllocator(InstructionList &instructions, uint32_t pseudo_count)
+        : m_instructions(instructions), m_node_count(K + pseudo_count) {}
+
+void RegisterAllocator::run() {
+    m_alias.resize(m_node_count);
+    for (uint32_t i = 0; i < m_node_count; ++i) {
+        m_alias[i] = i;
+    }
+    // A merged node interferes with whatever either half did, so coalescing updates the graph in place
+    // instead of rebuilding it
+    buildInterferenceGraph();
+    if (coalesce()) {
+        rewriteCoalesced();
+    }
+    color();
+    rewriteColored();
+}
+
+/**
+ * @brief Computes liveness per basic block and builds the interference graph from it.
+ *
+ * @details A definition interferes with everything live after it, except that the source of a move does not
+ *          interfere with its destination (they hold the same value, so they may share a register).
+ */
+void RegisterAllocator::buildInterferenceGraph() {
+    m_adjacency.assign(m_node_count, {});
+    m_degree.assign(m_node_count, 0);
+    m_edges.clear();
+    m_spill_cost.assign(m_node_count, 0);
+    for (uint32_t a = 0; a < K; ++a) {
+        for (uint32_t b = a + 1; b < K; ++b) {
+            addEdge(a, b);
+        }
+    }
+
+    // Split into basic blocks
+    std::vector<Block> blocks;
+    std::unordered_map<std::string, size_t> label_blocks;
+    size_t begin = 0;
+    for (size_t i = 0; i < m_instructions.size(); ++i) {
+        auto kind = m_instructions[i]->kind;
+        if (kind == Instruction::Kind::Label && i != begin) {
+            blocks.push_back({begin, i, {}, {}});
+            begin = i;
+        }
+        if (kind == Instruction::Kind::Label) {
+            label_blocks[static_cast<const assembly::Label &>(*m_instructions[i]).name] = blocks.size();
+        }
+        if (kind == Instruction::Kind::Jmp || kind == Instruction::Kind::JmpCC || kind == Instruction::Kind::Ret) {
+            blocks.push_back({begin, i + 1, {}, {}});
+            begin = i + 1;
+        }
+    }
+    if (begin < m_instructions.size()) {
+        blocks.push_back({begin, m_instructions.size(), {}, {}});
+    }
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        const Instruction &last = *m_instructions[blocks[b].end - 1];
+        if (last.kind == Instruction::Kind::Jmp) {
+            blocks[b].successors.push_back(label_blocks.at(static_cast<const assembly::Jmp &>(last).label));
+        } else if (last.kind != Instruction::Kind::Ret) {
+            if (last.kind == Instruction::Kind::JmpCC) {
+                blocks[b].successors.push_back(label_blocks.at(static_cast<const assembly::JmpCC &>(last).label));
+            }
+            if (b + 1 < blocks.size()) {
+                blocks[b].successors.push_back(b + 1);
+            }
+        }
+    }
+
+    // Backward dataflow to a fixed point. Few nodes are live across a block boundary, so those sets are sorted
+    // vectors; the set being walked is a SparseSet, which costs nothing per node that is not in it.
+    SparseSet live(m_node_count);
+    auto liveOut = [&blocks, &live](const Block &block) {
+        live.clear();
+        for (size_t successor: block.successors) {
+            for (uint32_t node: blocks[successor].live_in) {
+                live.insert(node);
+            }
+        }
+    };
+    std::vector<uint32_t> live_in;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            liveOut(blocks[b]);
+            for (size_t i = blocks[b].end; i-- > blocks[b].begin;) {
+                Access access = accessOf(*m_instructions[i]);
+                for (int d = 0; d < access.def_count; ++d) live.erase(access.defs[d]);
+                for (int u = 0; u < access.use_count; ++u) live.insert(access.uses[u]);
+            }
+            live_in = live.members();
+            std::sort(live_in.begin(), live_in.end());
+            if (live_in != blocks[b].live_in) {
+                blocks[b].live_in.swap(live_in);
+                changed = true;
+            }
+        }
+    }
+
+    // Walk each block backwards adding interference edges
+    for (const auto &block: blocks) {
+        liveOut(block);
+        for (size_t i = block.end; i-- > block.begin;) {
+            const Instruction &instruction = *m_instructions[i];
+            Access access = accessOf(instruction);
+            uint32_t move_source = kNoNode;
+            if (instruction.kind == Instruction::Kind::Mov) {
+                move_source = nodeOf(*static_cast<const assembly::Mov &>(instruction).src);
+            }
+            for (int d = 0; d < access.def_count; ++d) {
+                uint32_t def = access.defs[d];
+                for (uint32_t node: live.members()) {
+                    if (node != def && node != move_source) {
+                        addEdge(def, node);
+                    }
+                }
+            }
+            for (int d = 0; d < access.def_count; ++d) {
+                live.erase(access.defs[d]);
+                ++m_spill_cost[access.defs[d]];
+            }
+            for (int u = 0; u < access.use_count; ++u) {
+                live.insert(access.uses[u]);
+                ++m_spill_cost[access.uses[u]];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Merges the source and destination of moves where that cannot make the graph harder to color.
+ *
+ * @details Briggs' test for two pseudos: the merged node has fewer than K neighbours of significant degree.
+ *          George's test for a pseudo and a hard register: every neighbour of the pseudo already interferes with
+ *          the register or has insignificant degree. Merging can make other moves pass, so the moves are visited
+ *          again until none merges.
+ *
+ *          The merged node takes over the dropped node's edges. The dropped node is left in its neighbours'
+ *          adjacency lists, where it is skipped (it is no longer its own representative), and their degrees are
+ *          kept in m_degree.
+ * @return `true` if any move was coalesced.
+ */
+bool RegisterAllocator::coalesce() {
+    bool coalesced = false;
+    std::vector<uint32_t> merged_neighbours;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto &instruction: m_instructions) {
+            if (instruction->kind != Instruction::Kind::Mov) {
+                continue;
+            }
+            const auto &mov = static_cast<const assembly::Mov &>(*instruction);
+            uint32_t src = nodeOf(*mov.src);
+            uint32_t dst = nodeOf(*mov.dst);
+            if (src == kNoNode || dst == kNoNode) {
+                continue;
+            }
+            src = find(src);
+            dst = find(dst);
+            if (src == dst || interferes(src, dst) || (isHard(src) && isHard(dst))) {
+                continue;
+            }
+
+            uint32_t keep = isHard(src) ? src : dst;
+            uint32_t drop = keep == src ? dst : src;
+            auto merged = [this](uint32_t node) { return m_alias[node] != node; };
+            auto significant = [this](uint32_t node) { return isHard(node) || m_degree[node] >= K; };
+            bool safe;
+            if (isHard(keep)) {
+                safe = std::all_of(m_adjacency[drop].begin(), m_adjacency[drop].end(), [&](uint32_t t) {
+                    return merged(t) || interferes(t, keep) || !significant(t);
+                });
+            } else {
+                merged_neighbours.clear();
+                for (uint32_t t: m_adjacency[keep]) {
+                    if (!merged(t)) merged_neighbours.push_back(t);
+                }
+                for (uint32_t t: m_adjacency[drop]) {
+                    if (!merged(t) && !interferes(t, keep)) merged_neighbours.push_back(t);
+                }
+                size_t count = std::count_if(merged_neighbours.begin(), merged_neighbours.end(), significant);
+                safe = count < K;
+            }
+            if (!safe) {
+                continue;
+            }
+
+            for (uint32_t t: m_adjacency[drop]) {
+                if (!merged(t)) {
+                    --m_degree[t];
+                    addEdge(keep, t);
+                }
+            }
+            m_adjacency[drop].clear();
+            m_degree[drop] = 0;
+            m_spill_cost[keep] += m_spill_cost[drop];
+            m_alias[drop] = keep;
+            coalesced = changed = true;
+        }
+    }
+    return coalesced;
+}
+
+/**
+ * @brief Renames coalesced pseudos to their representative and drops the moves that became self-moves.
+ */
+void RegisterAllocator::rewriteCoalesced() {
+    for (auto &instruction: m_instructions) {
+        forEachOperand(*instruction, [this](std::unique_ptr<Operand> &operand) {
+            uint32_t node = nodeOf(*operand);
+            if (node == kNoNode || find(node) == node) {
+                return;
+            }
+            uint32_t target = find(node);
+            if (isHard(target)) {
+                operand = std::make_unique<assembly::Register>(kAllocatable[target]);
+            } else {
+                operand = std::make_unique<assembly::Pseudo>(target - K);
+            }
+        });
+        if (instruction->kind == Instruction::Kind::Mov) {
+            const auto &mov = static_cast<const assembly::Mov &>(*instruction);
+            uint32_t src = nodeOf(*mov.src);
+            if (src != kNoNode && src == nodeOf(*mov.dst)) {
+                instruction.reset();
+            }
+        }
+    }
+    std::erase(m_instructions, nullptr);
+}
+
+/**
+ * @brief Colors the graph by simplification with optimistic spilling (Briggs).
+ *
+ * @details Nodes of degree below K are removed first; when none is left, the pseudo with the lowest use count
+ *          per neighbour is removed optimistically. Nodes are then colored in reverse removal order, and a node
+ *          that finds no free color keeps no register and is later given a stack slot.
+ */
+void RegisterAllocator::color() {
+    m_color.assign(m_node_count, -1);
+    for (uint32_t i = 0; i < K; ++i) {
+        m_color[i] = static_cast<int>(i);
+    }
+
+    std::vector<size_t> degree(m_node_count);
+    std::vector<bool> removed(m_node_count, false);
+    std::vector<uint32_t> low;
+    auto spill_cost = [&](uint32_t node) {
+        return static_cast<double>(m_spill_cost[node]) / static_cast<double>(degree[node]);
+    };
+    // Spill candidates, cheapest first. A node's degree only falls while it waits, which only raises its
+    // cost, so an entry whose degree is out of date is pushed again with the new cost when it surfaces.
+    struct Candidate {
+        double cost;
+        uint32_t node;
+        size_t degree;
+    };
+    auto costlier = [](const Candidate &a, const Candidate &b) {
+        return a.cost != b.cost ? a.cost > b.cost : a.node > b.node;
+    };
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(costlier)> candidates(costlier);
+    for (uint32_t node = K; node < m_node_count; ++node) {
+        if (m_alias[node] != node || m_spill_cost[node] == 0) {
+            removed[node] = true;  // Coalesced away or unused
+            continue;
+        }
+        degree[node] = m_degree[node];
+        if (degree[node] < K) {
+            low.push_back(node);
+        } else {
+            candidates.push({spill_cost(node), node, degree[node]});
+        }
+    }
+
+    std::vector<uint32_t> stack;
+    auto remove = [&](uint32_t node) {
+        removed[node] = true;
+        stack.push_back(node);
+        for (uint32_t t: m_adjacency[node]) {
+            if (!isHard(t) && !removed[t] && degree[t]-- == K) {
+                low.push_back(t);
+            }
+        }
+    };
+    for (;;) {
+        if (!low.empty()) {
+            uint32_t node = low.back();
+            low.pop_back();
+            if (!removed[node]) remove(node);
+            continue;
+        }
+        if (candidates.empty()) {
+            break;
+        }
+        Candidate candidate = candidates.top();
+        candidates.pop();
+        if (removed[candidate.node]) {
+            continue;
+        }
+        if (candidate.degree != degree[candidate.node]) {
+            candidates.push({spill_cost(candidate.node), candidate.node, degree[candidate.node]});
+            continue;
+        }
+        remove(candidate.node);
+    }
+
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        uint32_t used = 0;
+        for (uint32_t t: m_adjacency[node]) {
+            if (m_color[t] >= 0) used |= 1u << m_color[t];
+        }
+        for (uint32_t c = 0; c < K; ++c) {
+            if (!(used & (1u << c))) {
+                m_color[node] = static_cast<int>(c);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Replaces every colored pseudo with its hard register; uncolored pseudos are left to be spilled.
+ */
+void RegisterAllocator::rewriteColored() {
+    for (auto &instruction: m_instructions) {
+        forEachOperand(*instruction, [this](std::unique_ptr<Operand> &operand) {
+            if (operand->kind != Operand::Kind::Pseudo) {
+                return;
+            }
+            int color = m_color[nodeOf(*operand)];
+            if (color >= 0) {
+                operand = std::make_unique<assembly::Register>(kAllocatable[color]);
+            }
+        });
+        if (instruction->kind == Instruction::Kind::Mov) {
+            const auto &mov = static_cast<const assembly::Mov &>(*instruction);
+            if (mov.src->kind == Operand::Kind::Register && mov.dst->kind == Operand::Kind::Register &&
+                static_cast<const assembly::Register &>(*mov.src).number ==
+                static_cast<const assembly::Register &>(*mov.dst).number) {
+                instruction.reset();
+            }
+        }
+    }
+    std::erase(m_instructions, nullptr);
+}
+
+void RegisterAllocator::addEdge(uint32_t a, uint32_t b) {
+    if (a == b || !m_edges.insert(edgeKey(a, b)).second) {
+        return;
+    }
+    m_adjacency[a].push_back(b);
+    m_adjacency[b].push_back(a);
+    ++m_degree[a];
+    ++m_degree[b];
+}
+
+bool RegisterAllocator::interferes(uint32_t a, uint32_t b) const {
+    return m_edges.count(edgeKey(a, b)) != 0;
+}
+
+bool RegisterAllocator::isHard(uint32_t node) const {
+    return node < K;
+}
+
+uint32_t RegisterAllocator::find(uint32_t node) {
+    while (m_alias[node] != node) {
+        m_alias[node] = m_alias[m_alias[node]];
+        node = m_alias[node];
+    }
+    return node;
+}
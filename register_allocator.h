@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include "assembly_ast.h"
+
+/**
+ * Graph-coloring register allocator (Chaitin/Briggs) over one function's instructions, run while operands are
+ * still pseudo-registers. Liveness is computed per basic block, moves are coalesced conservatively (Briggs for
+ * two pseudos, George against a hard register), and nodes that cannot be colored stay pseudos so the stack-slot
+ * pass spills them. Only caller-saved registers other than the %r10d/%r11d fixup scratch registers are handed
+ * out, so no save/restore code is needed.
+ */
+class RegisterAllocator {
+public:
+    using InstructionList = std::vector<std::unique_ptr<assembly::Instruction>>;
+
+    static void allocate(InstructionList &instructions, uint32_t pseudo_count);
+
+private:
+    RegisterAllocator(InstructionList &instructions, uint32_t pseudo_count);
+
+    void run();
+
+    void buildInterferenceGraph();
+
+    bool coalesce();
+
+    void rewriteCoalesced();
+
+    void color();
+
+    void rewriteColored();
+
+    void addEdge(uint32_t a, uint32_t b);
+
+    bool interferes(uint32_t a, uint32_t b) const;
+
+    bool isHard(uint32_t node) const;
+
+    uint32_t find(uint32_t node);
+
+    InstructionList &m_instructions;
+    uint32_t m_node_count;
+    std::vector<std::vector<uint32_t>> m_adjacency;  // May still list nodes since merged away
+    std::vector<uint32_t> m_degree;                   // Neighbours that have not been merged away
+    std::unordered_set<uint64_t> m_edges;
+    std::vector<uint32_t> m_alias;
+    std::vector<uint32_t> m_spill_cost;
+    std::vector<int> m_color;
+};
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ * Runtime benchmarks for the code mcc generates. Every program in the corpus directory is compiled with mcc and
+ * with gcc at -O0 and -O2, with `main` renamed to `bench_main` through -D so a timing driver can call it in a
+ * loop. Each binary runs pinned to one CPU, several times, and the median per-call time is reported along with
+ * cycle and instruction counts from perf_event_open where the kernel allows it. The return values must agree
+ * across compilers, so the corpus doubles as a correctness check.
+ */
+
+namespace {
+
+    // The timing driver, built once with gcc -O2. It prints: result ns/call cycles/call instructions/call, with
+    // -1 for counters that are unavailable.
+    const char *const kDriverSource = R"(
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int bench_main(void);
+
+static int openCounter(unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double perCall(int fd, long iterations) {
+    long long count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return (double) count / (double) iterations;
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    volatile int result = 0;
+    for (long i = 0; i < iterations / 10; ++i) result = bench_main();
+
+    int cycles = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+    int instructions = openCounter(PERF_COUNT_HW_INSTRUCTIONS);
+    struct timespec start, end;
+    if (cycles >= 0) ioctl(cycles, PERF_EVENT_IOC_ENABLE, 0);
+    if (instructions >= 0) ioctl(instructions, PERF_EVENT_IOC_ENABLE, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < iterations; ++i) result = bench_main();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (cycles >= 0) ioctl(cycles, PERF_EVENT_IOC_DISABLE, 0);
+    if (instructions >= 0) ioctl(instructions, PERF_EVENT_IOC_DISABLE, 0);
+
+    double ns = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+    printf("%d %.4f %.4f %.4f\n", result, ns / (double) iterations, perCall(cycles, iterations),
+           perCall(instructions, iterations));
+    return 0;
+}
+)";
+
+    struct Compiler {
+        std::string name;
+        bool is_mcc;
+        std::string flags;
+    };
+
+    const std::vector<Compiler> kCompilers = {
+            {"mcc", true, ""},
+            {"mcc --no-fold", true, "--no-fold"},
+            {"gcc -O0", false, "-O0"},
+            {"gcc -O2", false, "-O2"},
+    };
+
+    struct Options {
+        std::string mcc;
+        std::string corpus = MCC_RUNTIME_CORPUS;
+        long iterations = 10000000;
+        int repeat = 5;
+        int cpu = -1;  // -1 picks the last CPU the process may run on
+        std::string json_file;
+        bool keep = false;
+    };
+
+    struct Result {
+        std::string program;
+        std::string compiler;
+        int value = 0;
+        double ns = -1;       // Medians over the repetitions, per call
+        double cycles = -1;
+        double instructions = -1;
+    };
+
+    std::string quote(const std::string &text) {
+        std::string quoted = "'";
+        for (char c: text) {
+            quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+        }
+        return quoted + "'";
+    }
+
+    bool runCommand(const std::string &command) {
+        if (std::system((command + " >/dev/null 2>&1").c_str()) != 0) {
+            std::cerr << "Command failed: " << command << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /** Formats a per-call counter for the table; perf_event_open is often unavailable in containers. */
+    std::string counter(double value) {
+        if (value < 0) {
+            return "n/a";
+        }
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(3) << value;
+        return text.str();
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    /** Pins this process, and with it every benchmark it starts, to one CPU. */
+    int pinToCpu(int cpu) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return -1;
+        }
+        if (cpu < 0) {
+            for (int i = CPU_SETSIZE - 1; i >= 0; --i) {
+                if (CPU_ISSET(i, &allowed)) {
+                    cpu = i;
+                    break;
+                }
+            }
+        }
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        return sched_setaffinity(0, sizeof(one), &one) == 0 ? cpu : -1;
+    }
+
+    /**
+     * Runs one binary `repeat` times and fills in the medians.
+     */
+    bool measure(const Options &options, const std::string &binary, Result &result) {
+        std::vector<double> ns, cycles, instructions;
+        for (int run = 0; run < options.repeat; ++run) {
+            std::string command = quote(binary) + " " + std::to_string(options.iterations);
+            FILE *pipe = popen(command.c_str(), "r");
+            if (!pipe) {
+                return false;
+            }
+            Result sample;
+            int fields = std::fscanf(pipe, "%d %lf %lf %lf", &sample.value, &sample.ns, &sample.cycles,
+                                     &sample.instructions);
+            if (pclose(pipe) != 0 || fields != 4) {
+                std::cerr << "Benchmark failed: " << binary << std::endl;
+                return false;
+            }
+            result.value = sample.value;
+            ns.push_back(sample.ns);
+            cycles.push_back(sample.cycles);
+            instructions.push_back(sample.instructions);
+        }
+        result.ns = median(ns);
+        result.cycles = median(cycles);
+        result.instructions = median(instructions);
+        return true;
+    }
+
+    void writeJson(std::ostream &out, const Options &options, int cpu, const std::vector<Result> &results) {
+        out << "{\"iterations\": " << options.iterations << ", \"repeat\": " << options.repeat << ", \"cpu\": "
+            << cpu << ", \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &result = results[i];
+            out << (i ? ",\n  " : "\n  ") << "{\"program\": \"" << result.program << "\", \"compiler\": \""
+                << result.compiler << "\", \"value\": " << result.value << ", \"ns_per_call\": " << result.ns
+                << ", \"cycles_per_call\": " << result.cycles << ", \"instructions_per_call\": "
+                << result.instructions << "}";
+        }
+        out << "\n]}\n";
+    }
+
+    void printUsage() {
+        std::cout << "Usage: mcc_runtime_bench [options]" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  --mcc=<path>        The compiler to measure (default: mcc next to this program)" << std::endl;
+        std::cout << "  --corpus=<dir>      Directory of benchmark programs (default: the source tree's)"
+                  << std::endl;
+        std::cout << "  --iterations=<n>    Calls to main per run (default: 10000000)" << std::endl;
+        std::cout << "  --repeat=<n>        Runs per binary; the median is reported (default: 5)" << std::endl;
+        std::cout << "  --cpu=<n>           CPU to pin the benchmarks to (default: the last one available)"
+                  << std::endl;
+        std::cout << "  --json=<file>       Also write the results as JSON" << std::endl;
+        std::cout << "  --keep              Keep the build directory" << std::endl;
+    }
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    char self[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (length > 0) {
+        self[length] = '\0';
+        options.mcc = (std::filesystem::path(self).parent_path() / "mcc").string();
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--mcc=", 0) == 0) {
+            options.mcc = arg.substr(6);
+        } else if (arg.rfind("--corpus=", 0) == 0) {
+            options.corpus = arg.substr(9);
+        } else if (arg.rfind("--iterations=", 0) == 0) {
+            options.iterations = std::max(1L, std::strtol(arg.c_str() + 13, nullptr, 10));
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            options.repeat = std::max(1, std::atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--cpu=", 0) == 0) {
+            options.cpu = std::atoi(arg.c_str() + 6);
+        } else if (arg.rfind("--json=", 0) == 0) {
+            options.json_file = arg.substr(7);
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<std::filesystem::path> programs;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator(options.corpus, error)) {
+        if (entry.path().extension() == ".c") {
+            programs.push_back(entry.path());
+        }
+    }
+    if (programs.empty()) {
+        std::cerr << "No benchmark programs in " << options.corpus << std::endl;
+        return 1;
+    }
+    std::sort(programs.begin(), programs.end());
+
+    char directory_template[] = "/tmp/mcc_runtime_bench.XXXXXX";
+    if (!mkdtemp(directory_template)) {
+        std::cerr << "Unable to create a build directory" << std::endl;
+        return 1;
+    }
+    std::filesystem::path build = directory_template;
+    std::ofstream(build / "driver.c") << kDriverSource;
+    if (!runCommand("gcc -O2 -c " + quote((build / "driver.c").string()) + " -o " +
+                    quote((build / "driver.o").string()))) {
+        return 1;
+    }
+
+    int cpu = pinToCpu(options.cpu);
+    std::cout << "Pinned to CPU " << cpu << "; " << options.iterations << " calls per run, median of "
+              << options.repeat << " runs" << std::endl;
+    std::cout << std::left << std::setw(16) << "program" << std::setw(16) << "compiler" << std::right
+              << std::setw(8) << "value" << std::setw(12) << "ns/call" << std::setw(14) << "cycles/call"
+              << std::setw(14) << "instr/call" << std::setw(12) << "vs gcc -O2" << std::endl;
+
+    std::vector<Result> results;
+    bool ok = true;
+    for (const auto &program: programs) {
+        std::vector<Result> row;
+        for (size_t c = 0; c < kCompilers.size(); ++c) {
+            const Compiler &compiler = kCompilers[c];
+            std::string stem = program.stem().string() + "." + std::to_string(c);
+            std::string object = (build / (stem + ".o")).string();
+            std::string binary = (build / stem).string();
+            std::string compile = compiler.is_mcc
+                                  ? quote(options.mcc) + " -c " + compiler.flags + " -Dmain=bench_main " +
+                                    quote(program.string()) + " " + quote(object)
+                                  : "gcc -c " + compiler.flags + " -Dmain=bench_main " + quote(program.string()) +
+                                    " -o " + quote(object);
+            Result result;
+            result.program = program.stem().string();
+            result.compiler = compiler.name;
+            if (!runCommand(compile) ||
+                !runCommand("gcc " + quote((build / "driver.o").string()) + " " + quote(object) + " -o " +
+                            quote(binary)) ||
+                !measure(options, binary, result)) {
+                ok = false;
+                continue;
+            }
+            row.push_back(result);
+        }
+
+        double baseline = -1;
+        for (const auto &result: row) {
+            if (result.compiler == "gcc -O2") {
+                baseline = result.ns;
+            }
+        }
+        for (const auto &result: row) {
+            std::cout << std::left << std::setw(16) << result.program << std::setw(16) << result.compiler
+                      << std::right << std::setw(8) << result.value << std::fixed << std::setprecision(3)
+                      << std::setw(12) << result.ns << std::setw(14) << counter(result.cycles) << std::setw(14)
+                      << counter(result.instructions);
+            if (baseline > 0) {
+                std::cout << std::setw(11) << result.ns / baseline << "x";
+            }
+            std::cout << std::endl;
+            if (result.value != row.front().value) {
+                std::cerr << result.program << ": " << result.compiler << " returned " << result.value << ", "
+                          << row.front().compiler << " returned " << row.front().value << std::endl;
+                ok = false;
+            }
+            results.push_back(result);
+        }
+    }
+
+    if (!options.json_file.empty()) {
+        std::ofstream json(options.json_file);
+        writeJson(json, options, cpu, results);
+        if (!json.flush()) {
+            std::cerr << "Unable to write " << options.json_file << std::endl;
+            ok = false;
+        }
+    }
+    if (options.keep) {
+        std::cout << "Build directory: " << build.string() << std::endl;
+    } else {
+        std::filesystem::remove_all(build, error);
+    }
+    return ok ? 0 : 1;
+}
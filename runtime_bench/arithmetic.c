@@ -0,0 +1,4 @@
+/* Additive and multiplicative chains over small constants. */
+int main(void) {
+    return (((3 + 4) * (12 - 5) + (9 * 9 - 17)) * 2 - ((6 * 7) + (8 - 3) * 4)) % 251;
+}
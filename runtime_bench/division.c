@@ -0,0 +1,4 @@
+/* Division and remainder, which lower to idiv with its fixed registers. */
+int main(void) {
+    return ((1000 / 7) % 13 + (4096 / 3) / 11 - (999 % 37) * (500 / 9) % 17) / 2 + 50;
+}
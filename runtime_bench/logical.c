@@ -0,0 +1,4 @@
+/* Short-circuit && and || chains, which lower to conditional jumps. */
+int main(void) {
+    return ((1 && 2) || (0 && 3)) + ((0 || 0) || (5 && 0)) * 4 + (((7 || 0) && (0 || 8)) && (9 && 10)) * 16;
+}
@@ -0,0 +1,5 @@
+/* A deep mix of every operator, to stress register allocation. */
+int main(void) {
+    return ((((1 + 2) * (3 + 4)) - ((5 * 6) / (7 - 5))) + (((8 % 5) * (9 - 6)) < ((10 / 3) + (11 % 4))) *
+            (((12 - 4) * 2) + ((13 > 7) && (14 != 15)))) % 200 + (-(~(16 * 2)) - !(17 - 17)) * ((18 <= 19) || 0);
+}
@@ -0,0 +1,4 @@
+/* Comparisons, which lower to cmp and setcc. */
+int main(void) {
+    return (3 < 4) + (5 <= 5) * 2 + (7 > 9) * 4 + (8 >= 1) * 8 + (2 == 2) * 16 + (6 != 6) * 32 + ((1 < 2) == (3 > 4));
+}
@@ -0,0 +1,4 @@
+/* Negation, bitwise complement and logical not, nested. */
+int main(void) {
+    return -(-(~(~42))) + !(!(7)) + ~(-(5)) + -(~(!(0))) + !(-(3));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Incremental SHA-256 (FIPS 180-4), used to key the compilation cache.
+ */
+class Sha256 {
+public:
+    using Digest = std::array<uint8_t, 32>;
+
+    Sha256();
+
+    void update(const void *data, size_t size);
+
+    void update(std::string_view text) { update(text.data(), text.size()); }
+
+    Digest finish();
+
+    static std::string toHex(const Digest &digest);
+
+private:
+    void compress(const uint8_t *block);
+
+    std::array<uint32_t, 8> m_state;
+    std::array<uint8_t, 64> m_block{};
+    size_t m_block_size = 0;
+    uint64_t m_length = 0;
+};
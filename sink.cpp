@@ -0,0 +1,95 @@
+#include "sink.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+/**
+ * @brief Creates a sink that writes to a file descriptor.
+ *
+ * @param fd The descriptor; the sink does not close it.
+ * @param capacity The buffer size in bytes.
+ */
+Sink::Sink(int fd, size_t capacity)
+        : m_fd(fd), m_string(nullptr), m_buffer(new char[capacity]), m_capacity(capacity) {}
+
+/**
+ * @brief Creates a sink that appends to a string.
+ *
+ * @param out The string; it must outlive the sink.
+ * @param capacity The buffer size in bytes.
+ */
+Sink::Sink(std::string &out, size_t capacity)
+        : m_fd(-1), m_string(&out), m_buffer(new char[capacity]), m_capacity(capacity) {}
+
+/**
+ * @brief Flushes what is left in the buffer. Errors are dropped here; call flush() first to see them.
+ */
+Sink::~Sink() {
+    try {
+        flush();
+    } catch (const std::exception &) {
+    }
+}
+
+Sink &Sink::operator<<(std::string_view text) {
+    if (text.size() > m_capacity - m_size) {
+        flush();
+        if (text.size() >= m_capacity) {
+            write(text.data(), text.size());
+            return *this;
+        }
+    }
+    std::memcpy(m_buffer.get() + m_size, text.data(), text.size());
+    m_size += text.size();
+    return *this;
+}
+
+Sink &Sink::operator<<(int32_t value) {
+    if (m_capacity - m_size < 11) {
+        flush();
+    }
+    auto result = std::to_chars(m_buffer.get() + m_size, m_buffer.get() + m_capacity, value);
+    m_size = result.ptr - m_buffer.get();
+    return *this;
+}
+
+Sink &Sink::operator<<(uint32_t value) {
+    if (m_capacity - m_size < 10) {
+        flush();
+    }
+    auto result = std::to_chars(m_buffer.get() + m_size, m_buffer.get() + m_capacity, value);
+    m_size = result.ptr - m_buffer.get();
+    return *this;
+}
+
+/**
+ * @brief Writes out the buffered text.
+ *
+ * @throws std::runtime_error if the descriptor cannot be written, e.g. because the disk is full or the
+ *         assembler at the other end of a pipe has exited.
+ */
+void Sink::flush() {
+    size_t size = m_size;
+    m_size = 0;
+    write(m_buffer.get(), size);
+}
+
+void Sink::write(const char *data, size_t size) {
+    if (m_string) {
+        m_string->append(data, size);
+        return;
+    }
+    while (size > 0) {
+        ssize_t written = ::write(m_fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Unable to write output: ") + std::strerror(errno));
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * Buffered text output for the assembly emitter. Text is appended to one fixed buffer that is written out to a
+ * file descriptor (a file, or a pipe into the assembler) or appended to a string whenever it fills up, so
+ * emitting a program allocates nothing per instruction. Integers are formatted in place with std::to_chars.
+ */
+class Sink {
+public:
+    static constexpr size_t kDefaultCapacity = 256 * 1024;
+
+    explicit Sink(int fd, size_t capacity = kDefaultCapacity);
+
+    explicit Sink(std::string &out, size_t capacity = kDefaultCapacity);
+
+    Sink(const Sink &) = delete;
+
+    Sink &operator=(const Sink &) = delete;
+
+    ~Sink();
+
+    Sink &operator<<(std::string_view text);
+
+    Sink &operator<<(const char *text) { return *this << std::string_view(text); }
+
+    Sink &operator<<(char c) {
+        if (m_size == m_capacity) {
+            flush();
+        }
+        m_buffer[m_size++] = c;
+        return *this;
+    }
+
+    Sink &operator<<(int32_t value);
+
+    Sink &operator<<(uint32_t value);
+
+    void flush();
+
+private:
+    void write(const char *data, size_t size);
+
+    int m_fd;
+    std::string *m_string;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_capacity;
+    size_t m_size = 0;
+};
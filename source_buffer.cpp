@@ -0,0 +1,150 @@
+#include "source_buffer.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept {
+    *this = std::move(other);
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        m_mapped = other.m_mapped;
+        m_size = other.m_size;
+        m_owned = std::move(other.m_owned);
+        m_data = m_mapped ? other.m_data : m_owned.data();
+        m_line_starts = std::move(other.m_line_starts);
+        other.m_data = "";
+        other.m_size = 0;
+        other.m_mapped = false;
+    }
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+    release();
+}
+
+void SourceBuffer::release() {
+    if (m_mapped) {
+        munmap(const_cast<char *>(m_data), m_size);
+        m_mapped = false;
+    }
+    m_data = "";
+    m_size = 0;
+    m_owned.clear();
+    m_line_starts.clear();
+}
+
+/**
+ * @brief Maps a file read-only into memory.
+ *
+ * @details Empty files are represented without a mapping, since mmap rejects zero-length requests.
+ *
+ * @param path The path of the file to map.
+ * @return A buffer viewing the whole file.
+ * @throws std::runtime_error if the file cannot be opened or mapped, or is too large to be addressed by a
+ *         SourceLocation.
+ */
+SourceBuffer SourceBuffer::mapFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file " + path);
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Unable to stat file " + path);
+    }
+
+    if (static_cast<uint64_t>(st.st_size) > UINT32_MAX) {
+        ::close(fd);
+        throw std::runtime_error("File " + path + " is too large (source locations are 32-bit)");
+    }
+
+    SourceBuffer buffer;
+    if (st.st_size > 0) {
+        void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Unable to map file " + path);
+        }
+        buffer.m_data = static_cast<const char *>(data);
+        buffer.m_size = static_cast<size_t>(st.st_size);
+        buffer.m_mapped = true;
+    }
+    ::close(fd);
+    return buffer;
+}
+
+/**
+ * @brief Wraps text that already lives in memory.
+ *
+ * @param text The source text; the buffer takes ownership of it.
+ * @return A buffer viewing the text.
+ * @throws std::runtime_error if the text is too large to be addressed by a SourceLocation.
+ */
+SourceBuffer SourceBuffer::fromString(std::string text) {
+    if (text.size() > UINT32_MAX) {
+        throw std::runtime_error("Source text is too large (source locations are 32-bit)");
+    }
+    SourceBuffer buffer;
+    buffer.m_owned = std::move(text);
+    buffer.m_data = buffer.m_owned.data();
+    buffer.m_size = buffer.m_owned.size();
+    return buffer;
+}
+
+/**
+ * @brief Records the offset at which every line starts.
+ *
+ * @details Only called the first time a diagnostic asks for a line or column, so lexing never pays for it.
+ */
+void SourceBuffer::buildLineTable() const {
+    m_line_starts.push_back(0);
+    const char *cursor = m_data;
+    const char *end = m_data + m_size;
+    while (const auto *newline = static_cast<const char *>(std::memchr(cursor, '\n', end - cursor))) {
+        m_line_starts.push_back(static_cast<uint32_t>(newline + 1 - m_data));
+        cursor = newline + 1;
+    }
+}
+
+/**
+ * @brief Converts a byte offset into a 1-based line and column.
+ *
+ * @param location The location to convert.
+ * @return The line and column of the location.
+ */
+LineColumn SourceBuffer::lineColumn(SourceLocation location) const {
+    if (m_line_starts.empty()) {
+        buildLineTable();
+    }
+    auto next_line = std::upper_bound(m_line_starts.begin(), m_line_starts.end(), location.offset);
+    auto line = static_cast<uint32_t>(next_line - m_line_starts.begin());
+    return {line, location.offset - m_line_starts[line - 1] + 1};
+}
+
+/**
+ * @brief Returns the text of a line, without its terminating newline.
+ *
+ * @param line The 1-based line number.
+ * @return The line's text, or an empty view if the line does not exist.
+ */
+std::string_view SourceBuffer::lineText(uint32_t line) const {
+    if (m_line_starts.empty()) {
+        buildLineTable();
+    }
+    if (line == 0 || line > m_line_starts.size()) {
+        return {};
+    }
+    uint32_t begin = m_line_starts[line - 1];
+    uint32_t end = line < m_line_starts.size() ? m_line_starts[line] - 1 : static_cast<uint32_t>(m_size);
+    return text().substr(begin, end - begin);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "source_location.h"
+
+/**
+ * Read-only view of a translation unit's text. Files are memory-mapped so the lexer and the tokens it produces
+ * can slice the mapping directly instead of copying the file into a std::string.
+ */
+class SourceBuffer {
+public:
+    SourceBuffer() = default;
+
+    SourceBuffer(const SourceBuffer &) = delete;
+
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    SourceBuffer(SourceBuffer &&other) noexcept;
+
+    SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+
+    ~SourceBuffer();
+
+    static SourceBuffer mapFile(const std::string &path);
+
+    static SourceBuffer fromString(std::string text);
+
+    std::string_view text() const { return {m_data, m_size}; }
+
+    size_t size() const { return m_size; }
+
+    LineColumn lineColumn(SourceLocation location) const;
+
+    std::string_view lineText(uint32_t line) const;
+
+private:
+    void release();
+
+    void buildLineTable() const;
+
+    const char *m_data = "";
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_owned;
+    mutable std::vector<uint32_t> m_line_starts;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Byte offset into a SourceBuffer. Lines and columns are only computed when a diagnostic needs them
+ * (see SourceBuffer::lineColumn), so carrying a location costs four bytes and no work on the hot path.
+ */
+struct SourceLocation {
+    uint32_t offset = 0;
+};
+
+struct LineColumn {
+    uint32_t line = 1;
+    uint32_t column = 1;
+};
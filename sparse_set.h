@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A set of integers below a fixed bound, with constant-time insert, erase, lookup and clear, and iteration in
+ * time proportional to the number of members rather than to the bound (Briggs and Torczon). Suited to live sets,
+ * which are sparse but are cleared and refilled once per basic block.
+ */
+class SparseSet {
+public:
+    explicit SparseSet(size_t bound = 0) : m_index(bound) {}
+
+    bool contains(uint32_t value) const {
+        uint32_t index = m_index[value];
+        return index < m_members.size() && m_members[index] == value;
+    }
+
+    void insert(uint32_t value) {
+        if (!contains(value)) {
+            m_index[value] = static_cast<uint32_t>(m_members.size());
+            m_members.push_back(value);
+        }
+    }
+
+    void erase(uint32_t value) {
+        if (contains(value)) {
+            uint32_t last = m_members.back();
+            m_index[last] = m_index[value];
+            m_members[m_index[value]] = last;
+            m_members.pop_back();
+        }
+    }
+
+    void clear() { m_members.clear(); }
+
+    size_t size() const { return m_members.size(); }
+
+    /** The members, in no particular order. */
+    const std::vector<uint32_t> &members() const { return m_members; }
+
+private:
+    std::vector<uint32_t> m_index;  // Where each value would sit in m_members; only trusted if it points back
+    std::vector<uint32_t> m_members;
+};
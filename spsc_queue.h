@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Bounded queue between exactly one producer thread and one consumer thread. Items move in batches; the fast
+ * path is two atomic indices, each side caching the other's so it rarely touches the other's cache line. A side
+ * that finds the queue full (or empty) yields briefly and then sleeps on a condition variable, which the other
+ * side only signals when someone is actually asleep.
+ *
+ * The producer calls `close` after its last item. The consumer can call `cancel` to make further pushes fail,
+ * so a producer never stays blocked on a consumer that gave up.
+ */
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+            : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 2))), m_items(new T[m_capacity]) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /** Producer: appends `count` items, blocking while the queue is full. Returns false once cancelled. */
+    bool push(const T *items, size_t count) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        while (count > 0) {
+            if (tail - m_cached_head == m_capacity) {
+                m_cached_head = m_head.load(std::memory_order_acquire);
+                if (tail - m_cached_head == m_capacity) {
+                    block(m_producer_waiting, [&] {
+                        return m_head.load() != m_cached_head || m_cancelled.load();
+                    });
+                    if (m_cancelled.load()) {
+                        return false;
+                    }
+                    continue;
+                }
+            }
+            size_t batch = std::min(count, m_capacity - (tail - m_cached_head));
+            for (size_t i = 0; i < batch; ++i) {
+                m_items[(tail + i) & (m_capacity - 1)] = items[i];
+            }
+            tail += batch;
+            items += batch;
+            count -= batch;
+            m_tail.store(tail);
+            wake(m_consumer_waiting);
+        }
+        return !m_cancelled.load(std::memory_order_relaxed);
+    }
+
+    /** Consumer: takes up to `max` items, blocking until there is one. Returns 0 once closed and drained. */
+    size_t pop(T *out, size_t max) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail) {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail) {
+                block(m_consumer_waiting, [&] { return m_tail.load() != head || m_closed.load(); });
+                m_cached_tail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cached_tail) {
+                    return 0;
+                }
+            }
+        }
+        size_t count = std::min(max, m_cached_tail - head);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = std::move(m_items[(head + i) & (m_capacity - 1)]);
+        }
+        m_head.store(head + count);
+        wake(m_producer_waiting);
+        return count;
+    }
+
+    /** Producer: no more items will be pushed. */
+    void close() {
+        m_closed.store(true);
+        wake(m_consumer_waiting);
+    }
+
+    /** Consumer: no more items will be popped. */
+    void cancel() {
+        m_cancelled.store(true);
+        wake(m_producer_waiting);
+    }
+
+private:
+    // The sleeper publishes its flag before rechecking, and the waker publishes its index before reading the
+    // flag (both sequentially consistent), so at least one of them sees the other and no wakeup is lost
+    template<typename Ready>
+    void block(std::atomic<bool> &waiting, Ready ready) {
+        for (int spin = 0; spin < 16; ++spin) {
+            if (ready()) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+        std::unique_lock lock(m_mutex);
+        waiting.store(true);
+        m_wakeup.wait(lock, ready);
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<bool> &waiting) {
+        if (waiting.load()) {
+            std::lock_guard lock(m_mutex);
+            m_wakeup.notify_all();
+        }
+    }
+
+    const size_t m_capacity;
+    std::unique_ptr<T[]> m_items;
+
+    alignas(64) std::atomic<size_t> m_head{0};  // Written by the consumer
+    size_t m_cached_tail = 0;
+    alignas(64) std::atomic<size_t> m_tail{0};  // Written by the producer
+    size_t m_cached_head = 0;
+
+    alignas(64) std::atomic<bool> m_closed{false};
+    std::atomic<bool> m_cancelled{false};
+    std::atomic<bool> m_producer_waiting{false};
+    std::atomic<bool> m_consumer_waiting{false};
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+};
@@ -0,0 +1,63 @@
+#include "synthetic_source.h"
+
+namespace {
+
+    constexpr int kMaxDepth = 6;
+
+    const char *const kUnaryOperators[] = {"-", "~", "!"};
+    const char *const kBinaryOperators[] = {"+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+
+} // namespace
+
+/**
+ * @brief Generates a translation unit of at least `target_bytes` bytes, ending with `main`.
+ */
+std::string SyntheticSource::generate(size_t target_bytes) {
+    std::string out;
+    out.reserve(target_bytes + 1024);
+    out += "/* Synthetic benchmark input */\n";
+    for (size_t function = 0; out.size() < target_bytes; ++function) {
+        if (function % 8 == 0) {
+            out += "\n/*\n * Functions " + std::to_string(function) + " to " + std::to_string(function + 7) +
+                   "\n */\n";
+        }
+        out += "int f" + std::to_string(function) + "(void) {\n    // Expression tree\n    return ";
+        appendExpression(out, kMaxDepth);
+        out += ";\n}\n";
+    }
+    out += "int main(void) { return 0; }\n";
+    return out;
+}
+
+void SyntheticSource::appendExpression(std::string &out, int depth) {
+    uint32_t choice = next() % 8;
+    if (depth == 0 || choice == 0) {
+        out += std::to_string(next() % 1000);
+    } else if (choice == 1) {
+        out += kUnaryOperators[next() % 3];
+        out += '(';
+        appendExpression(out, depth - 1);
+        out += ')';
+    } else {
+        const char *op = kBinaryOperators[next() % 13];
+        out += '(';
+        appendExpression(out, depth - 1);
+        out += ' ';
+        out += op;
+        out += ' ';
+        if (op[0] == '/' || op[0] == '%') {
+            out += std::to_string(1 + next() % 97);
+        } else {
+            appendExpression(out, depth - 1);
+        }
+        out += ')';
+    }
+}
+
+/** xorshift64*: fast, and the same sequence on every platform. */
+uint32_t SyntheticSource::next() {
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return static_cast<uint32_t>((m_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Generates C translation units of a requested size for benchmarking: many `int fN(void)` functions that
+ * return random expression trees over every operator the compiler supports, with comments in between. The
+ * same seed and size always give the same text. Divisors are non-zero constants, so the programs are valid.
+ */
+class SyntheticSource {
+public:
+    explicit SyntheticSource(uint64_t seed = 1) : m_state(seed ? seed : 1) {}
+
+    std::string generate(size_t target_bytes);
+
+private:
+    void appendExpression(std::string &out, int depth);
+
+    uint32_t next();
+
+    uint64_t m_state;
+};
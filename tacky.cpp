@@ -0,0 +1,113 @@
+#include "tacky.h"
+#include <sstream>
+
+namespace tacky {
+
+    namespace {
+
+        std::string indentString(int indent) {
+            return std::string(indent * 2, ' ');
+        }
+
+        std::string valString(const Val &val) {
+            if (val.isConstant()) {
+                return "Constant(" + std::to_string(val.value) + ")";
+            }
+            return "Var(tmp." + std::to_string(val.value) + ")";
+        }
+
+        const char *opcodeName(Opcode opcode) {
+            switch (opcode) {
+                case Opcode::Return:
+                    return "Return";
+                case Opcode::Copy:
+                    return "Copy";
+                case Opcode::Negate:
+                    return "Negate";
+                case Opcode::Complement:
+                    return "Complement";
+                case Opcode::Not:
+                    return "Not";
+                case Opcode::Add:
+                    return "Add";
+                case Opcode::Subtract:
+                    return "Subtract";
+                case Opcode::Multiply:
+                    return "Multiply";
+                case Opcode::Divide:
+                    return "Divide";
+                case Opcode::Remainder:
+                    return "Remainder";
+                case Opcode::Equal:
+                    return "Equal";
+                case Opcode::NotEqual:
+                    return "NotEqual";
+                case Opcode::LessThan:
+                    return "LessThan";
+                case Opcode::LessOrEqual:
+                    return "LessOrEqual";
+                case Opcode::GreaterThan:
+                    return "GreaterThan";
+                case Opcode::GreaterOrEqual:
+                    return "GreaterOrEqual";
+                case Opcode::Jump:
+                    return "Jump";
+                case Opcode::JumpIfZero:
+                    return "JumpIfZero";
+                case Opcode::JumpIfNotZero:
+                    return "JumpIfNotZero";
+                case Opcode::Label:
+                    return "Label";
+            }
+            return "Unknown";
+        }
+
+        std::string instructionString(const Instruction &instruction) {
+            std::string result = opcodeName(instruction.opcode);
+            std::string label = "L" + std::to_string(instruction.label);
+            switch (instruction.opcode) {
+                case Opcode::Return:
+                    return result + "(" + valString(instruction.src1) + ")";
+                case Opcode::Copy:
+                case Opcode::Negate:
+                case Opcode::Complement:
+                case Opcode::Not:
+                    return result + "(" + valString(instruction.src1) + ", " + valString(instruction.dst) + ")";
+                case Opcode::Jump:
+                case Opcode::Label:
+                    return result + "(" + label + ")";
+                case Opcode::JumpIfZero:
+                case Opcode::JumpIfNotZero:
+                    return result + "(" + valString(instruction.src1) + ", " + label + ")";
+                default:
+                    return result + "(" + valString(instruction.src1) + ", " + valString(instruction.src2) + ", " +
+                           valString(instruction.dst) + ")";
+            }
+        }
+
+    } // namespace
+
+    std::string Function::prettyPrint(int indent) const {
+        std::ostringstream oss;
+        oss << indentString(indent) << "Function(\n"
+            << indentString(indent + 1) << "name=\"" << name << "\",\n"
+            << indentString(indent + 1) << "instructions=[\n";
+        for (const auto &instruction: instructions) {
+            oss << indentString(indent + 2) << instructionString(instruction) << ",\n";
+        }
+        oss << indentString(indent + 1) << "]\n"
+            << indentString(indent) << ")";
+        return oss.str();
+    }
+
+    std::string Program::prettyPrint(int indent) const {
+        std::ostringstream oss;
+        oss << indentString(indent) << "Program(\n";
+        for (size_t i = 0; i < functions.size(); ++i) {
+            oss << functions[i].prettyPrint(indent + 1) << (i + 1 < functions.size() ? ",\n" : "\n");
+        }
+        oss << indentString(indent) << ")";
+        return oss.str();
+    }
+
+} // namespace tacky
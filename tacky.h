@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * TACKY: a flat three-address IR between the AST and assembly. A function is a plain vector of fixed-size
+ * instructions whose operands are constants or numbered variables, so passes can scan and rewrite it in place.
+ */
+namespace tacky {
+
+    enum class ValKind : uint8_t {
+        Constant,
+        Var
+    };
+
+    struct Val {
+        ValKind kind;
+        int32_t value;  // The constant, or the variable number
+
+        static Val constant(int32_t value) {
+            return {ValKind::Constant, value};
+        }
+
+        static Val var(uint32_t id) {
+            return {ValKind::Var, static_cast<int32_t>(id)};
+        }
+
+        bool isConstant() const { return kind == ValKind::Constant; }
+
+        bool operator==(const Val &other) const = default;
+    };
+
+    enum class Opcode : uint8_t {
+        Return,         // return src1
+        Copy,           // dst = src1
+        Negate,         // dst = -src1
+        Complement,     // dst = ~src1
+        Not,            // dst = !src1
+        Add,            // dst = src1 + src2, and so on for the binary operators
+        Subtract,
+        Multiply,
+        Divide,
+        Remainder,
+        Equal,
+        NotEqual,
+        LessThan,
+        LessOrEqual,
+        GreaterThan,
+        GreaterOrEqual,
+        Jump,           // goto label
+        JumpIfZero,     // if (src1 == 0) goto label
+        JumpIfNotZero,  // if (src1 != 0) goto label
+        Label           // label:
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        Val src1{};
+        Val src2{};
+        Val dst{};
+        uint32_t label = 0;
+
+        static Instruction makeReturn(Val value) {
+            return {Opcode::Return, value};
+        }
+
+        static Instruction makeCopy(Val src, Val dst) {
+            return {Opcode::Copy, src, {}, dst};
+        }
+
+        static Instruction makeUnary(Opcode opcode, Val src, Val dst) {
+            return {opcode, src, {}, dst};
+        }
+
+        static Instruction makeBinary(Opcode opcode, Val src1, Val src2, Val dst) {
+            return {opcode, src1, src2, dst};
+        }
+
+        static Instruction makeJump(uint32_t label) {
+            return {Opcode::Jump, {}, {}, {}, label};
+        }
+
+        static Instruction makeJumpIfZero(Val condition, uint32_t label) {
+            return {Opcode::JumpIfZero, condition, {}, {}, label};
+        }
+
+        static Instruction makeJumpIfNotZero(Val condition, uint32_t label) {
+            return {Opcode::JumpIfNotZero, condition, {}, {}, label};
+        }
+
+        static Instruction makeLabel(uint32_t label) {
+            return {Opcode::Label, {}, {}, {}, label};
+        }
+    };
+
+    struct Function {
+        std::string name;
+        std::vector<Instruction> instructions;
+        uint32_t var_count = 0;
+        uint32_t label_count = 0;
+
+        Val makeTemporary() { return Val::var(var_count++); }
+
+        uint32_t makeLabel() { return label_count++; }
+
+        std::string prettyPrint(int indent = 0) const;
+    };
+
+    struct Program {
+        std::vector<Function> functions;
+
+        std::string prettyPrint(int indent = 0) const;
+    };
+
+} // namespace tacky
@@ -0,0 +1,150 @@
+#include "tacky_gen.h"
+#include <stdexcept>
+
+/**
+ * @brief Lowers an AST to TACKY.
+ *
+ * @param ast The abstract syntax tree representing the program.
+ * @return The TACKY program.
+ */
+tacky::Program TackyGen::generate(const Program &ast) {
+    tacky::Program program;
+    program.functions.reserve(ast.functions.size());
+    for (const Function *function: ast.functions) {
+        program.functions.push_back(generate(*function));
+    }
+    return program;
+}
+
+/**
+ * @brief Lowers one function to TACKY.
+ *
+ * @details Functions are lowered independently, so a pipelined compile can lower each one as soon as it is
+ *          parsed, while the parser keeps adding later functions to the same arena.
+ *
+ * @param function The function's AST.
+ * @return The TACKY function.
+ */
+tacky::Function TackyGen::generate(const Function &function) {
+    tacky::Function result;
+    result.name = std::string(function.name);
+    TackyGen generator(result);
+    generator.generateStatement(*function.body);
+    return result;
+}
+
+/**
+ * @brief Appends the instructions for a statement to the current function.
+ *
+ * @param statement The statement AST node.
+ */
+void TackyGen::generateStatement(const Statement &statement) {
+    switch (statement.kind) {
+        case ASTNode::Kind::Return: {
+            const auto &returnStmt = static_cast<const Return &>(statement);
+            m_function.instructions.push_back(tacky::Instruction::makeReturn(generateExpression(*returnStmt.exp)));
+            return;
+        }
+        default:
+            throw std::runtime_error("Unsupported statement type");
+    }
+}
+
+/**
+ * @brief Appends the instructions computing an expression and returns the value holding its result.
+ *
+ * @param exp The expression AST node.
+ * @return The constant or variable holding the expression's value.
+ */
+tacky::Val TackyGen::generateExpression(const Exp &exp) {
+    switch (exp.kind) {
+        case ASTNode::Kind::Constant:
+            return tacky::Val::constant(static_cast<const Constant &>(exp).value);
+        case ASTNode::Kind::Unary: {
+            const auto &unary = static_cast<const Unary &>(exp);
+            tacky::Val src = generateExpression(*unary.operand);
+            tacky::Val dst = m_function.makeTemporary();
+            m_function.instructions.push_back(tacky::Instruction::makeUnary(unaryOpcode(unary.op), src, dst));
+            return dst;
+        }
+        case ASTNode::Kind::Binary: {
+            const auto &binary = static_cast<const Binary &>(exp);
+            if (binary.op == BinaryOperator::And || binary.op == BinaryOperator::Or) {
+                return generateShortCircuit(binary);
+            }
+            tacky::Val src1 = generateExpression(*binary.left);
+            tacky::Val src2 = generateExpression(*binary.right);
+            tacky::Val dst = m_function.makeTemporary();
+            m_function.instructions.push_back(
+                    tacky::Instruction::makeBinary(binaryOpcode(binary.op), src1, src2, dst));
+            return dst;
+        }
+        default:
+            throw std::runtime_error("Unsupported expression type");
+    }
+}
+
+/**
+ * @brief Lowers `&&` and `||` to conditional jumps so the right operand is only evaluated when needed.
+ *
+ * @param binary The logical AND or OR node.
+ * @return The variable holding the 0/1 result.
+ */
+tacky::Val TackyGen::generateShortCircuit(const Binary &binary) {
+    bool is_and = binary.op == BinaryOperator::And;
+    auto jump = is_and ? tacky::Instruction::makeJumpIfZero : tacky::Instruction::makeJumpIfNotZero;
+    uint32_t short_circuit = m_function.makeLabel();
+    uint32_t end = m_function.makeLabel();
+    tacky::Val dst = m_function.makeTemporary();
+    auto &instructions = m_function.instructions;
+
+    instructions.push_back(jump(generateExpression(*binary.left), short_circuit));
+    instructions.push_back(jump(generateExpression(*binary.right), short_circuit));
+    instructions.push_back(tacky::Instruction::makeCopy(tacky::Val::constant(is_and ? 1 : 0), dst));
+    instructions.push_back(tacky::Instruction::makeJump(end));
+    instructions.push_back(tacky::Instruction::makeLabel(short_circuit));
+    instructions.push_back(tacky::Instruction::makeCopy(tacky::Val::constant(is_and ? 0 : 1), dst));
+    instructions.push_back(tacky::Instruction::makeLabel(end));
+    return dst;
+}
+
+tacky::Opcode TackyGen::unaryOpcode(UnaryOperator op) {
+    switch (op) {
+        case UnaryOperator::Negate:
+            return tacky::Opcode::Negate;
+        case UnaryOperator::Complement:
+            return tacky::Opcode::Complement;
+        case UnaryOperator::Not:
+            return tacky::Opcode::Not;
+    }
+    throw std::runtime_error("Unsupported unary operator");
+}
+
+tacky::Opcode TackyGen::binaryOpcode(BinaryOperator op) {
+    switch (op) {
+        case BinaryOperator::Add:
+            return tacky::Opcode::Add;
+        case BinaryOperator::Subtract:
+            return tacky::Opcode::Subtract;
+        case BinaryOperator::Multiply:
+            return tacky::Opcode::Multiply;
+        case BinaryOperator::Divide:
+            return tacky::Opcode::Divide;
+        case BinaryOperator::Remainder:
+            return tacky::Opcode::Remainder;
+        case BinaryOperator::Equal:
+            return tacky::Opcode::Equal;
+        case BinaryOperator::NotEqual:
+            return tacky::Opcode::NotEqual;
+        case BinaryOperator::LessThan:
+            return tacky::Opcode::LessThan;
+        case BinaryOperator::LessOrEqual:
+            return tacky::Opcode::LessOrEqual;
+        case BinaryOperator::GreaterThan:
+            return tacky::Opcode::GreaterThan;
+        case BinaryOperator::GreaterOrEqual:
+            return tacky::Opcode::GreaterOrEqual;
+        default:
+            throw std::runtime_error("Logical operators are lowered with jumps");
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "ast.h"
+#include "tacky.h"
+
+class TackyGen {
+public:
+    static tacky::Program generate(const Program &ast);
+
+    static tacky::Function generate(const Function &function);
+
+private:
+    explicit TackyGen(tacky::Function &function) : m_function(function) {}
+
+    void generateStatement(const Statement &statement);
+
+    tacky::Val generateExpression(const Exp &exp);
+
+    tacky::Val generateShortCircuit(const Binary &binary);
+
+    static tacky::Opcode unaryOpcode(UnaryOperator op);
+
+    static tacky::Opcode binaryOpcode(BinaryOperator op);
+
+    tacky::Function &m_function;
+};
@@ -0,0 +1,232 @@
+#include "text_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MCC_X86_SIMD 1
+#endif
+
+namespace {
+
+    size_t skipSpaceScalar(const char *text, size_t position, size_t end) {
+        while (position < end && TextScanner::isSpace(text[position])) {
+            ++position;
+        }
+        return position;
+    }
+
+    size_t findNewlineScalar(const char *text, size_t position, size_t end) {
+        while (position < end && text[position] != '\n') {
+            ++position;
+        }
+        return position;
+    }
+
+    size_t findCommentEndScalar(const char *text, size_t position, size_t end) {
+        for (; position + 1 < end; ++position) {
+            if (text[position] == '*' && text[position + 1] == '/') {
+                return position;
+            }
+        }
+        return end;
+    }
+
+#ifdef MCC_X86_SIMD
+
+    // Whitespace is ' ' or a byte in '\t'..'\r': subtracting '\t' maps that range to 0..4, which is the only
+    // case where the unsigned minimum with 4 leaves the byte unchanged
+    __attribute__((target("sse2"))) inline __m128i spaceMask(__m128i bytes) {
+        __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        return _mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+    }
+
+    __attribute__((target("sse2"))) size_t skipSpaceSse2(const char *text, size_t position, size_t end) {
+        for (; position + 16 <= end; position += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + position));
+            auto other = static_cast<unsigned>(~_mm_movemask_epi8(spaceMask(bytes))) & 0xFFFF;
+            if (other) {
+                return position + __builtin_ctz(other);
+            }
+        }
+        return skipSpaceScalar(text, position, end);
+    }
+
+    __attribute__((target("sse2"))) size_t findNewlineSse2(const char *text, size_t position, size_t end) {
+        const __m128i newline = _mm_set1_epi8('\n');
+        for (; position + 16 <= end; position += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + position));
+            auto found = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+            if (found) {
+                return position + __builtin_ctz(found);
+            }
+        }
+        return findNewlineScalar(text, position, end);
+    }
+
+    // Compares each block with '*' and the block one byte further on with '/'
+    __attribute__((target("sse2"))) size_t findCommentEndSse2(const char *text, size_t position, size_t end) {
+        const __m128i star = _mm_set1_epi8('*');
+        const __m128i slash = _mm_set1_epi8('/');
+        for (; position + 17 <= end; position += 16) {
+            __m128i here = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + position));
+            __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + position + 1));
+            auto found = static_cast<unsigned>(_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(here, star), _mm_cmpeq_epi8(next, slash))));
+            if (found) {
+                return position + __builtin_ctz(found);
+            }
+        }
+        return findCommentEndScalar(text, position, end);
+    }
+
+    __attribute__((target("avx2"))) inline __m256i spaceMask(__m256i bytes) {
+        __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        return _mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+    }
+
+    __attribute__((target("avx2"))) size_t skipSpaceAvx2(const char *text, size_t position, size_t end) {
+        for (; position + 32 <= end; position += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + position));
+            auto other = ~static_cast<unsigned>(_mm256_movemask_epi8(spaceMask(bytes)));
+            if (other) {
+                return position + __builtin_ctz(other);
+            }
+        }
+        return skipSpaceSse2(text, position, end);
+    }
+
+    __attribute__((target("avx2"))) size_t findNewlineAvx2(const char *text, size_t position, size_t end) {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        for (; position + 32 <= end; position += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + position));
+            auto found = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)));
+            if (found) {
+                return position + __builtin_ctz(found);
+            }
+        }
+        return findNewlineSse2(text, position, end);
+    }
+
+    __attribute__((target("avx2"))) size_t findCommentEndAvx2(const char *text, size_t position, size_t end) {
+        const __m256i star = _mm256_set1_epi8('*');
+        const __m256i slash = _mm256_set1_epi8('/');
+        for (; position + 33 <= end; position += 32) {
+            __m256i here = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + position));
+            __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + position + 1));
+            auto found = static_cast<unsigned>(_mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(here, star), _mm256_cmpeq_epi8(next, slash))));
+            if (found) {
+                return position + __builtin_ctz(found);
+            }
+        }
+        return findCommentEndSse2(text, position, end);
+    }
+
+#endif
+
+    constexpr TextScanner::Kernels kScalar{TextScanner::Isa::Scalar, skipSpaceScalar, findNewlineScalar,
+                                           findCommentEndScalar};
+#ifdef MCC_X86_SIMD
+    constexpr TextScanner::Kernels kSse2{TextScanner::Isa::Sse2, skipSpaceSse2, findNewlineSse2, findCommentEndSse2};
+    constexpr TextScanner::Kernels kAvx2{TextScanner::Isa::Avx2, skipSpaceAvx2, findNewlineAvx2, findCommentEndAvx2};
+#endif
+
+    const TextScanner::Kernels *kernelsFor(TextScanner::Isa isa) {
+        switch (isa) {
+#ifdef MCC_X86_SIMD
+            case TextScanner::Isa::Avx2:
+                return &kAvx2;
+            case TextScanner::Isa::Sse2:
+                return &kSse2;
+#endif
+            default:
+                return &kScalar;
+        }
+    }
+
+    const TextScanner::Kernels *detect() {
+#ifdef MCC_X86_SIMD
+        // Needed if this runs before libgcc's own constructor has identified the CPU
+        __builtin_cpu_init();
+#endif
+        if (TextScanner::supported(TextScanner::Isa::Avx2)) {
+            return kernelsFor(TextScanner::Isa::Avx2);
+        }
+        if (TextScanner::supported(TextScanner::Isa::Sse2)) {
+            return kernelsFor(TextScanner::Isa::Sse2);
+        }
+        return &kScalar;
+    }
+
+    const TextScanner::Kernels *install() {
+        const TextScanner::Kernels *kernels = detect();
+        TextScanner::use(kernels->isa);
+        return kernels;
+    }
+
+    size_t skipSpaceFirst(const char *text, size_t position, size_t end) {
+        return install()->skip_space(text, position, end);
+    }
+
+    size_t findNewlineFirst(const char *text, size_t position, size_t end) {
+        return install()->find_newline(text, position, end);
+    }
+
+    size_t findCommentEndFirst(const char *text, size_t position, size_t end) {
+        return install()->find_comment_end(text, position, end);
+    }
+
+    // Stands in until the first scan; its `isa` is never reported
+    constexpr TextScanner::Kernels kDetect{TextScanner::Isa::Scalar, skipSpaceFirst, findNewlineFirst,
+                                           findCommentEndFirst};
+
+} // namespace
+
+constinit std::atomic<const TextScanner::Kernels *> TextScanner::s_kernels{&kDetect};
+
+/**
+ * @brief Returns the instruction set the scans currently use.
+ */
+TextScanner::Isa TextScanner::isa() {
+    const Kernels *current = kernels();
+    return current == &kDetect ? install()->isa : current->isa;
+}
+
+/**
+ * @brief Returns whether this build and this CPU can run the scans with `isa`.
+ */
+bool TextScanner::supported(Isa isa) {
+    switch (isa) {
+        case Isa::Scalar:
+            return true;
+#ifdef MCC_X86_SIMD
+        case Isa::Sse2:
+            return __builtin_cpu_supports("sse2");
+        case Isa::Avx2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Switches every later scan to `isa`, which must be supported.
+ *
+ * @details Meant for tests and benchmarks; it is not synchronised with scans running on other threads.
+ */
+void TextScanner::use(Isa isa) {
+    s_kernels.store(kernelsFor(supported(isa) ? isa : Isa::Scalar), std::memory_order_relaxed);
+}
+
+const char *TextScanner::name(Isa isa) {
+    switch (isa) {
+        case Isa::Sse2:
+            return "sse2";
+        case Isa::Avx2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Scans source text for the lexer sixteen or thirty-two bytes at a time: past whitespace, to the end of a line
+ * comment and to the end of a block comment. The implementation is chosen on first use, from what the CPU
+ * supports (AVX2, then SSE2, then portable scalar code); `use` overrides the choice so the variants can be
+ * compared.
+ *
+ * Each scan looks at `text[position, end)` and returns the position it stopped at, or `end`.
+ */
+class TextScanner {
+public:
+    enum class Isa {
+        Scalar,
+        Sse2,
+        Avx2
+    };
+
+    /** Whether `c` is whitespace for std::isspace in the "C" locale: space, \t, \n, \v, \f or \r. */
+    static bool isSpace(char c) {
+        return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+    }
+
+    /** The first byte that is not whitespace. */
+    static size_t skipSpace(const char *text, size_t position, size_t end) {
+        // Most runs between tokens are a few bytes long, which is not worth a vector load
+        for (size_t limit = position + 4; position < end && position < limit; ++position) {
+            if (!isSpace(text[position])) {
+                return position;
+            }
+        }
+        return position < end ? kernels()->skip_space(text, position, end) : position;
+    }
+
+    /** The first '\n'. */
+    static size_t findNewline(const char *text, size_t position, size_t end) {
+        return kernels()->find_newline(text, position, end);
+    }
+
+    /** The first '*' that is followed by '/'. */
+    static size_t findCommentEnd(const char *text, size_t position, size_t end) {
+        return kernels()->find_comment_end(text, position, end);
+    }
+
+    static Isa isa();
+
+    static bool supported(Isa isa);
+
+    static void use(Isa isa);
+
+    static const char *name(Isa isa);
+
+    struct Kernels {
+        Isa isa;
+        size_t (*skip_space)(const char *, size_t, size_t);
+        size_t (*find_newline)(const char *, size_t, size_t);
+        size_t (*find_comment_end)(const char *, size_t, size_t);
+    };
+
+private:
+    static const Kernels *kernels() { return s_kernels.load(std::memory_order_relaxed); }
+
+    // Constant-initialised to kernels that detect the CPU on their first call, so scans work even from another
+    // translation unit's static initialiser
+    static constinit std::atomic<const Kernels *> s_kernels;
+};
@@ -0,0 +1,190 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace {
+
+    // The pool and deque index of the current thread, if it is a worker
+    thread_local const ThreadPool *t_pool = nullptr;
+    thread_local size_t t_index = 0;
+
+    /** Shared between the caller of parallelFor and the helper tasks, which may start after the loop is done. */
+    struct LoopState {
+        size_t count;
+        const std::function<void(size_t)> *body;
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        size_t finished = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+
+        void work() {
+            size_t completed = 0;
+            for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                if (!failed.load(std::memory_order_relaxed)) {
+                    try {
+                        (*body)(i);
+                    } catch (...) {
+                        std::lock_guard lock(mutex);
+                        if (!error) {
+                            error = std::current_exception();
+                        }
+                        failed = true;
+                    }
+                }
+                ++completed;
+            }
+            if (completed != 0) {
+                std::lock_guard lock(mutex);
+                finished += completed;
+                if (finished == count) {
+                    done.notify_all();
+                }
+            }
+        }
+    };
+
+} // namespace
+
+/**
+ * @brief Starts the workers.
+ *
+ * @param thread_count The number of worker threads; with none, tasks run on the thread that submits them.
+ * @param on_start Run first on each worker thread, e.g. to give it the working directory of a server client.
+ */
+ThreadPool::ThreadPool(unsigned thread_count, std::function<void()> on_start) {
+    for (unsigned i = 0; i < thread_count; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+    m_workers.reserve(thread_count);
+    for (unsigned i = 0; i < thread_count; ++i) {
+        m_workers.emplace_back([this, i, on_start] {
+            if (on_start) {
+                on_start();
+            }
+            workerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_available.notify_all();
+    for (auto &worker: m_workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Returns the number of hardware threads, or 1 if the platform cannot tell.
+ */
+unsigned ThreadPool::defaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief Queues a task. From one of this pool's workers it goes on that worker's own deque; from any other
+ *        thread the deques are filled round-robin. A pool without workers runs the task straight away.
+ *
+ * @param task The task; exceptions escaping it terminate the program, so it must handle its own errors.
+ */
+void ThreadPool::submit(std::function<void()> task) {
+    if (m_queues.empty()) {
+        task();
+        return;
+    }
+    size_t index = t_pool == this ? t_index : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+    {
+        // Counted before it is queued so that a worker taking it straight away never sees the count underflow
+        std::lock_guard lock(m_mutex);
+        ++m_pending;
+    }
+    {
+        std::lock_guard lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    m_available.notify_one();
+}
+
+/**
+ * @brief Calls `body(i)` for every `i` in `[0, count)`, spread over the workers and the calling thread.
+ *
+ * @details Indices are handed out one at a time from an atomic counter, so uneven items balance themselves.
+ *          Returns once every index has been processed. If a call throws, the remaining indices are skipped and
+ *          the first exception is rethrown here.
+ *
+ * @param count The number of indices.
+ * @param body The function to call for each index; it may run on any thread.
+ */
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &body) {
+    if (count == 0) {
+        return;
+    }
+    auto state = std::make_shared<LoopState>();
+    state->count = count;
+    state->body = &body;
+    size_t helpers = std::min<size_t>(m_workers.size(), count - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+        submit([state] { state->work(); });
+    }
+    state->work();
+
+    std::unique_lock lock(state->mutex);
+    state->done.wait(lock, [&] { return state->finished == count; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+/**
+ * @brief Takes the newest task from the worker's own deque, or else steals the oldest one from another worker.
+ *
+ * @param index The worker's index.
+ * @param task Receives the task.
+ * @return `false` if every deque was empty.
+ */
+bool ThreadPool::takeTask(size_t index, std::function<void()> &task) {
+    {
+        auto &own = *m_queues[index];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+        auto &victim = *m_queues[(index + offset) % m_queues.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    t_pool = this;
+    t_index = index;
+    for (;;) {
+        std::function<void()> task;
+        if (takeTask(index, task)) {
+            --m_pending;
+            task();
+            continue;
+        }
+        std::unique_lock lock(m_mutex);
+        m_available.wait(lock, [this] { return m_stopping || m_pending > 0; });
+        if (m_stopping && m_pending == 0) {
+            return;
+        }
+    }
+}
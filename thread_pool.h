@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads with one task deque each. A worker pops its own newest task first and, when its
+ * deque is empty, steals the oldest task from another worker, so tasks spawned from inside a task (a batch job
+ * generating its functions in parallel) stay local until someone is idle. `parallelFor` is the entry point the
+ * compiler uses: the calling thread works through the index range alongside the workers, so it also makes
+ * progress when called from inside a task.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned thread_count = defaultThreadCount(), std::function<void()> on_start = {});
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    void parallelFor(size_t count, const std::function<void(size_t)> &body);
+
+    unsigned size() const { return static_cast<unsigned>(m_workers.size()); }
+
+    static unsigned defaultThreadCount();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void workerLoop(size_t index);
+
+    bool takeTask(size_t index, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_next_queue{0};
+    std::atomic<size_t> m_pending{0};
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+    bool m_stopping = false;
+};
@@ -0,0 +1,151 @@
+#include "time_report.h"
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include "allocation_counter.h"
+
+namespace {
+
+    void writeJsonString(std::ostream &out, const std::string &text) {
+        out << '"';
+        for (char c: text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec
+                    << std::setfill(' ');
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    void writeJsonPhase(std::ostream &out, const TimeReport::Phase &phase) {
+        out << "{\"name\": ";
+        writeJsonString(out, phase.name);
+        out << ", \"wall_ms\": " << phase.wall_ms << ", \"cpu_ms\": " << phase.cpu_ms << ", \"allocations\": "
+            << phase.allocations << ", \"allocated_bytes\": " << phase.allocated_bytes;
+        for (const auto &[what, value]: phase.counts) {
+            out << ", ";
+            writeJsonString(out, what);
+            out << ": " << value;
+        }
+        out << "}";
+    }
+
+} // namespace
+
+TimeReport::TimeReport(std::string file) : m_enabled(true), m_file(std::move(file)) {}
+
+/**
+ * @brief Ends the current phase, if any, and starts timing the next one.
+ *
+ * @param phase The name of the phase, as shown in the report.
+ */
+void TimeReport::begin(const char *phase) {
+    if (!m_enabled) {
+        return;
+    }
+    finish();
+    m_phases.emplace_back();
+    m_phases.back().name = phase;
+    m_in_phase = true;
+    m_start = now();
+}
+
+/**
+ * @brief Attaches a count (tokens, nodes, instructions, bytes) to the most recent phase.
+ */
+void TimeReport::count(const char *what, uint64_t value) {
+    if (m_enabled && !m_phases.empty()) {
+        m_phases.back().counts.emplace_back(what, value);
+    }
+}
+
+/**
+ * @brief Ends the current phase. Called before printing; calling it again does nothing.
+ */
+void TimeReport::finish() {
+    if (!m_enabled || !m_in_phase) {
+        return;
+    }
+    Snapshot end = now();
+    Phase &phase = m_phases.back();
+    phase.wall_ms = std::chrono::duration<double, std::milli>(end.wall - m_start.wall).count();
+    phase.cpu_ms = end.cpu_ms - m_start.cpu_ms;
+    phase.allocations = end.allocations - m_start.allocations;
+    phase.allocated_bytes = end.allocated_bytes - m_start.allocated_bytes;
+    m_in_phase = false;
+}
+
+/**
+ * @brief Prints the report as a table, one row per phase and a total.
+ */
+void TimeReport::print(std::ostream &out) const {
+    if (!m_enabled) {
+        return;
+    }
+    std::ostringstream table;
+    table << "Time report for " << m_file << ":\n";
+    table << "  " << std::left << std::setw(12) << "phase" << std::right << std::setw(11) << "wall ms"
+          << std::setw(11) << "cpu ms" << std::setw(10) << "allocs" << std::setw(12) << "bytes" << "\n";
+    auto row = [&table](const Phase &phase) {
+        table << "  " << std::left << std::setw(12) << phase.name << std::right << std::fixed << std::setprecision(3)
+              << std::setw(11) << phase.wall_ms << std::setw(11) << phase.cpu_ms << std::setw(10)
+              << phase.allocations << std::setw(12) << phase.allocated_bytes;
+        for (const auto &[what, value]: phase.counts) {
+            table << "  " << what << "=" << value;
+        }
+        table << "\n";
+    };
+    for (const auto &phase: m_phases) {
+        row(phase);
+    }
+    row(total());
+    out << table.str() << std::flush;
+}
+
+/**
+ * @brief Writes the reports of every file compiled by one invocation as a JSON document.
+ *
+ * @details The shape is `{"files": [{"file": ..., "phases": [...], "total": {...}}]}`, where each phase has
+ *          `name`, `wall_ms`, `cpu_ms`, `allocations`, `allocated_bytes` and its counts as further members.
+ */
+void TimeReport::writeJson(std::ostream &out, const std::vector<TimeReport> &reports) {
+    out << "{\"files\": [";
+    for (size_t i = 0; i < reports.size(); ++i) {
+        const TimeReport &report = reports[i];
+        out << (i ? ",\n  " : "\n  ") << "{\"file\": ";
+        writeJsonString(out, report.m_file);
+        out << ", \"phases\": [";
+        for (size_t j = 0; j < report.m_phases.size(); ++j) {
+            out << (j ? ",\n    " : "\n    ");
+            writeJsonPhase(out, report.m_phases[j]);
+        }
+        out << "],\n   \"total\": ";
+        writeJsonPhase(out, report.total());
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+TimeReport::Snapshot TimeReport::now() {
+    timespec cpu{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    AllocationCounter::Totals allocated = AllocationCounter::totals();
+    double cpu_ms = static_cast<double>(cpu.tv_sec) * 1e3 + static_cast<double>(cpu.tv_nsec) / 1e6;
+    return {std::chrono::steady_clock::now(), cpu_ms, allocated.allocations, allocated.bytes};
+}
+
+TimeReport::Phase TimeReport::total() const {
+    Phase sum;
+    sum.name = "total";
+    for (const auto &phase: m_phases) {
+        sum.wall_ms += phase.wall_ms;
+        sum.cpu_ms += phase.cpu_ms;
+        sum.allocations += phase.allocations;
+        sum.allocated_bytes += phase.allocated_bytes;
+    }
+    return sum;
+}
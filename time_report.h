@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Wall time, CPU time and heap allocations per compiler phase, plus counts such as tokens or instructions that
+ * put the times in proportion. Phases run back to back: `begin` ends the current phase and starts the next.
+ * A disabled report ignores every call. CPU time is the process's, so it includes pool workers generating
+ * code in parallel (and, in batch mode, other files compiled at the same time).
+ */
+class TimeReport {
+public:
+    struct Phase {
+        std::string name;
+        double wall_ms = 0;
+        double cpu_ms = 0;
+        uint64_t allocations = 0;
+        uint64_t allocated_bytes = 0;
+        std::vector<std::pair<std::string, uint64_t>> counts;
+    };
+
+    TimeReport() = default;
+
+    explicit TimeReport(std::string file);
+
+    bool enabled() const { return m_enabled; }
+
+    void begin(const char *phase);
+
+    void count(const char *what, uint64_t value);
+
+    void finish();
+
+    void print(std::ostream &out) const;
+
+    static void writeJson(std::ostream &out, const std::vector<TimeReport> &reports);
+
+private:
+    struct Snapshot {
+        std::chrono::steady_clock::time_point wall;
+        double cpu_ms;
+        uint64_t allocations;
+        uint64_t allocated_bytes;
+    };
+
+    static Snapshot now();
+
+    Phase total() const;
+
+    bool m_enabled = false;
+    bool m_in_phase = false;
+    std::string m_file;
+    std::vector<Phase> m_phases;
+    Snapshot m_start{};
+};
@@ -0,0 +1,85 @@
+#include "token_stream.h"
+#include <algorithm>
+
+namespace {
+
+    // Tokens taken from a generator or a queue at a time. Generators resume once per token, so a small window
+    // is as fast as a large one; a queue hands over whole batches, so a larger window means fewer handoffs.
+    constexpr size_t kGeneratorWindow = 64;
+    constexpr size_t kQueueWindow = 1024;
+
+} // namespace
+
+/**
+ * @brief Reads tokens that have already been lexed, in place. The span must outlive the stream.
+ */
+TokenStream::TokenStream(std::span<const Token> tokens)
+        : m_tokens(tokens.data()), m_size(tokens.size()), m_count(tokens.size()) {
+    if (!tokens.empty()) {
+        m_last = tokens.back();
+    }
+}
+
+/**
+ * @brief Lexes on demand: the generator is resumed only when the parser needs a token it has not seen yet.
+ */
+TokenStream::TokenStream(Generator<Token> tokens)
+        : m_tokens(nullptr), m_size(0), m_generator(std::move(tokens)), m_buffer(kGeneratorWindow), m_count(0) {}
+
+/**
+ * @brief Reads tokens that another thread pushes into `queue`, one batch at a time.
+ */
+TokenStream::TokenStream(SpscQueue<Token> &queue)
+        : m_tokens(nullptr), m_size(0), m_queue(&queue), m_buffer(kQueueWindow), m_count(0) {}
+
+/**
+ * @brief Refills the window so that it reaches `ahead` tokens past the current one, if the input does.
+ *
+ * @details Tokens not yet consumed move to the front of the buffer and the rest of it is filled from the
+ *          source. A lexer error raised by a generator propagates from here.
+ *
+ * @param ahead How far past the current token the caller wants to read; less than kLookahead.
+ * @return The requested token, or nullptr if the input ends first.
+ */
+const Token *TokenStream::fill(size_t ahead) {
+    if (!m_generator && !m_queue) {
+        return nullptr;
+    }
+    size_t kept = m_size - m_position;
+    std::copy(m_tokens + m_position, m_tokens + m_size, m_buffer.begin());
+    m_tokens = m_buffer.data();
+    m_position = 0;
+    m_size = kept;
+    if (m_generator) {
+        while (m_size < m_buffer.size()) {
+            const Token *token = m_generator->next();
+            if (!token) {
+                break;
+            }
+            m_buffer[m_size++] = *token;
+        }
+    } else {
+        while (m_size <= ahead) {
+            size_t count = m_queue->pop(m_buffer.data() + m_size, m_buffer.size() - m_size);
+            if (count == 0) {
+                break;
+            }
+            m_size += count;
+        }
+    }
+    m_count += m_size - kept;
+    if (m_size > kept) {
+        m_last = m_buffer[m_size - 1];
+    }
+    return ahead < m_size ? &m_tokens[ahead] : nullptr;
+}
+
+/**
+ * @brief Returns where the input ends: just past the last token, or the start of the file if there was none.
+ */
+SourceLocation TokenStream::endLocation() const {
+    if (!m_last) {
+        return {};
+    }
+    return {m_last->location.offset + static_cast<uint32_t>(tokenText(*m_last).size())};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <vector>
+#include "generator.h"
+#include "lexer.h"
+#include "spsc_queue.h"
+
+/**
+ * The parser's view of its input: the tokens not yet consumed, readable a few at a time ahead of the current
+ * one. The tokens come from a vector that already holds them all (read in place, never copied), from a
+ * generator that lexes on demand, or from a queue filled by a lexer on another thread. The last two only ever
+ * hold a small window of tokens.
+ */
+class TokenStream {
+public:
+    static constexpr size_t kLookahead = 16;  // How far peek can see past the current token
+
+    explicit TokenStream(std::span<const Token> tokens);
+
+    explicit TokenStream(Generator<Token> tokens);
+
+    explicit TokenStream(SpscQueue<Token> &queue);
+
+    TokenStream(const TokenStream &) = delete;
+
+    TokenStream &operator=(const TokenStream &) = delete;
+
+    /** The token `ahead` places after the current one, or nullptr past the end of the input. */
+    const Token *peek(size_t ahead = 0) {
+        return m_position + ahead < m_size ? &m_tokens[m_position + ahead] : fill(ahead);
+    }
+
+    /** Consumes the current token; only valid after peek() returned one. */
+    void advance() { ++m_position; }
+
+    SourceLocation endLocation() const;
+
+    /** Tokens taken from the source so far, including any still waiting in the window. */
+    size_t count() const { return m_count; }
+
+private:
+    const Token *fill(size_t ahead);
+
+    const Token *m_tokens;  // The window being read: the caller's span, or m_buffer
+    size_t m_position = 0;
+    size_t m_size;
+    std::optional<Generator<Token>> m_generator;
+    SpscQueue<Token> *m_queue = nullptr;
+    std::vector<Token> m_buffer;
+    size_t m_count;
+    std::optional<Token> m_last;  // The last token read from the source, for the end-of-input location
+};
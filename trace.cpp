@@ -0,0 +1,147 @@
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+    constexpr size_t kRingSize = 1 << 16;  // Events kept per thread
+    constexpr size_t kChunkSize = 1 << 10; // Events allocated at a time as a ring fills
+    constexpr size_t kDetailSize = 48;     // Longer details (function or file names) are truncated
+
+    struct Event {
+        const char *name;
+        uint64_t start;
+        uint64_t end;
+        char detail[kDetailSize];
+    };
+
+    /**
+     * A thread's ring of events. It is allocated a chunk at a time, left uninitialised, so a thread's first
+     * event costs a small allocation rather than the whole ring.
+     */
+    struct Buffer {
+        std::vector<std::unique_ptr<Event[]>> chunks;
+        uint64_t written = 0;
+        unsigned tid = 0;
+
+        Event &at(uint64_t index) {
+            size_t slot = index % kRingSize;
+            return chunks[slot / kChunkSize][slot % kChunkSize];
+        }
+
+        Event &next() {
+            size_t slot = written % kRingSize;
+            if (slot / kChunkSize == chunks.size()) {
+                chunks.push_back(std::make_unique_for_overwrite<Event[]>(kChunkSize));
+            }
+            return at(written++);
+        }
+    };
+
+    // Buffers are owned here as well as by their thread, so events of pool workers that have exited are kept
+    std::mutex g_mutex;
+    std::vector<std::shared_ptr<Buffer>> g_buffers;
+    uint64_t g_start = 0;
+
+    Buffer &threadBuffer() {
+        thread_local std::shared_ptr<Buffer> buffer = [] {
+            auto created = std::make_shared<Buffer>();
+            created->chunks.reserve(kRingSize / kChunkSize);
+            created->chunks.push_back(std::make_unique_for_overwrite<Event[]>(kChunkSize));
+            std::lock_guard lock(g_mutex);
+            created->tid = static_cast<unsigned>(g_buffers.size() + 1);
+            g_buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    void writeJsonString(std::ostream &out, std::string_view text) {
+        out << '"';
+        for (char c: text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << ' ';
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+} // namespace
+
+/**
+ * @brief Turns recording on. Events are timed relative to this call.
+ *
+ * @details The calling thread's buffer is set up here, outside the traced work, which also makes it thread 1.
+ */
+void Trace::start() {
+    threadBuffer();
+    g_start = now();
+    s_enabled.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Writes every recorded event as a trace-event JSON file.
+ *
+ * @details Must be called once the traced work has finished; threads are not stopped while their buffers are
+ *          read. Events lost to a full ring buffer are counted in `otherData.dropped_events`.
+ *
+ * @param path The file to write.
+ * @returns `false` if the file could not be written.
+ */
+bool Trace::write(const std::string &path) {
+    std::ofstream out(path);
+    std::lock_guard lock(g_mutex);
+    uint64_t dropped = 0;
+    pid_t pid = getpid();
+    out << "{\"traceEvents\": [";
+    const char *separator = "\n";
+    out << std::fixed << std::setprecision(3);
+    for (const auto &buffer: g_buffers) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": "
+            << buffer->tid << ", \"args\": {\"name\": \"" << (buffer->tid == 1 ? "main" : "worker") << "\"}}";
+        separator = ",\n";
+        uint64_t first = buffer->written > kRingSize ? buffer->written - kRingSize : 0;
+        dropped += first;
+        for (uint64_t i = first; i < buffer->written; ++i) {
+            const Event &event = buffer->at(i);
+            out << ",\n{\"name\": \"" << event.name << "\", \"cat\": \"mcc\", \"ph\": \"X\", \"ts\": "
+                << static_cast<double>(event.start - g_start) / 1000.0 << ", \"dur\": "
+                << static_cast<double>(event.end - event.start) / 1000.0 << ", \"pid\": " << pid << ", \"tid\": "
+                << buffer->tid;
+            if (event.detail[0]) {
+                out << ", \"args\": {\"detail\": ";
+                writeJsonString(out, event.detail);
+                out << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+    return static_cast<bool>(out.flush());
+}
+
+uint64_t Trace::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Trace::record(const char *name, std::string_view detail, uint64_t start, uint64_t end) {
+    Event &event = threadBuffer().next();
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    size_t length = std::min(detail.size(), kDetailSize - 1);
+    std::memcpy(event.detail, detail.data(), length);
+    event.detail[length] = '\0';
+}
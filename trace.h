@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Records timed events in Chrome trace-event format (chrome://tracing, ui.perfetto.dev). Each thread appends
+ * completed events to a ring buffer of its own, so recording takes no lock; when a buffer is full its oldest
+ * events are overwritten. Until `start()` is called a `Trace::Scope` costs one relaxed load.
+ */
+class Trace {
+public:
+    class Scope {
+    public:
+        explicit Scope(const char *name, std::string_view detail = {}) {
+            if (enabled()) {
+                m_name = name;
+                m_detail = detail;
+                m_start = now();
+            }
+        }
+
+        Scope(const Scope &) = delete;
+
+        Scope &operator=(const Scope &) = delete;
+
+        ~Scope() {
+            if (m_name) {
+                record(m_name, m_detail, m_start, now());
+            }
+        }
+
+    private:
+        const char *m_name = nullptr;
+        std::string_view m_detail;  // Must outlive the scope
+        uint64_t m_start = 0;
+    };
+
+    static void start();
+
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    static bool write(const std::string &path);
+
+private:
+    static uint64_t now();
+
+    static void record(const char *name, std::string_view detail, uint64_t start, uint64_t end);
+
+    static inline std::atomic<bool> s_enabled{false};
+};
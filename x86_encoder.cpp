@@ -0,0 +1,418 @@
+#include "x86_encoder.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace x86 {
+
+    /**
+     * @brief Returns the AT&T name (without the `%`) of a register.
+     *
+     * @param number The register number, 0-15.
+     * @param size The width in bytes: 1, 4 or 8.
+     */
+    std::string_view registerName(uint8_t number, uint8_t size) {
+        static const char *const names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                              "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+        static const char *const names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                              "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+        static const char *const names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                             "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+        number &= 15;
+        return size == 8 ? names64[number] : size == 1 ? names8[number] : names32[number];
+    }
+
+    std::string_view conditionSuffix(Condition condition) {
+        switch (condition) {
+            case Condition::E:
+                return "e";
+            case Condition::NE:
+                return "ne";
+            case Condition::L:
+                return "l";
+            case Condition::GE:
+                return "ge";
+            case Condition::LE:
+                return "le";
+            case Condition::G:
+                return "g";
+        }
+        return {};
+    }
+
+    void Encoder::beginFunction(const std::string &name) {
+        m_symbols.push_back({name, m_code.size(), 0, true});
+    }
+
+    /**
+     * @brief Closes the current function, patching its jumps now that every label is bound.
+     *
+     * @throws std::runtime_error if a jump targets a label that was never bound.
+     */
+    void Encoder::endFunction() {
+        for (auto &fixup: m_fixups) {
+            auto label = m_labels.find(fixup.label);
+            if (label == m_labels.end()) {
+                throw std::runtime_error("Undefined label " + fixup.label);
+            }
+            fixup.target = label->second;
+        }
+        relaxJumps();
+        m_fixups.clear();
+        m_labels.clear();
+        m_symbols.back().size = m_code.size() - m_symbols.back().offset;
+    }
+
+    namespace {
+
+        size_t longSize(uint8_t opcode) {
+            return opcode == 0xE9 ? 5 : 6;     // jmp rel32 / 0F 8x jcc rel32
+        }
+
+        constexpr size_t kShortSize = 2;       // jmp rel8 (EB) / jcc rel8 (7x)
+
+    } // namespace
+
+    /**
+     * @brief Picks the shortest encoding for each jump of the current function and rewrites its code to match.
+     *
+     * @details Every jump is first assumed to fit in 8 bits. Jumps whose displacement doesn't fit are widened to
+     *          32 bits, which can only lengthen other jumps' displacements, so repeating this reaches a fixed point
+     *          with the fewest long jumps. The code is then compacted in place, since it only ever shrinks.
+     */
+    void Encoder::relaxJumps() {
+        if (m_fixups.empty()) {
+            return;
+        }
+        // saved[i] is how many bytes the first i jumps shrink by, so an offset moves back by saved[jumps before it]
+        std::vector<size_t> saved(m_fixups.size() + 1, 0);
+        auto relocate = [&](size_t offset) {
+            auto before = std::lower_bound(m_fixups.begin(), m_fixups.end(), offset,
+                                           [](const Fixup &fixup, size_t value) { return fixup.offset < value; });
+            return offset - saved[before - m_fixups.begin()];
+        };
+        bool changed = true;
+        while (changed) {
+            for (size_t i = 0; i < m_fixups.size(); ++i) {
+                const Fixup &fixup = m_fixups[i];
+                size_t shrink = fixup.wide ? 0 : longSize(m_code[fixup.offset]) - kShortSize;
+                saved[i + 1] = saved[i] + shrink;
+            }
+            changed = false;
+            for (auto &fixup: m_fixups) {
+                if (fixup.wide) {
+                    continue;
+                }
+                auto displacement = static_cast<int64_t>(relocate(fixup.target)) -
+                                    static_cast<int64_t>(relocate(fixup.offset) + kShortSize);
+                if (displacement < INT8_MIN || displacement > INT8_MAX) {
+                    fixup.wide = true;
+                    changed = true;
+                }
+            }
+        }
+
+        size_t write = m_fixups.front().offset;
+        size_t read = write;
+        for (const auto &fixup: m_fixups) {
+            while (read < fixup.offset) {
+                m_code[write++] = m_code[read++];
+            }
+            uint8_t opcode = m_code[read];
+            size_t long_size = longSize(opcode);
+            size_t size = fixup.wide ? long_size : kShortSize;
+            auto displacement = static_cast<uint32_t>(relocate(fixup.target) - (write + size));
+            if (fixup.wide) {
+                for (size_t i = 0; i < long_size - 4; ++i) {
+                    m_code[write++] = m_code[read + i];
+                }
+                for (int i = 0; i < 4; ++i) {
+                    m_code[write++] = static_cast<uint8_t>(displacement >> (8 * i));
+                }
+            } else {
+                // 0F 8x becomes 7x; E9 becomes EB
+                m_code[write++] = opcode == 0xE9 ? 0xEB : static_cast<uint8_t>(0x70 | (m_code[read + 1] & 0x0F));
+                m_code[write++] = static_cast<uint8_t>(displacement);
+            }
+            read += long_size;
+        }
+        while (read < m_code.size()) {
+            m_code[write++] = m_code[read++];
+        }
+        m_code.resize(write);
+    }
+
+    void Encoder::emitByte(uint8_t byte) {
+        m_code.push_back(byte);
+    }
+
+    void Encoder::emitImm32(int32_t value) {
+        auto bits = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; ++i) {
+            m_code.push_back(static_cast<uint8_t>(bits >> (8 * i)));
+        }
+    }
+
+    /**
+     * @brief Emits a REX prefix when the instruction needs one.
+     *
+     * @param wide Sets REX.W for 64-bit operand size.
+     * @param reg_field The register (or opcode extension) in the ModRM reg field.
+     * @param rm The register or memory operand in the ModRM r/m field.
+     * @param force Emit a REX prefix even if no bit is set (required for `spl`/`bpl`/`sil`/`dil`).
+     */
+    void Encoder::emitRex(bool wide, uint8_t reg_field, const Operand &rm, bool force) {
+        uint8_t rex = 0x40;
+        if (wide) rex |= 0x08;
+        if (reg_field & 8) rex |= 0x04;
+        if (rm.kind != OperandKind::Immediate && (rm.reg & 8)) rex |= 0x01;
+        if (rex != 0x40 || force) {
+            emitByte(rex);
+        }
+    }
+
+    /**
+     * @brief Emits the ModRM byte, plus SIB and displacement for memory operands.
+     *
+     * @details `rsp`/`r12` bases need a SIB byte, and `rbp`/`r13` bases always need a displacement because the
+     *          displacement-free encoding means RIP-relative.
+     */
+    void Encoder::emitModRM(uint8_t reg_field, const Operand &rm) {
+        uint8_t reg_bits = static_cast<uint8_t>((reg_field & 7) << 3);
+        if (rm.kind == OperandKind::Register) {
+            emitByte(0xC0 | reg_bits | (rm.reg & 7));
+            return;
+        }
+        uint8_t base = rm.reg & 7;
+        uint8_t mod;
+        if (rm.value == 0 && base != 5) {
+            mod = 0x00;
+        } else if (rm.value >= -128 && rm.value <= 127) {
+            mod = 0x40;
+        } else {
+            mod = 0x80;
+        }
+        emitByte(mod | reg_bits | base);
+        if (base == 4) {
+            emitByte(0x24);
+        }
+        if (mod == 0x40) {
+            emitByte(static_cast<uint8_t>(static_cast<int8_t>(rm.value)));
+        } else if (mod == 0x80) {
+            emitImm32(rm.value);
+        }
+    }
+
+    /**
+     * @brief Encodes a 32-bit `mov`.
+     *
+     * @param dst A register or memory destination.
+     * @param src A register, memory or immediate source; at most one of the operands may be in memory.
+     */
+    void Encoder::mov32(const Operand &dst, const Operand &src) {
+        if (dst.kind == OperandKind::Immediate) {
+            throw std::runtime_error("mov destination cannot be an immediate");
+        }
+        if (src.kind == OperandKind::Immediate) {
+            if (dst.kind == OperandKind::Register) {
+                emitRex(false, 0, dst);
+                emitByte(0xB8 + (dst.reg & 7));       // mov r32, imm32
+            } else {
+                emitRex(false, 0, dst);
+                emitByte(0xC7);                       // mov r/m32, imm32
+                emitModRM(0, dst);
+            }
+            emitImm32(src.value);
+        } else if (src.kind == OperandKind::Register) {
+            emitRex(false, src.reg, dst);
+            emitByte(0x89);                           // mov r/m32, r32
+            emitModRM(src.reg, dst);
+        } else if (dst.kind == OperandKind::Register) {
+            emitRex(false, dst.reg, src);
+            emitByte(0x8B);                           // mov r32, r/m32
+            emitModRM(dst.reg, src);
+        } else {
+            throw std::runtime_error("mov cannot have two memory operands");
+        }
+    }
+
+    /**
+     * @brief Encodes one of the classic two-operand ALU instructions (`add`, `sub`, `xor`, `cmp`).
+     *
+     * @details Uses the same forms as GNU as: the sign-extended imm8 form when the immediate fits, the short
+     *          `eax` form for other immediates into `eax`, and the register/memory forms otherwise.
+     *
+     * @param opcode The base opcode of the family (0x00 add, 0x28 sub, 0x30 xor, 0x38 cmp).
+     * @param extension The ModRM reg field used by the immediate forms.
+     */
+    void Encoder::emitAlu(uint8_t opcode, uint8_t extension, const Operand &dst, const Operand &src) {
+        if (dst.kind == OperandKind::Immediate) {
+            throw std::runtime_error("ALU destination cannot be an immediate");
+        }
+        if (src.kind == OperandKind::Immediate) {
+            bool imm8 = src.value >= -128 && src.value <= 127;
+            if (!imm8 && dst.kind == OperandKind::Register && dst.reg == 0) {
+                emitByte(opcode + 5);                 // op eax, imm32
+                emitImm32(src.value);
+                return;
+            }
+            emitRex(false, 0, dst);
+            emitByte(imm8 ? 0x83 : 0x81);             // op r/m32, imm8 / imm32
+            emitModRM(extension, dst);
+            if (imm8) {
+                emitByte(static_cast<uint8_t>(static_cast<int8_t>(src.value)));
+            } else {
+                emitImm32(src.value);
+            }
+        } else if (src.kind == OperandKind::Register) {
+            emitRex(false, src.reg, dst);
+            emitByte(opcode + 1);                     // op r/m32, r32
+            emitModRM(src.reg, dst);
+        } else if (dst.kind == OperandKind::Register) {
+            emitRex(false, dst.reg, src);
+            emitByte(opcode + 3);                     // op r32, r/m32
+            emitModRM(dst.reg, src);
+        } else {
+            throw std::runtime_error("ALU instruction cannot have two memory operands");
+        }
+    }
+
+    void Encoder::add32(const Operand &dst, const Operand &src) {
+        emitAlu(0x00, 0, dst, src);
+    }
+
+    void Encoder::sub32(const Operand &dst, const Operand &src) {
+        emitAlu(0x28, 5, dst, src);
+    }
+
+    void Encoder::xor32(const Operand &dst, const Operand &src) {
+        emitAlu(0x30, 6, dst, src);
+    }
+
+    void Encoder::cmp32(const Operand &dst, const Operand &src) {
+        emitAlu(0x38, 7, dst, src);
+    }
+
+    /**
+     * @brief Encodes a 32-bit signed multiply into a register.
+     *
+     * @param dst The destination register.
+     * @param src A register, memory or immediate multiplier.
+     */
+    void Encoder::imul32(const Operand &dst, const Operand &src) {
+        if (dst.kind != OperandKind::Register) {
+            throw std::runtime_error("imul destination must be a register");
+        }
+        if (src.kind == OperandKind::Immediate) {
+            bool imm8 = src.value >= -128 && src.value <= 127;
+            emitRex(false, dst.reg, dst);
+            emitByte(imm8 ? 0x6B : 0x69);             // imul r32, r/m32, imm8 / imm32
+            emitModRM(dst.reg, dst);
+            if (imm8) {
+                emitByte(static_cast<uint8_t>(static_cast<int8_t>(src.value)));
+            } else {
+                emitImm32(src.value);
+            }
+            return;
+        }
+        emitRex(false, dst.reg, src);
+        emitByte(0x0F);
+        emitByte(0xAF);                               // imul r32, r/m32
+        emitModRM(dst.reg, src);
+    }
+
+    /**
+     * @brief Encodes a unary group-3 instruction (`not`, `neg`, `idiv`) on a register or memory operand.
+     */
+    void Encoder::emitGroup3(uint8_t extension, const Operand &operand) {
+        if (operand.kind == OperandKind::Immediate) {
+            throw std::runtime_error("Operand cannot be an immediate");
+        }
+        emitRex(false, 0, operand);
+        emitByte(0xF7);
+        emitModRM(extension, operand);
+    }
+
+    void Encoder::not32(const Operand &dst) {
+        emitGroup3(2, dst);
+    }
+
+    void Encoder::neg32(const Operand &dst) {
+        emitGroup3(3, dst);
+    }
+
+    void Encoder::idiv32(const Operand &src) {
+        emitGroup3(7, src);
+    }
+
+    void Encoder::cdq() {
+        emitByte(0x99);
+    }
+
+    /**
+     * @brief Encodes `setcc` into the low byte of a register or a byte of memory.
+     */
+    void Encoder::setcc(Condition condition, const Operand &dst) {
+        if (dst.kind == OperandKind::Immediate) {
+            throw std::runtime_error("setcc destination cannot be an immediate");
+        }
+        // Without a REX prefix, registers 4-7 would mean ah/ch/dh/bh instead of spl/bpl/sil/dil
+        bool force_rex = dst.kind == OperandKind::Register && dst.reg >= 4 && dst.reg < 8;
+        emitRex(false, 0, dst, force_rex);
+        emitByte(0x0F);
+        emitByte(0x90 | static_cast<uint8_t>(condition));
+        emitModRM(0, dst);
+    }
+
+    /**
+     * @brief Binds a label to the current position in the current function.
+     */
+    void Encoder::bindLabel(const std::string &label) {
+        if (!m_labels.emplace(label, m_code.size()).second) {
+            throw std::runtime_error("Duplicate label " + label);
+        }
+    }
+
+    void Encoder::jmp(const std::string &label) {
+        m_fixups.push_back({m_code.size(), label});
+        emitByte(0xE9);                               // jmp rel32
+        emitImm32(0);
+    }
+
+    void Encoder::jcc(Condition condition, const std::string &label) {
+        m_fixups.push_back({m_code.size(), label});
+        emitByte(0x0F);
+        emitByte(0x80 | static_cast<uint8_t>(condition));  // jcc rel32
+        emitImm32(0);
+    }
+
+    /**
+     * @brief Encodes the standard frame prologue: `push %rbp; mov %rsp, %rbp; sub $stack_size, %rsp`.
+     */
+    void Encoder::enterFrame(int32_t stack_size) {
+        emitByte(0x55);                               // push rbp
+        emitByte(0x48);
+        emitByte(0x89);
+        emitByte(0xE5);                               // mov rbp, rsp
+        if (stack_size > 0) {
+            Operand rsp = Operand::registerOperand(4, 8);
+            bool imm8 = stack_size <= 127;
+            emitRex(true, 0, rsp);
+            emitByte(imm8 ? 0x83 : 0x81);             // sub rsp, imm8 / imm32
+            emitModRM(5, rsp);
+            if (imm8) {
+                emitByte(static_cast<uint8_t>(stack_size));
+            } else {
+                emitImm32(stack_size);
+            }
+        }
+    }
+
+    void Encoder::leave() {
+        emitByte(0xC9);
+    }
+
+    void Encoder::ret() {
+        emitByte(0xC3);
+    }
+
+} // namespace x86
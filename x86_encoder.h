@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace x86 {
+
+    enum class OperandKind : uint8_t {
+        Register,
+        Memory,
+        Immediate
+    };
+
+    /**
+     * Machine-level operand: a register (number plus width in bytes), a [base + displacement] memory reference,
+     * or a 32-bit immediate.
+     */
+    struct Operand {
+        OperandKind kind;
+        uint8_t reg;
+        uint8_t size;
+        int32_t value;
+
+        static Operand registerOperand(uint8_t number, uint8_t size) {
+            return {OperandKind::Register, number, size, 0};
+        }
+
+        static Operand memory(uint8_t base, int32_t displacement) {
+            return {OperandKind::Memory, base, 0, displacement};
+        }
+
+        static Operand immediate(int32_t value) {
+            return {OperandKind::Immediate, 0, 0, value};
+        }
+    };
+
+    /**
+     * Register numbers as used in ModRM/REX encodings. The width is chosen by the instruction, so `AX` names
+     * %al, %eax or %rax.
+     */
+    enum RegisterNumber : uint8_t {
+        AX, CX, DX, BX, SP, BP, SI, DI, R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    std::string_view registerName(uint8_t number, uint8_t size);
+
+    /**
+     * Condition codes, numbered as in the low nibble of the `Jcc`/`SETcc` opcodes.
+     */
+    enum class Condition : uint8_t {
+        E = 0x4,
+        NE = 0x5,
+        L = 0xC,
+        GE = 0xD,
+        LE = 0xE,
+        G = 0xF
+    };
+
+    std::string_view conditionSuffix(Condition condition);
+
+    struct Symbol {
+        std::string name;
+        uint64_t offset;
+        uint64_t size;
+        bool global;
+    };
+
+    /**
+     * Encodes instructions straight into a byte buffer, recording the function symbols defined along the way.
+     * Jumps are emitted with 32-bit displacements and relaxed when the function ends: every jump starts out short
+     * (8-bit displacement) and only those whose target is out of reach are widened, so labels are local to the
+     * function being encoded.
+     */
+    class Encoder {
+    public:
+        void beginFunction(const std::string &name);
+
+        void endFunction();
+
+        void mov32(const Operand &dst, const Operand &src);
+
+        void add32(const Operand &dst, const Operand &src);
+
+        void sub32(const Operand &dst, const Operand &src);
+
+        void cmp32(const Operand &dst, const Operand &src);
+
+        void xor32(const Operand &dst, const Operand &src);
+
+        void imul32(const Operand &dst, const Operand &src);
+
+        void neg32(const Operand &dst);
+
+        void not32(const Operand &dst);
+
+        void idiv32(const Operand &src);
+
+        void cdq();
+
+        void setcc(Condition condition, const Operand &dst);
+
+        void bindLabel(const std::string &label);
+
+        void jmp(const std::string &label);
+
+        void jcc(Condition condition, const std::string &label);
+
+        void enterFrame(int32_t stack_size);
+
+        void leave();
+
+        void ret();
+
+        const std::vector<uint8_t> &code() const { return m_code; }
+
+        const std::vector<Symbol> &symbols() const { return m_symbols; }
+
+    private:
+        void emitByte(uint8_t byte);
+
+        void emitImm32(int32_t value);
+
+        void emitRex(bool wide, uint8_t reg_field, const Operand &rm, bool force = false);
+
+        void emitModRM(uint8_t reg_field, const Operand &rm);
+
+        void emitAlu(uint8_t opcode, uint8_t extension, const Operand &dst, const Operand &src);
+
+        void emitGroup3(uint8_t extension, const Operand &operand);
+
+        void relaxJumps();
+
+        struct Fixup {
+            size_t offset;      // Where the jump instruction starts, in its rel32 form
+            std::string label;
+            size_t target = 0;  // The label's offset, before relaxation
+            bool wide = false;  // Whether the jump keeps its rel32 form
+        };
+
+        std::vector<uint8_t> m_code;
+        std::vector<Symbol> m_symbols;
+        std::unordered_map<std::string, size_t> m_labels;
+        std::vector<Fixup> m_fixups;
+    };
+
+} // namespace x86